@@ -29,13 +29,24 @@
 #include <QtCore/QString>
 #include <QtCore/QByteArray>
 #include <QtCore/QQueue>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QVector>
 #include <QtCore/QtEndian>
 #include <QtCore/QElapsedTimer>
 #include <QtCore/QTimer>
+#include <QtCore/QDateTime>
+#include <QtCore/QCoreApplication>
 #include <QtNetwork/QTcpSocket>
 #include <QtNetwork/QHostAddress>
+#include <QtNetwork/QHostInfo>
 #include <limits>
 
+#ifdef Q_OS_UNIX
+#include <poll.h>
+#include <errno.h>
+#endif
+
 namespace Dcp {
 
 /*! \class Client
@@ -79,7 +90,23 @@ public:
 
     bool readNextMessageFromSocket();
     void writeMessageToSocket(const Message &msg);
+    void writeReplyToSocket(const Message &command, bool ack, int errorCode,
+                            const QByteArray &data);
+    void sendOrPaceMessage(const Message &msg);
+    int flushPaceQueues();
+    void clearPaceQueues();
+    void journalMessage(const Message &msg, bool sent);
+    void expireUnackedMessages();
+    void acknowledgeMessage(const Message &reply);
+    void replayJournal();
+    void clearJournal();
     void registerName(const QByteArray &deviceName);
+    void unregisterName(const QByteArray &deviceName);
+    void scheduleReconnect();
+    void lookupServerAddress();
+    void abortHostLookup();
+    quint32 nextRandom();
+    bool isLocalName(const QByteArray &name, const QByteArray &key) const;
     void incrementSnr() {
         snr = (snr < std::numeric_limits<quint32>::max()) ? snr+1 : 1;
     }
@@ -93,6 +120,17 @@ public:
     void _k_socketError(QAbstractSocket::SocketError error);
     void _k_readMessagesFromSocket();
     void _k_autoReconnectTimeout();
+    void _k_hostLookupFinished(const QHostInfo &hostInfo);
+    void _k_paceTimeout();
+
+    // messages with the PaceFlag waiting for a destination's token bucket
+    struct PaceQueue {
+        TokenBucket bucket;
+        QQueue<Message> queue;
+        bool custom;
+    };
+    typedef QHash<QByteArray, PaceQueue> PaceQueueHash;
+    PaceQueue & paceQueue(const QByteArray &destination);
 
     // private data
     Client * const q;
@@ -101,10 +139,33 @@ public:
     QString serverName;
     quint16 serverPort;
     QByteArray deviceName;
+    QList<QByteArray> aliases;
     QTimer *reconnectTimer;
+    ReconnectPolicy reconnectPolicy;
+    int reconnectAttempt;
+    quint32 randomState;
+    QHostAddress cachedAddress;  // server address used for reconnects
+    int lookupId;                // pending QHostInfo lookup or -1
     bool autoReconnect;
     bool connectionRequested;
     quint32 snr;
+    PaceQueueHash paceQueues;
+    double paceRate;
+    int paceBurst;
+    int pacedCount;
+    QTimer *paceTimer;
+    QElapsedTimer paceClock;
+
+    // outbound journal, see setJournalSize()
+    struct UnackedMessage {
+        Message msg;
+        qint64 sentTime;  // paceClock time
+    };
+    int journalSize;
+    int journalTimeout;
+    QList<UnackedMessage> unackedMessages;  // sent, waiting for a reply
+    QList<Message> pendingMessages;         // sent while not connected
+    int droppedCount;
 };
 
 ClientPrivate::ClientPrivate(Client *qq)
@@ -112,17 +173,37 @@ ClientPrivate::ClientPrivate(Client *qq)
       socket(new QTcpSocket),
       serverPort(0),
       reconnectTimer(new QTimer),
+      reconnectAttempt(0),
+      lookupId(-1),
       autoReconnect(false),
       connectionRequested(false),
-      snr(0)
+      snr(0),
+      paceRate(0.0),
+      paceBurst(1),
+      pacedCount(0),
+      paceTimer(new QTimer),
+      journalSize(0),
+      journalTimeout(10000),
+      droppedCount(0)
 {
-    reconnectTimer->setInterval(30000);
+    reconnectTimer->setSingleShot(true);
+    paceTimer->setSingleShot(true);
+    paceClock.start();
+
+    // the jitter must differ between processes started at the same time
+    randomState = quint32(QDateTime::currentMSecsSinceEpoch())
+            ^ quint32(QCoreApplication::applicationPid() << 16)
+            ^ quint32(quintptr(this));
+    if (randomState == 0)
+        randomState = 0x9e3779b9u;
 }
 
 ClientPrivate::~ClientPrivate()
 {
+    abortHostLookup();
     delete socket;
     delete reconnectTimer;
+    delete paceTimer;
 }
 
 /*! \todo Check for (FullHeaderSize + MessageDataLen) instead of
@@ -160,7 +241,10 @@ bool ClientPrivate::readNextMessageFromSocket()
                  "Multi-packet messages are currently not supported.");
     }
     else {
-        inQueue.enqueue(Message::fromByteArray(rawMsg));
+        Message msg = Message::fromByteArray(rawMsg);
+        if (!unackedMessages.isEmpty() && msg.isReply())
+            acknowledgeMessage(msg);
+        inQueue.enqueue(msg);
         emit q->messageReceived();
     }
 
@@ -180,6 +264,15 @@ void ClientPrivate::writeMessageToSocket(const Message &msg)
         return;
     }
 
+    // registration messages to the null device are never journaled
+    if (journalSize > 0 && !msg.destination().isEmpty()) {
+        bool connected = socket->state() == QAbstractSocket::ConnectedState;
+        if (!connected || !msg.isReply())
+            journalMessage(msg, connected);
+        if (!connected)
+            return;
+    }
+
     char pkgHeader[PacketHeaderSize];
     quint32 *pMsgSize = reinterpret_cast<quint32 *>(
                 pkgHeader + PacketMsgSizePos);
@@ -193,6 +286,254 @@ void ClientPrivate::writeMessageToSocket(const Message &msg)
     socket->write(msg.toByteArray());
 }
 
+/*
+    Encodes an ACK or reply to the command message directly into a packet
+    and writes it to the socket, without creating a Message object. Source
+    and destination are copied swapped from the command; ACK data is taken
+    from the ackTemplate()s and the error code of replies is converted in
+    place. Packets are assembled on the stack unless the reply data is
+    large. Replies that are subject to pacing or journaling take the normal
+    path through sendOrPaceMessage().
+ */
+void ClientPrivate::writeReplyToSocket(const Message &command, bool ack,
+                                       int errorCode, const QByteArray &data)
+{
+    quint16 flags = command.flags() | Message::ReplyFlag;
+    if (ack)
+        flags |= Message::UrgentFlag;
+
+    const char *prefix = ack ? ackTemplate(errorCode) : 0;
+    int dataSize = ack ? 0 : (data.isEmpty() ? 3 : data.size());
+    int maxSize = FullHeaderSize + MaxIntSize + AckDataSize + dataSize;
+    bool connected = socket->state() == QAbstractSocket::ConnectedState;
+    if (command.isNull() || (flags & Message::PaceFlag) ||
+            (journalSize > 0 && !connected) || maxSize > MaxPacketSize) {
+        sendOrPaceMessage(ack ? command.ackMessage(errorCode)
+                              : command.replyMessage(data, errorCode));
+        return;
+    }
+
+    enum { StackBufferSize = 512 };
+    char stackBuffer[StackBufferSize];
+    QByteArray heapBuffer;
+    char *buffer = stackBuffer;
+    if (maxSize > StackBufferSize) {
+        heapBuffer.resize(maxSize);
+        buffer = heapBuffer.data();
+    }
+
+    // message data
+    char *msg = buffer + PacketHeaderSize;
+    char *p = msg + MessageHeaderSize;
+    if (prefix) {
+        qCopy(prefix, prefix + AckDataSize, p);
+        p += AckDataSize;
+    }
+    else {
+        p = formatInt(p, errorCode);
+        if (ack) {
+            qCopy(" ACK", " ACK" + 4, p);
+            p += 4;
+        }
+        else {
+            *p++ = ' ';
+            if (data.isEmpty()) {
+                qCopy("FIN", "FIN" + 3, p);
+                p += 3;
+            }
+            else {
+                qCopy(data.constBegin(), data.constEnd(), p);
+                p += data.size();
+            }
+        }
+    }
+    quint32 msgDataSize = quint32(p - (msg + MessageHeaderSize));
+
+    // message header with swapped source and destination
+    QByteArray source = command.destination();
+    QByteArray destination = command.source();
+    qFill(msg, msg + MessageHeaderSize, '\0');
+    *reinterpret_cast<quint16 *>(msg + MessageFlagsPos) = qToBigEndian(flags);
+    *reinterpret_cast<quint32 *>(msg + MessageSnrPos) =
+            qToBigEndian(command.snr());
+    qCopy(source.constBegin(), source.constEnd(), msg + MessageSourcePos);
+    qCopy(destination.constBegin(), destination.constEnd(),
+          msg + MessageDestinationPos);
+    *reinterpret_cast<quint32 *>(msg + MessageDataLenPos) =
+            qToBigEndian(msgDataSize);
+
+    // packet header
+    *reinterpret_cast<quint32 *>(buffer + PacketMsgSizePos) =
+            qToBigEndian(msgDataSize);
+    *reinterpret_cast<quint32 *>(buffer + PacketOffsetPos) = 0;
+
+    socket->write(buffer, qint64(p - buffer));
+}
+
+/*
+    Writes the message to the socket, unless it has the PaceFlag set and the
+    token bucket of its destination is empty. In this case the message is
+    queued and will be written by the pace timer.
+ */
+void ClientPrivate::sendOrPaceMessage(const Message &msg)
+{
+    if (msg.isNull() || !msg.isPaced()) {
+        writeMessageToSocket(msg);
+        return;
+    }
+
+    PaceQueue &pq = paceQueue(msg.destination());
+    if (pq.queue.isEmpty() && pq.bucket.consume(paceClock.elapsed())) {
+        writeMessageToSocket(msg);
+        return;
+    }
+
+    pq.queue.enqueue(msg);
+    pacedCount++;
+    flushPaceQueues();
+}
+
+/*
+    Writes all queued messages for which tokens are available and restarts
+    the pace timer. Returns the time in milliseconds until the next queued
+    message can be written, or -1 if there are no queued messages left.
+ */
+int ClientPrivate::flushPaceQueues()
+{
+    const qint64 now = paceClock.elapsed();
+    int nextTimeout = -1;
+    PaceQueueHash::iterator it = paceQueues.begin();
+    for (; it != paceQueues.end(); ++it)
+    {
+        PaceQueue &pq = it.value();
+        while (!pq.queue.isEmpty() && pq.bucket.consume(now)) {
+            writeMessageToSocket(pq.queue.dequeue());
+            pacedCount--;
+        }
+        if (!pq.queue.isEmpty()) {
+            int msecs = pq.bucket.msecsUntilAvailable(now);
+            if (nextTimeout < 0 || msecs < nextTimeout)
+                nextTimeout = msecs;
+        }
+    }
+
+    if (nextTimeout >= 0)
+        paceTimer->start(nextTimeout);
+    else
+        paceTimer->stop();
+
+    return nextTimeout;
+}
+
+void ClientPrivate::clearPaceQueues()
+{
+    PaceQueueHash::iterator it = paceQueues.begin();
+    for (; it != paceQueues.end(); ++it)
+        it.value().queue.clear();
+    pacedCount = 0;
+    paceTimer->stop();
+}
+
+/*
+    Returns the pace queue for the given destination, which is created
+    using the default pacing rate if it does not exist yet.
+ */
+ClientPrivate::PaceQueue & ClientPrivate::paceQueue(
+    const QByteArray &destination)
+{
+    PaceQueueHash::iterator it = paceQueues.find(destination);
+    if (it == paceQueues.end()) {
+        PaceQueue pq;
+        pq.bucket.setRate(paceRate, paceBurst);
+        pq.custom = false;
+        it = paceQueues.insert(destination, pq);
+    }
+    return it.value();
+}
+
+/*
+    Adds a message to the journal; sent messages are kept until they are
+    acknowledged or expire, all other messages until the connection is
+    established. Both lists hold up to journalSize messages; only messages
+    that were never sent are counted as dropped when they are removed.
+ */
+void ClientPrivate::journalMessage(const Message &msg, bool sent)
+{
+    if (sent) {
+        expireUnackedMessages();
+        if (unackedMessages.size() >= journalSize)
+            unackedMessages.removeFirst();
+        UnackedMessage entry = { msg, paceClock.elapsed() };
+        unackedMessages.append(entry);
+    }
+    else {
+        if (pendingMessages.size() >= journalSize) {
+            pendingMessages.removeFirst();
+            droppedCount++;
+        }
+        pendingMessages.append(msg);
+    }
+}
+
+/*
+    Removes the sent messages that have not been acknowledged within
+    journalTimeout. Messages to devices that never reply would otherwise
+    stay in the journal and be sent again after every reconnect.
+ */
+void ClientPrivate::expireUnackedMessages()
+{
+    const qint64 expired = paceClock.elapsed() - journalTimeout;
+    while (!unackedMessages.isEmpty() &&
+           unackedMessages.first().sentTime <= expired)
+        unackedMessages.removeFirst();
+}
+
+/*
+    Removes the sent message the reply belongs to from the journal. Replies
+    carry the serial number of the command, and the command's destination
+    as source.
+ */
+void ClientPrivate::acknowledgeMessage(const Message &reply)
+{
+    for (int i = 0; i < unackedMessages.size(); ++i) {
+        const Message &msg = unackedMessages.at(i).msg;
+        if (msg.snr() == reply.snr() && msg.destination() == reply.source()) {
+            unackedMessages.removeAt(i);
+            return;
+        }
+    }
+}
+
+/*
+    Sends all journaled messages in a single batch: first the messages that
+    were sent but not acknowledged before the connection was lost, then the
+    messages that were sent while the client was not connected. Messages
+    with the PaceFlag are passed to the pacing engine. The messages are
+    journaled again when they are written.
+ */
+void ClientPrivate::replayJournal()
+{
+    expireUnackedMessages();
+    if (unackedMessages.isEmpty() && pendingMessages.isEmpty())
+        return;
+
+    QList<Message> messages;
+    foreach (const UnackedMessage &entry, unackedMessages)
+        messages.append(entry.msg);
+    messages += pendingMessages;
+    unackedMessages.clear();
+    pendingMessages.clear();
+    foreach (const Message &msg, messages)
+        sendOrPaceMessage(msg);
+    socket->flush();
+}
+
+void ClientPrivate::clearJournal()
+{
+    unackedMessages.clear();
+    pendingMessages.clear();
+}
+
 void ClientPrivate::registerName(const QByteArray &deviceName)
 {
     Message msg(snr, deviceName, QByteArray(), "HELO", 0);
@@ -201,6 +542,71 @@ void ClientPrivate::registerName(const QByteArray &deviceName)
     socket->flush();
 }
 
+void ClientPrivate::unregisterName(const QByteArray &deviceName)
+{
+    Message msg(snr, deviceName, QByteArray(), "BYE", 0);
+    incrementSnr();
+    writeMessageToSocket(msg);
+    socket->flush();
+}
+
+/*
+    Starts the reconnect timer with the delay for the next attempt given by
+    the reconnect policy.
+ */
+void ClientPrivate::scheduleReconnect()
+{
+    int msecs = reconnectPolicy.delay(reconnectAttempt, nextRandom());
+    if (reconnectAttempt < 64)
+        reconnectAttempt++;
+    reconnectTimer->start(msecs);
+}
+
+/*
+    Resolves the server name in the background, so that the next reconnect
+    attempt can use a fresh address without waiting for the name lookup.
+ */
+void ClientPrivate::lookupServerAddress()
+{
+    if (lookupId != -1 || QHostAddress(serverName).protocol() !=
+            QAbstractSocket::UnknownNetworkLayerProtocol)
+        return;
+    lookupId = QHostInfo::lookupHost(
+        serverName, q, SLOT(_k_hostLookupFinished(QHostInfo)));
+}
+
+void ClientPrivate::abortHostLookup()
+{
+    if (lookupId != -1) {
+        QHostInfo::abortHostLookup(lookupId);
+        lookupId = -1;
+    }
+}
+
+/*
+    Simple xorshift generator for the reconnect jitter; qrand() is seeded
+    identically in every process unless the application seeds it.
+ */
+quint32 ClientPrivate::nextRandom()
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+/*
+    Returns true if the device name refers to the device key, which is
+    a name truncated to the maximum size and stripped of trailing zeros.
+ */
+bool ClientPrivate::isLocalName(const QByteArray &name,
+                                const QByteArray &key) const
+{
+    QByteArray nameKey = name.left(MessageDeviceNameSize);
+    stripRight(nameKey);
+    return nameKey == key;
+}
+
 Client::State ClientPrivate::mapSocketState(
     QAbstractSocket::SocketState state)
 {
@@ -272,13 +678,21 @@ void ClientPrivate::_k_socketStateChanged(QAbstractSocket::SocketState state)
 {
     //qDebug() << "ClientPrivate::_k_socketStateChanged:" << state;
 
-    // register device name, when connected
-    if (state == QAbstractSocket::ConnectedState)
+    // register device name and additional names, when connected
+    if (state == QAbstractSocket::ConnectedState) {
+        reconnectAttempt = 0;
+        cachedAddress = socket->peerAddress();
         registerName(deviceName);
+        foreach (const QByteArray &alias, aliases)
+            registerName(alias);
+        replayJournal();
+    }
 
     if (autoReconnect && connectionRequested
-                      && state == QAbstractSocket::UnconnectedState)
-        reconnectTimer->start();
+                      && state == QAbstractSocket::UnconnectedState) {
+        scheduleReconnect();
+        lookupServerAddress();
+    }
     else
         reconnectTimer->stop();
 
@@ -305,10 +719,38 @@ void ClientPrivate::_k_autoReconnectTimeout()
 {
     //qDebug() << "ClientPrivate::_k_autoReconnectTimeout";
 
-    if (socket->state() == QAbstractSocket::UnconnectedState)
+    if (socket->state() != QAbstractSocket::UnconnectedState)
+        return;
+
+    // use the cached address to avoid a blocking name lookup
+    if (!cachedAddress.isNull())
+        socket->connectToHost(cachedAddress, serverPort);
+    else
         socket->connectToHost(serverName, serverPort);
 }
 
+void ClientPrivate::_k_hostLookupFinished(const QHostInfo &hostInfo)
+{
+    //qDebug() << "ClientPrivate::_k_hostLookupFinished";
+
+    if (hostInfo.lookupId() != lookupId)
+        return;
+    lookupId = -1;
+
+    // keep the current address if it is still valid
+    QList<QHostAddress> addresses = hostInfo.addresses();
+    if (hostInfo.error() == QHostInfo::NoError && !addresses.isEmpty()
+            && !addresses.contains(cachedAddress))
+        cachedAddress = addresses.first();
+}
+
+void ClientPrivate::_k_paceTimeout()
+{
+    //qDebug() << "ClientPrivate::_k_paceTimeout";
+
+    flushPaceQueues();
+}
+
 // ---------------------------------------------------------------------------
 
 /*! \brief Creates a Dcp::Client object.
@@ -332,6 +774,7 @@ Client::Client(QObject *parent)
     connect(d->socket, SIGNAL(readyRead()), SLOT(_k_readMessagesFromSocket()),
             Qt::DirectConnection);
     connect(d->reconnectTimer, SIGNAL(timeout()), SLOT(_k_autoReconnectTimeout()));
+    connect(d->paceTimer, SIGNAL(timeout()), SLOT(_k_paceTimeout()));
 }
 
 /*! \brief Destroys the client, closing the connection if neccessary.
@@ -369,13 +812,18 @@ void Client::connectToServer(const QString &serverName, quint16 serverPort,
     d->serverName = serverName;
     d->serverPort = serverPort;
     d->deviceName = deviceName;
+    d->cachedAddress.clear();
+    d->reconnectAttempt = 0;
+    d->abortHostLookup();
     d->socket->connectToHost(serverName, serverPort);
 }
 
 /*! \brief Disconnects from a DCP server.
 
     Any pending messages will be written to the socket and after that the
-    disconnected() signal will be emitted. If the blocking interface is used
+    disconnected() signal will be emitted. Paced messages that are still
+    waiting to be sent and the content of the outbound journal are
+    discarded. If the blocking interface is used
     (i.e. if no message loop exists and the disconnected() signal can not be
     handled), you need to call waitForDisconnected() to wait until the
     connection is closed.
@@ -385,6 +833,9 @@ void Client::connectToServer(const QString &serverName, quint16 serverPort,
 void Client::disconnectFromServer()
 {
     d->connectionRequested = false;
+    d->abortHostLookup();
+    d->clearPaceQueues();
+    d->clearJournal();
     d->socket->disconnectFromHost();
 }
 
@@ -447,7 +898,7 @@ Message Client::sendMessage(const QByteArray &destination,
 {
     Message msg(d->snr, d->deviceName, destination, data, flags);
     d->incrementSnr();
-    d->writeMessageToSocket(msg);
+    d->sendOrPaceMessage(msg);
     return msg;
 }
 
@@ -472,7 +923,7 @@ Message Client::sendMessage(const QByteArray &destination,
 {
     Message msg(d->snr, d->deviceName, destination, data, dcpFlags, userFlags);
     d->incrementSnr();
-    d->writeMessageToSocket(msg);
+    d->sendOrPaceMessage(msg);
     return msg;
 }
 
@@ -495,7 +946,7 @@ Message Client::sendMessage(quint32 snr, const QByteArray &destination,
                             const QByteArray &data, quint16 flags)
 {
     Message msg(snr, d->deviceName, destination, data, flags);
-    d->writeMessageToSocket(msg);
+    d->sendOrPaceMessage(msg);
     return msg;
 }
 
@@ -520,7 +971,7 @@ Message Client::sendMessage(quint32 snr, const QByteArray &destination,
                             quint8 userFlags)
 {
     Message msg(snr, d->deviceName, destination, data, dcpFlags, userFlags);
-    d->writeMessageToSocket(msg);
+    d->sendOrPaceMessage(msg);
     return msg;
 }
 
@@ -531,10 +982,46 @@ Message Client::sendMessage(quint32 snr, const QByteArray &destination,
     The given Message object is sent as is. The user is responsible to set the
     correct message source; it will not be corrected if it differs from the
     deviceName() of the sending Client object.
+
+    \note Messages with the Message::PaceFlag set are subject to pacing,
+          this applies to all overloaded sendMessage() methods.
+
+    \sa setPacing()
  */
 void Client::sendMessage(const Message &message)
 {
-    d->writeMessageToSocket(message);
+    d->sendOrPaceMessage(message);
+}
+
+/*! \brief Sends an ACK for a received command message.
+
+    This is equivalent to <code>sendMessage(command.ackMessage(errorCode))
+    </code>, but the ACK packet is encoded directly into the output buffer
+    of the socket without creating an intermediate Message object. For the
+    error codes defined in AckErrorCode no memory is allocated; the default
+    \a errorCode is Dcp::AckNoError.
+
+    \sa Message::ackMessage(), sendReply()
+ */
+void Client::sendAck(const Message &command, int errorCode)
+{
+    d->writeReplyToSocket(command, true, errorCode, QByteArray());
+}
+
+/*! \brief Sends a reply for a received command message.
+
+    This is equivalent to
+    <code>sendMessage(command.replyMessage(data, errorCode))</code>, but the
+    reply packet is encoded directly into the output buffer of the socket
+    without creating an intermediate Message object. An empty \a data is
+    sent as <code>FIN</code>.
+
+    \sa Message::replyMessage(), sendAck()
+ */
+void Client::sendReply(const Message &command, const QByteArray &data,
+                       int errorCode)
+{
+    d->writeReplyToSocket(command, false, errorCode, data);
 }
 
 /*! \brief Returns the number of messages that are available for reading.
@@ -559,6 +1046,43 @@ Message Client::readMessage()
     return d->inQueue.isEmpty() ? Message() : d->inQueue.dequeue();
 }
 
+/*! \brief Returns the number of unread messages addressed to the given
+           \a deviceName.
+
+    This is useful if the client serves more than one device name, see
+    addDeviceName().
+
+    \sa readMessage(const QByteArray &), messagesAvailable()
+ */
+int Client::messagesAvailable(const QByteArray &deviceName) const
+{
+    QByteArray key = deviceName.left(MessageDeviceNameSize);
+    stripRight(key);
+    int count = 0;
+    foreach (const Message &msg, d->inQueue)
+        if (msg.destination() == key)
+            count++;
+    return count;
+}
+
+/*! \brief Returns the next available message addressed to the given
+           \a deviceName and removes it from the input queue.
+
+    Messages for other device names stay in the input queue. If no unread
+    message is addressed to \a deviceName, a null-message is returned.
+
+    \sa messagesAvailable(const QByteArray &), addDeviceName()
+ */
+Message Client::readMessage(const QByteArray &deviceName)
+{
+    QByteArray key = deviceName.left(MessageDeviceNameSize);
+    stripRight(key);
+    for (int i = 0; i < d->inQueue.size(); ++i)
+        if (d->inQueue.at(i).destination() == key)
+            return d->inQueue.takeAt(i);
+    return Message();
+}
+
 /*! \brief Returns the current state of the client.
 
     This method can be used to check the current state of the client, e.g. if
@@ -651,6 +1175,66 @@ QByteArray Client::deviceName() const
     return d->deviceName;
 }
 
+/*! \brief Returns the device name and all additional device names of the
+           client.
+
+    \sa deviceName(), addDeviceName()
+ */
+QList<QByteArray> Client::deviceNames() const
+{
+    QList<QByteArray> names;
+    if (!d->deviceName.isEmpty())
+        names.append(d->deviceName);
+    return names + d->aliases;
+}
+
+/*! \brief Registers an additional device name on the client's connection.
+
+    Messages addressed to \a name are then delivered to this client, in
+    addition to the messages for deviceName(). This allows a single
+    connection to serve many logical devices. Incoming messages can be
+    separated by their destination with readMessage(const QByteArray &), and
+    replies created with Message::replyMessage() or Message::ackMessage()
+    automatically carry the right source name. To send other messages on
+    behalf of an additional name, create a Message object with \a name as
+    source and pass it to sendMessage(const Message &).
+
+    The name is registered immediately if the client is connected, and again
+    after every reconnect. The server silently ignores names that are
+    already in use.
+
+    \note This requires a server that supports additional device names.
+
+    \sa removeDeviceName(), deviceNames()
+ */
+void Client::addDeviceName(const QByteArray &name)
+{
+    QByteArray key = name.left(MessageDeviceNameSize);
+    stripRight(key);
+    if (key.isEmpty() || d->isLocalName(d->deviceName, key) ||
+            d->aliases.contains(key))
+        return;
+
+    d->aliases.append(key);
+    if (d->socket->state() == QAbstractSocket::ConnectedState)
+        d->registerName(key);
+}
+
+/*! \brief Releases a device name that was added with addDeviceName().
+
+    \sa addDeviceName(), deviceNames()
+ */
+void Client::removeDeviceName(const QByteArray &name)
+{
+    QByteArray key = name.left(MessageDeviceNameSize);
+    stripRight(key);
+    if (d->aliases.removeAll(key) == 0)
+        return;
+
+    if (d->socket->state() == QAbstractSocket::ConnectedState)
+        d->unregisterName(key);
+}
+
 /*! \brief Returns the host address of the local client socket if available;
            otherwise returns QHostAddress::Null.
 
@@ -687,44 +1271,294 @@ bool Client::autoReconnect() const
 
     If the auto-reconnect feature is enabled, the client tries to reconnect
     to the server if a connection attempt failed or the connection was
-    terminated by the server. The time between each reconnection attempt
-    can be set by using the setReconnectInterval(). If the connection was
+    terminated by the server. The time between the reconnection attempts
+    is determined by the reconnectPolicy(). If the connection was
     closed manually using the disconnectFromServer() method, no reconnection
     attempt will be performed. By default the auto-reconnect feature is
     disabled and must be enabled explicitly.
 
-    \sa autoReconnect(), setReconnectInterval()
+    Reconnection attempts use the server address of the last successful
+    connection, which is refreshed in the background, so that they do not
+    have to wait for a name lookup.
+
+    \sa autoReconnect(), setReconnectPolicy()
  */
 void Client::setAutoReconnect(bool enable)
 {
     d->autoReconnect = enable;
     if (enable && d->connectionRequested
                && d->socket->state() == QAbstractSocket::UnconnectedState)
-        d->reconnectTimer->start();
+        d->scheduleReconnect();
     else if (!enable)
         d->reconnectTimer->stop();
 }
 
-/*! \brief Returns the auto-reconnect interval in milliseconds.
+/*! \brief Returns the delay before the first reconnection attempt in
+           milliseconds.
 
-    The default value of the auto-reconnect interval is 30 seconds.
+    This is the same as reconnectPolicy().initialDelay().
 
-    \sa setReconnectInterval(), setAutoReconnect()
+    \sa setReconnectInterval(), reconnectPolicy()
  */
 int Client::reconnectInterval() const
 {
-    return d->reconnectTimer->interval();
+    return d->reconnectPolicy.initialDelay();
 }
 
-/*! \brief Sets the auto-reconnect interval in milliseconds.
+/*! \brief Sets a constant auto-reconnect interval in milliseconds.
 
-    The default value of the auto-reconnect interval is 30 seconds.
+    This is the same as calling setReconnectPolicy() with
+    ReconnectPolicy::fixedInterval(\a msecs). Consider using a policy with
+    exponential backoff and jitter instead, if many clients connect to the
+    same server.
 
-    \sa reconnectInterval(), setAutoReconnect()
+    \sa reconnectInterval(), setReconnectPolicy(), setAutoReconnect()
  */
 void Client::setReconnectInterval(int msecs)
 {
-    d->reconnectTimer->setInterval(msecs);
+    setReconnectPolicy(ReconnectPolicy::fixedInterval(msecs));
+}
+
+/*! \brief Returns the reconnect policy.
+
+    \sa setReconnectPolicy(), setAutoReconnect()
+ */
+ReconnectPolicy Client::reconnectPolicy() const
+{
+    return d->reconnectPolicy;
+}
+
+/*! \brief Sets the reconnect policy, which determines the delays between
+           the auto-reconnect attempts.
+
+    The default policy starts with a delay of 1 second and doubles it after
+    every failed attempt, up to 30 seconds, with full jitter. The new policy
+    is used starting with the next reconnection attempt.
+
+    \sa reconnectPolicy(), setAutoReconnect(), ReconnectPolicy
+ */
+void Client::setReconnectPolicy(const ReconnectPolicy &policy)
+{
+    d->reconnectPolicy = policy;
+}
+
+/*! \brief Returns the default pacing rate in messages per second.
+
+    A rate of 0 means that pacing is disabled, which is the default.
+
+    \sa setPacing(), pacingBurst()
+ */
+double Client::pacingRate() const
+{
+    return d->paceRate;
+}
+
+/*! \brief Returns the pacing rate in messages per second, that is used for
+           the given \a destination.
+
+    \sa setPacing(), pacingBurst()
+ */
+double Client::pacingRate(const QByteArray &destination) const
+{
+    ClientPrivate::PaceQueueHash::const_iterator it =
+            d->paceQueues.constFind(destination);
+    return it != d->paceQueues.constEnd() ? it.value().bucket.rate()
+                                          : d->paceRate;
+}
+
+/*! \brief Returns the default number of messages that can be sent in a
+           burst to a single destination.
+
+    \sa setPacing(), pacingRate()
+ */
+int Client::pacingBurst() const
+{
+    return d->paceBurst;
+}
+
+/*! \brief Returns the number of messages that can be sent in a burst to the
+           given \a destination.
+
+    \sa setPacing(), pacingRate()
+ */
+int Client::pacingBurst(const QByteArray &destination) const
+{
+    ClientPrivate::PaceQueueHash::const_iterator it =
+            d->paceQueues.constFind(destination);
+    return it != d->paceQueues.constEnd() ? int(it.value().bucket.burst())
+                                          : d->paceBurst;
+}
+
+/*! \brief Sets the default pacing rate and burst size.
+
+    \param rate the maximum number of messages per second that are sent to
+           a single destination; a value of 0 disables pacing
+    \param burst the maximum number of messages that can be sent to a
+           single destination at once
+
+    Messages with the Message::PaceFlag set are sent using a separate token
+    bucket for each destination device. If a destination's bucket is empty,
+    the message is queued and will be sent by a timer as soon as the rate
+    permits it; the sendMessage() methods never block. Messages without the
+    PaceFlag are always sent immediately and may therefore overtake queued
+    paced messages. The settings apply to all destinations which have not
+    been configured using setPacing(const QByteArray &, double, int).
+
+    If the blocking interface is used, waitForMessagesWritten() needs to be
+    called in order to send the queued messages.
+
+    \sa pacingRate(), pacingBurst(), messagesPaced(), Message::PaceFlag
+ */
+void Client::setPacing(double rate, int burst)
+{
+    d->paceRate = rate > 0.0 ? rate : 0.0;
+    d->paceBurst = burst > 0 ? burst : 1;
+    ClientPrivate::PaceQueueHash::iterator it = d->paceQueues.begin();
+    for (; it != d->paceQueues.end(); ++it)
+        if (!it.value().custom)
+            it.value().bucket.setRate(d->paceRate, d->paceBurst);
+    d->flushPaceQueues();
+}
+
+/*! \brief Sets the pacing rate and burst size for a single \a destination.
+
+    The settings override the default values set by
+    setPacing(double, int), until resetPacing() is called for the
+    \a destination.
+
+    \sa resetPacing(), pacingRate(), pacingBurst()
+ */
+void Client::setPacing(const QByteArray &destination, double rate, int burst)
+{
+    QByteArray key = destination.left(MessageDeviceNameSize);
+    stripRight(key);
+    ClientPrivate::PaceQueue &pq = d->paceQueue(key);
+    pq.bucket.setRate(rate > 0.0 ? rate : 0.0, burst > 0 ? burst : 1);
+    pq.custom = true;
+    d->flushPaceQueues();
+}
+
+/*! \brief Resets the pacing rate and burst size of the given \a destination
+           to the default values.
+
+    \sa setPacing()
+ */
+void Client::resetPacing(const QByteArray &destination)
+{
+    QByteArray key = destination.left(MessageDeviceNameSize);
+    stripRight(key);
+    ClientPrivate::PaceQueueHash::iterator it = d->paceQueues.find(key);
+    if (it == d->paceQueues.end())
+        return;
+    it.value().bucket.setRate(d->paceRate, d->paceBurst);
+    it.value().custom = false;
+    d->flushPaceQueues();
+}
+
+/*! \brief Returns the number of paced messages, which are waiting to be
+           sent.
+
+    \sa setPacing(), waitForMessagesWritten()
+ */
+int Client::messagesPaced() const
+{
+    return d->pacedCount;
+}
+
+/*! \brief Returns the maximum number of messages held by the outbound
+           journal, or 0 if the journal is disabled.
+
+    \sa setJournalSize()
+ */
+int Client::journalSize() const
+{
+    return d->journalSize;
+}
+
+/*! \brief Enables the outbound journal, which holds up to \a messages
+           messages; a value of 0 disables the journal.
+
+    The journal keeps up to \a messages messages that are sent while the
+    client is not connected, and separately up to \a messages sent
+    messages until their first reply (usually the ACK) arrives or the
+    journalTimeout() expires. When the connection is established again,
+    e.g. by the auto-reconnect feature, all journaled messages are sent in a
+    single batch right after the device name has been registered. Messages
+    that were sent but not acknowledged before the connection was lost come
+    first, followed by the messages that were sent while disconnected.
+    Messages with the Message::PaceFlag set are subject to pacing.
+
+    Thus recovering from a lost connection does not require resending the
+    whole state of a device. The delivery is at-least-once: a message that
+    was received, but not answered before the connection was lost, is
+    delivered again. Receivers of journaled messages must therefore handle
+    duplicates, e.g. by using idempotent commands.
+
+    If the journal of unsent messages is full, the oldest message is
+    dropped, see messagesDropped(). Unacknowledged messages that are
+    removed because of the size limit or the timeout are not counted, since
+    they have already been sent. The journal is disabled by default, and it
+    is cleared by disconnectFromServer().
+
+    \sa messagesJournaled(), setJournalTimeout(), setAutoReconnect()
+ */
+void Client::setJournalSize(int messages)
+{
+    d->journalSize = qMax(messages, 0);
+    while (d->unackedMessages.size() > d->journalSize)
+        d->unackedMessages.removeFirst();
+    while (d->pendingMessages.size() > d->journalSize) {
+        d->pendingMessages.removeFirst();
+        d->droppedCount++;
+    }
+}
+
+/*! \brief Returns the time in milliseconds sent messages are kept in the
+           outbound journal while waiting for a reply.
+
+    The default timeout is 10 seconds.
+
+    \sa setJournalTimeout()
+ */
+int Client::journalTimeout() const
+{
+    return d->journalTimeout;
+}
+
+/*! \brief Sets the time in milliseconds sent messages are kept in the
+           outbound journal while waiting for a reply.
+
+    Messages to devices that do not reply, e.g. telemetry, are removed from
+    the journal after this time, so that they are not sent again after a
+    reconnect.
+
+    \sa setJournalSize()
+ */
+void Client::setJournalTimeout(int msecs)
+{
+    d->journalTimeout = qMax(msecs, 0);
+    d->expireUnackedMessages();
+}
+
+/*! \brief Returns the number of messages in the outbound journal, i.e. the
+           number of unacknowledged messages and messages waiting for the
+           connection.
+
+    \sa setJournalSize()
+ */
+int Client::messagesJournaled() const
+{
+    return d->unackedMessages.size() + d->pendingMessages.size();
+}
+
+/*! \brief Returns the number of messages that were dropped because the
+           outbound journal was full.
+
+    \sa setJournalSize()
+ */
+int Client::messagesDropped() const
+{
+    return d->droppedCount;
 }
 
 /*! \brief Waits until the client is connected to the server, up to \a msecs
@@ -801,24 +1635,126 @@ bool Client::waitForReadyRead(int msecs)
     written, this method returns true; otherwise it returns false.  If
     \a msecs is -1, this method will not time out.
 
-    \sa waitForReadyRead()
+    Paced messages are sent by this method as soon as the pacing rate permits
+    it, i.e. this method also waits until messagesPaced() returns 0.
+
+    \sa waitForReadyRead(), setPacing()
  */
 bool Client::waitForMessagesWritten(int msecs)
 {
     QElapsedTimer stopWatch;
     stopWatch.start();
 
-    while(d->socket->bytesToWrite() != 0)
+    while(d->socket->bytesToWrite() != 0 || d->pacedCount != 0)
     {
+        int paceTimeout = d->flushPaceQueues();
+
         int msecsLeft = timeoutValue(msecs, stopWatch.elapsed());
         if (msecsLeft == 0)
             break;
 
-        if (!d->socket->waitForBytesWritten(msecsLeft))
-            return false;
+        if (d->socket->bytesToWrite() != 0) {
+            if (!d->socket->waitForBytesWritten(msecsLeft))
+                return false;
+        }
+        else if (paceTimeout > 0) {
+            if (d->socket->state() != QAbstractSocket::ConnectedState)
+                return false;
+
+            // wait for the next paced message, incoming messages are
+            // handled by _k_readMessagesFromSocket() in the meantime
+            int waitTime = (msecsLeft < 0 || paceTimeout < msecsLeft) ?
+                        paceTimeout : msecsLeft;
+            if (d->socket->waitForReadyRead(waitTime))
+                d->_k_readMessagesFromSocket();
+        }
+    }
+
+    return d->socket->bytesToWrite() == 0 && d->pacedCount == 0;
+}
+
+/*! \brief Waits until a message is available for reading on any of the
+           given \a clients, up to \a msecs milliseconds.
+
+    Returns the list of clients that have at least one message available,
+    in the order in which they appear in \a clients. An empty list is
+    returned if no message arrived before the timeout. If \a msecs is -1,
+    this method will not time out.
+
+    Unlike calling waitForReadyRead() for each client in turn, the sockets
+    of all connected clients are watched with a single poll() call, so that
+    scripts talking to several servers or using several device names neither
+    busy-wait nor add latency. Clients that are not connected are ignored.
+
+    \sa waitForReadyRead(), messagesAvailable()
+ */
+QList<Client *> Client::waitForAny(const QList<Client *> &clients, int msecs)
+{
+    QElapsedTimer stopWatch;
+    stopWatch.start();
+
+    QList<Client *> readyClients;
+    forever {
+        // messages may already be queued, or data may already be buffered
+        // by the socket without having been read yet
+        for (int i = 0; i < clients.size(); ++i) {
+            ClientPrivate *cd = clients[i]->d;
+            if (cd->inQueue.isEmpty() && cd->socket->bytesAvailable() > 0)
+                cd->_k_readMessagesFromSocket();
+            if (!cd->inQueue.isEmpty())
+                readyClients.append(clients[i]);
+        }
+        if (!readyClients.isEmpty())
+            break;
+
+        int msecsLeft = timeoutValue(msecs, stopWatch.elapsed());
+        if (msecsLeft == 0)
+            break;
+
+#ifdef Q_OS_UNIX
+        QVector<pollfd> fds;
+        QVector<ClientPrivate *> polled;
+        for (int i = 0; i < clients.size(); ++i) {
+            ClientPrivate *cd = clients[i]->d;
+            int fd = int(cd->socket->socketDescriptor());
+            if (fd == -1 ||
+                    cd->socket->state() != QAbstractSocket::ConnectedState)
+                continue;
+            pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            fds.append(pfd);
+            polled.append(cd);
+        }
+        if (fds.isEmpty())
+            break;
+
+        int n = ::poll(fds.data(), nfds_t(fds.size()), msecsLeft);
+        if (n < 0 && errno != EINTR)
+            break;
+
+        // let the sockets pick up the pending data (or the disconnect)
+        // without blocking; messages are read in the next iteration
+        for (int i = 0; n > 0 && i < fds.size(); ++i)
+            if (fds[i].revents != 0)
+                polled[i]->socket->waitForReadyRead(0);
+#else
+        // no poll() available; wait on each connected socket in turn
+        bool connected = false;
+        for (int i = 0; i < clients.size(); ++i) {
+            QTcpSocket *socket = clients[i]->d->socket;
+            if (socket->state() != QAbstractSocket::ConnectedState)
+                continue;
+            connected = true;
+            socket->waitForReadyRead(qMin(msecsLeft < 0 ? 10 : msecsLeft, 10));
+        }
+        if (!connected)
+            break;
+#endif
     }
 
-    return d->socket->bytesToWrite() == 0;
+    return readyClients;
 }
 
 } // namespace Dcp
@@ -27,11 +27,14 @@
 #define DCPCLIENT_CLIENT_H
 
 #include "dcpclient_export.h"
+#include "reconnectpolicy.h"
 #include <QtCore/QObject>
 
 class QByteArray;
 class QString;
 class QHostAddress;
+class QHostInfo;
+template <typename T> class QList;
 
 namespace Dcp {
 
@@ -84,9 +87,14 @@ public:
                         const QByteArray &data, quint8 dcpFlags,
                         quint8 userFlags);
     void sendMessage(const Message &message);
+    void sendAck(const Message &command, int errorCode = 0);
+    void sendReply(const Message &command, const QByteArray &data,
+                   int errorCode = 0);
 
     int messagesAvailable() const;
+    int messagesAvailable(const QByteArray &deviceName) const;
     Message readMessage();
+    Message readMessage(const QByteArray &deviceName);
 
     Client::State state() const;
     bool isConnected() const;
@@ -99,6 +107,9 @@ public:
     QHostAddress serverAddress() const;
     quint16 serverPort() const;
     QByteArray deviceName() const;
+    QList<QByteArray> deviceNames() const;
+    void addDeviceName(const QByteArray &name);
+    void removeDeviceName(const QByteArray &name);
     QHostAddress localAddress() const;
     quint16 localPort() const;
 
@@ -106,12 +117,33 @@ public:
     void setAutoReconnect(bool enable);
     int reconnectInterval() const;
     void setReconnectInterval(int msecs);
+    ReconnectPolicy reconnectPolicy() const;
+    void setReconnectPolicy(const ReconnectPolicy &policy);
+
+    double pacingRate() const;
+    double pacingRate(const QByteArray &destination) const;
+    int pacingBurst() const;
+    int pacingBurst(const QByteArray &destination) const;
+    void setPacing(double rate, int burst = 1);
+    void setPacing(const QByteArray &destination, double rate, int burst = 1);
+    void resetPacing(const QByteArray &destination);
+    int messagesPaced() const;
+
+    int journalSize() const;
+    void setJournalSize(int messages);
+    int journalTimeout() const;
+    void setJournalTimeout(int msecs);
+    int messagesJournaled() const;
+    int messagesDropped() const;
 
     bool waitForConnected(int msecs = 10000);
     bool waitForDisconnected(int msecs = 10000);
     bool waitForReadyRead(int msecs = 10000);
     bool waitForMessagesWritten(int msecs = 10000);
 
+    static QList<Client *> waitForAny(const QList<Client *> &clients,
+                                      int msecs = 10000);
+
 signals:
     void connected();
     void disconnected();
@@ -125,6 +157,8 @@ private:
     Q_PRIVATE_SLOT(d, void _k_socketError(QAbstractSocket::SocketError))
     Q_PRIVATE_SLOT(d, void _k_readMessagesFromSocket())
     Q_PRIVATE_SLOT(d, void _k_autoReconnectTimeout())
+    Q_PRIVATE_SLOT(d, void _k_hostLookupFinished(QHostInfo))
+    Q_PRIVATE_SLOT(d, void _k_paceTimeout())
     Q_DISABLE_COPY(Client)
     friend class ClientPrivate;
     ClientPrivate * const d;
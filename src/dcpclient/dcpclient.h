@@ -27,8 +27,11 @@
 #define DCPCLIENT_H
 
 #include "client.h"
+#include "deviceserver.h"
 #include "message.h"
 #include "messageparser.h"
+#include "reconnectpolicy.h"
+#include "typedcommand.h"
 #include "version.h"
 
 #endif // DCPCLIENT_H
@@ -24,7 +24,9 @@
  */
 
 #include "dcpclient_p.h"
+#include "message.h"
 #include <QtCore/QByteArray>
+#include <cmath>
 
 namespace Dcp {
 
@@ -53,4 +55,124 @@ int timeoutValue(int msecs, int elapsed)
     return msecsLeft < 0 ? 0 : msecsLeft;
 }
 
+/*
+    Writes the decimal representation of value to buffer, which must hold at
+    least MaxIntSize characters, and returns a pointer past the last written
+    character. No terminating null character is written.
+ */
+char * formatInt(char *buffer, int value)
+{
+    char digits[MaxIntSize];
+    quint32 n = value < 0 ? 0u - quint32(value) : quint32(value);
+    int i = 0;
+    do {
+        digits[i++] = char('0' + n % 10);
+        n /= 10;
+    } while (n != 0);
+
+    if (value < 0)
+        *buffer++ = '-';
+    while (i > 0)
+        *buffer++ = digits[--i];
+    return buffer;
+}
+
+/*
+    Returns the pre-encoded data of an ACK message with one of the error
+    codes defined in AckErrorCode, or 0 for any other error code. The
+    returned strings have a size of AckDataSize.
+ */
+const char * ackTemplate(int errorCode)
+{
+    switch (errorCode)
+    {
+    case AckNoError:
+        return "0 ACK";
+    case AckUnknownCommandError:
+        return "2 ACK";
+    case AckParameterError:
+        return "3 ACK";
+    case AckWrongModeError:
+        return "5 ACK";
+    default:
+        return 0;
+    }
+}
+
+/*
+    Creates an unlimited token bucket.
+ */
+TokenBucket::TokenBucket()
+    : m_rate(0.0),
+      m_burst(1.0),
+      m_tokens(1.0),
+      m_lastUpdate(-1)
+{
+}
+
+/*
+    Creates a full token bucket that is refilled with the given rate and
+    holds at most burst tokens. A rate <= 0 disables the rate limit.
+ */
+TokenBucket::TokenBucket(double rate, double burst)
+    : m_rate(0.0),
+      m_burst(1.0),
+      m_tokens(1.0),
+      m_lastUpdate(-1)
+{
+    setRate(rate, burst);
+    m_tokens = m_burst;
+}
+
+/*
+    Changes rate and burst size; tokens that exceed the new burst size are
+    discarded.
+ */
+void TokenBucket::setRate(double rate, double burst)
+{
+    m_rate = rate;
+    m_burst = burst < 1.0 ? 1.0 : burst;
+    if (m_tokens > m_burst)
+        m_tokens = m_burst;
+}
+
+/*
+    Takes the given number of tokens from the bucket. Returns false, without
+    changing the bucket, if not enough tokens are available.
+ */
+bool TokenBucket::consume(qint64 now, double tokens)
+{
+    if (isUnlimited())
+        return true;
+    refill(now);
+    if (m_tokens < tokens)
+        return false;
+    m_tokens -= tokens;
+    return true;
+}
+
+/*
+    Returns the time in milliseconds until the given number of tokens will
+    be available, or 0 if they are already available.
+ */
+int TokenBucket::msecsUntilAvailable(qint64 now, double tokens)
+{
+    if (isUnlimited())
+        return 0;
+    refill(now);
+    if (m_tokens >= tokens)
+        return 0;
+    return int(std::ceil((tokens - m_tokens) * 1000.0 / m_rate));
+}
+
+void TokenBucket::refill(qint64 now)
+{
+    if (m_lastUpdate >= 0 && now > m_lastUpdate) {
+        m_tokens += (now - m_lastUpdate) * m_rate / 1000.0;
+        if (m_tokens > m_burst)
+            m_tokens = m_burst;
+    }
+    m_lastUpdate = now;
+}
+
 } // namespace Dcp
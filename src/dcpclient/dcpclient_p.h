@@ -33,6 +33,8 @@
     Don't use this file as its content may change in future.
  */
 
+#include <QtCore/QtGlobal>
+
 class QByteArray;
 
 namespace Dcp {
@@ -49,11 +51,42 @@ enum {
     PacketMsgSizePos = 0,
     PacketOffsetPos = 4,
     FullHeaderSize = MessageHeaderSize + PacketHeaderSize,
-    MaxPacketSize = 0x10000
+    MaxPacketSize = 0x10000,
+    MaxIntSize = 11,   // characters of the longest int, including the sign
+    AckDataSize = 5    // size of the ackTemplate() strings
 };
 
 void stripRight(QByteArray &ba, char c = '\0');
 int timeoutValue(int msecs, int elapsed);
+char * formatInt(char *buffer, int value);
+const char * ackTemplate(int errorCode);
+
+/*
+    Simple token bucket, used for rate limiting. The rate is given in tokens
+    per second, timestamps are monotonic times in milliseconds.
+ */
+class TokenBucket
+{
+public:
+    TokenBucket();
+    TokenBucket(double rate, double burst);
+
+    double rate() const { return m_rate; }
+    double burst() const { return m_burst; }
+    void setRate(double rate, double burst);
+    bool isUnlimited() const { return m_rate <= 0.0; }
+
+    bool consume(qint64 now, double tokens = 1.0);
+    int msecsUntilAvailable(qint64 now, double tokens = 1.0);
+
+private:
+    void refill(qint64 now);
+
+    double m_rate;
+    double m_burst;
+    double m_tokens;
+    qint64 m_lastUpdate;
+};
 
 } // namespace Dcp
 
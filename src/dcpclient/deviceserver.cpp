@@ -0,0 +1,608 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "deviceserver.h"
+#include "client.h"
+#include "message.h"
+#include "typedcommand.h"
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+#include <QtCore/QHash>
+#include <QtCore/QPointer>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QMetaMethod>
+#include <cstring>
+
+namespace Dcp {
+
+/*! \class DeviceRequest
+    \brief A command message dispatched by a DeviceServer.
+
+    DeviceRequest objects are passed to the command handlers of a
+    DeviceServer. They provide the parsed command and collect the response
+    of the handler: the reply data, or an ACK error code if the command is
+    rejected.
+
+    \sa DeviceServer
+ */
+
+/*! \class ReplySink
+    \brief Interface for sending the ACKs and replies of a DeviceServer.
+
+    A DeviceServer that is not bound to a Client passes the answers to
+    the commands it handles to a ReplySink. The \a command argument is the
+    command message being answered, so that a sink serving several
+    connections can find the connection of the sender.
+
+    \fn void ReplySink::sendAck(const Message &command, int errorCode)
+    \brief Sends an ACK with the given \a errorCode for \a command.
+
+    \fn void ReplySink::sendReply(const Message &command, const QByteArray &data, int errorCode)
+    \brief Sends a reply with \a data and \a errorCode for \a command.
+           An empty \a data is sent as <code>FIN</code>.
+
+    \sa DeviceServer, Client::sendAck(), Client::sendReply()
+ */
+
+/*! \class DeviceServer
+    \brief Dispatches command messages to registered handlers.
+
+    The DeviceServer class reads the command messages received by a Client
+    and calls the handler that was registered for the command type and
+    identifier with addCommand(). Handlers are looked up by a single hash
+    lookup, so that the dispatch time does not depend on the number of
+    commands. The command is split in place, without copying the message
+    data; the identifier and arguments of a DeviceRequest are only copied
+    when a handler asks for them. Unknown commands and commands with a
+    wrong number of arguments are answered with an ACK error automatically.
+
+    Handlers are slots with a single Dcp::DeviceRequest pointer argument.
+    The ACK is sent right after the handler returns and is followed by the
+    reply set with DeviceRequest::setReply(), or by a <code>FIN</code> reply
+    if no reply data was set. Handlers that need more time can call
+    DeviceRequest::defer() and send the reply later.
+
+    <b>Example:</b>
+    \code
+    class TimeDevice : public QObject
+    {
+        Q_OBJECT
+    public:
+        TimeDevice() : server(&client) {
+            server.addCommand(Dcp::CommandParser::GetCmd, "time",
+                              this, SLOT(getTime(Dcp::DeviceRequest *)));
+        }
+    public slots:
+        void getTime(Dcp::DeviceRequest *request) {
+            request->setReply(QTime::currentTime().toString().toLatin1());
+        }
+    private:
+        Dcp::Client client;
+        Dcp::DeviceServer server;
+    };
+    \endcode
+
+    Commands with typed arguments can be registered with typedCommand(),
+    which converts the arguments to the parameter types of the handler.
+
+    Reply messages are not dispatched, they are passed on by the
+    replyReceived() signal.
+
+    A server can also be used without a Client, e.g. by applications that
+    read their messages by other means. Such a server is created with a
+    ReplySink, which sends the ACKs and replies, and the command messages
+    are passed to it with handleMessage().
+
+    \fn void DeviceServer::replyReceived(const Dcp::Message &msg)
+    \brief This signal is emitted for every reply message read by the
+           server.
+ */
+
+// The requests of a DeviceServer live on the stack and refer to the
+// message data; the identifier and the argument list are only copied out
+// of it when they are asked for.
+class DeviceRequestPrivate
+{
+public:
+    DeviceRequestPrivate(const Message &msg_, CommandParser::CmdType cmdType_,
+                         const QByteArray &identifier_,
+                         const QList<QByteArray> &arguments_)
+        : msg(msg_), cmdType(cmdType_), identifierBegin(0),
+          argumentsBegin(0), end(0), parsed(true), identifier(identifier_),
+          arguments(arguments_), ackErrorCode(AckNoError), replyErrorCode(0),
+          deferred(false), ownedByRequest(true) {}
+
+    DeviceRequestPrivate(const Message &msg_, CommandParser::CmdType cmdType_,
+                         const char *identifierBegin_,
+                         const char *argumentsBegin_, const char *end_)
+        : msg(msg_), cmdType(cmdType_), identifierBegin(identifierBegin_),
+          argumentsBegin(argumentsBegin_), end(end_), parsed(false),
+          ackErrorCode(AckNoError), replyErrorCode(0), deferred(false),
+          ownedByRequest(false) {}
+
+    void parse() const;
+
+    Message msg;
+    CommandParser::CmdType cmdType;
+    const char *identifierBegin;  // ranges in the data of msg
+    const char *argumentsBegin;
+    const char *end;
+    mutable bool parsed;
+    mutable QByteArray identifier;
+    mutable QList<QByteArray> arguments;
+    int ackErrorCode;
+    QByteArray replyData;
+    int replyErrorCode;
+    bool deferred;
+    bool ownedByRequest;
+};
+
+void DeviceRequestPrivate::parse() const
+{
+    if (parsed)
+        return;
+    parsed = true;
+    identifier = QByteArray(identifierBegin,
+                            int(argumentsBegin - identifierBegin));
+    ArgumentTokenizer tokens(argumentsBegin, end);
+    const char *argBegin, *argEnd;
+    while (tokens.next(&argBegin, &argEnd))
+        arguments.append(QByteArray(argBegin, int(argEnd - argBegin)));
+}
+
+/*! \brief Creates a request for the command message \a msg. */
+DeviceRequest::DeviceRequest(const Message &msg,
+                             CommandParser::CmdType cmdType,
+                             const QByteArray &identifier,
+                             const QList<QByteArray> &arguments)
+    : d(new DeviceRequestPrivate(msg, cmdType, identifier, arguments))
+{
+}
+
+/*! \internal \brief Creates a request that uses the data \a dd, which is
+           not owned by the request.
+ */
+DeviceRequest::DeviceRequest(DeviceRequestPrivate &dd)
+    : d(&dd)
+{
+}
+
+/*! \brief Destroys the request. */
+DeviceRequest::~DeviceRequest()
+{
+    if (d->ownedByRequest)
+        delete d;
+}
+
+/*! \brief Returns the command message. */
+Message DeviceRequest::message() const
+{
+    return d->msg;
+}
+
+/*! \brief Returns the command type. */
+CommandParser::CmdType DeviceRequest::cmdType() const
+{
+    return d->cmdType;
+}
+
+/*! \brief Returns the command identifier. */
+QByteArray DeviceRequest::identifier() const
+{
+    d->parse();
+    return d->identifier;
+}
+
+/*! \brief Returns the command arguments. */
+QList<QByteArray> DeviceRequest::arguments() const
+{
+    d->parse();
+    return d->arguments;
+}
+
+/*! \brief Returns the argument at index \a i, or an empty byte array if
+           there is no such argument.
+ */
+QByteArray DeviceRequest::argument(int i) const
+{
+    d->parse();
+    return d->arguments.value(i);
+}
+
+/*! \brief Returns the number of arguments. */
+int DeviceRequest::numArguments() const
+{
+    d->parse();
+    return d->arguments.size();
+}
+
+/*! \brief Rejects the command.
+
+    The command is answered with the ACK error \a ackErrorCode and no reply
+    is sent.
+ */
+void DeviceRequest::reject(int ackErrorCode)
+{
+    d->ackErrorCode = ackErrorCode;
+}
+
+/*! \brief Sets the reply data and error code.
+
+    If no reply is set, the command is answered by a <code>FIN</code> reply.
+ */
+void DeviceRequest::setReply(const QByteArray &data, int errorCode)
+{
+    d->replyData = data;
+    d->replyErrorCode = errorCode;
+}
+
+/*! \brief Defers the reply.
+
+    Only the ACK is sent by the DeviceServer; the handler is responsible for
+    sending the reply later, e.g. with Message::replyMessage().
+ */
+void DeviceRequest::defer()
+{
+    d->deferred = true;
+}
+
+/*! \brief Returns the ACK error code set by reject(). */
+int DeviceRequest::ackErrorCode() const
+{
+    return d->ackErrorCode;
+}
+
+/*! \brief Returns the reply data set by setReply(). */
+QByteArray DeviceRequest::replyData() const
+{
+    return d->replyData;
+}
+
+/*! \brief Returns the reply error code set by setReply(). */
+int DeviceRequest::replyErrorCode() const
+{
+    return d->replyErrorCode;
+}
+
+/*! \brief Returns true if the reply has been deferred; otherwise returns
+           false.
+ */
+bool DeviceRequest::isDeferred() const
+{
+    return d->deferred;
+}
+
+
+/*! \brief Destroys the reply sink. */
+ReplySink::~ReplySink()
+{
+}
+
+// Sends the answers of a server that reads the messages of a Client.
+class ClientReplySink : public ReplySink
+{
+public:
+    explicit ClientReplySink(Client *client_) : client(client_) {}
+
+    void sendAck(const Message &command, int errorCode) {
+        client->sendAck(command, errorCode);
+    }
+    void sendReply(const Message &command, const QByteArray &data,
+                   int errorCode) {
+        client->sendReply(command, data, errorCode);
+    }
+
+    Client * const client;
+};
+
+struct CommandHandler
+{
+    QPointer<QObject> receiver;
+    QMetaMethod method;
+    QSharedPointer<AbstractCommand> command;  // used instead of the method
+    int minArgs;
+    int maxArgs;
+};
+
+class DeviceServerPrivate
+{
+public:
+    DeviceServerPrivate(DeviceServer *qq, Client *client_, ReplySink *sink_)
+        : q(qq), client(client_), clientSink(client_),
+          sink(sink_ ? sink_ : &clientSink) {}
+
+    static int commandType(const char *begin, const char *end);
+    void _k_messageReceived();
+
+    DeviceServer * const q;
+    Client * const client;
+    ClientReplySink clientSink;
+    ReplySink * const sink;
+
+    // handlers by command type and identifier
+    QHash<QByteArray, CommandHandler> handlers[CommandParser::UndefCmd + 1];
+
+    // refers to the identifier of the dispatched message, so that handlers
+    // are looked up without copying it
+    QByteArray lookupKey;
+};
+
+// Returns the command type of the command keyword between begin and end, or
+// -1 if it is not a valid keyword.
+int DeviceServerPrivate::commandType(const char *begin, const char *end)
+{
+    switch (end - begin) {
+    case 3:
+        if (std::memcmp(begin, "set", 3) == 0)
+            return CommandParser::SetCmd;
+        if (std::memcmp(begin, "get", 3) == 0)
+            return CommandParser::GetCmd;
+        if (std::memcmp(begin, "def", 3) == 0)
+            return CommandParser::DefCmd;
+        break;
+    case 5:
+        if (std::memcmp(begin, "undef", 5) == 0)
+            return CommandParser::UndefCmd;
+        break;
+    }
+    return -1;
+}
+
+void DeviceServerPrivate::_k_messageReceived()
+{
+    while (client->messagesAvailable() > 0)
+        q->handleMessage(client->readMessage());
+}
+
+/*! \brief Creates a device server that handles the messages received by
+           \a client.
+
+    The client is not owned by the server.
+ */
+DeviceServer::DeviceServer(Client *client, QObject *parent)
+    : QObject(parent),
+      d(new DeviceServerPrivate(this, client, 0))
+{
+    Q_ASSERT(client);
+    connect(client, SIGNAL(messageReceived()), SLOT(_k_messageReceived()));
+}
+
+/*! \brief Creates a device server that sends its ACKs and replies to
+           \a sink.
+
+    The server does not read any messages by itself; they must be passed
+    to handleMessage(). The sink is not owned by the server.
+ */
+DeviceServer::DeviceServer(ReplySink *sink, QObject *parent)
+    : QObject(parent),
+      d(new DeviceServerPrivate(this, 0, sink))
+{
+    Q_ASSERT(sink);
+}
+
+/*! \brief Destroys the device server. */
+DeviceServer::~DeviceServer()
+{
+    delete d;
+}
+
+/*! \brief Returns the client used by the server, or 0 if the server was
+           created with a ReplySink.
+ */
+Client * DeviceServer::client() const
+{
+    return d->client;
+}
+
+/*! \brief Returns the sink that sends the ACKs and replies of the server.
+ */
+ReplySink * DeviceServer::replySink() const
+{
+    return d->sink;
+}
+
+/*! \brief Registers a command handler.
+
+    Commands of type \a cmdType with the given \a identifier are passed to
+    the slot \a member of the \a receiver object. The slot must take a single
+    Dcp::DeviceRequest pointer argument, e.g.
+    <code>SLOT(setMode(Dcp::DeviceRequest *))</code>.
+
+    Commands with less than \a minArgs or more than \a maxArgs arguments are
+    answered with an Dcp::AckParameterError without calling the handler;
+    \a maxArgs may be DeviceServer::UnlimitedArguments. An existing handler
+    for the same command is replaced.
+
+    Returns true if the handler has been registered; otherwise returns false.
+ */
+bool DeviceServer::addCommand(CommandParser::CmdType cmdType,
+                              const QByteArray &identifier,
+                              QObject *receiver, const char *member,
+                              int minArgs, int maxArgs)
+{
+    if (!receiver || !member || identifier.isEmpty()) {
+        qWarning("Dcp::DeviceServer::addCommand(): Invalid arguments.");
+        return false;
+    }
+
+    // skip the code added by the SLOT() macro
+    if (*member >= '0' && *member <= '9')
+        ++member;
+    QByteArray signature = QMetaObject::normalizedSignature(member);
+    int index = receiver->metaObject()->indexOfMethod(signature.constData());
+    if (index == -1) {
+        qWarning("Dcp::DeviceServer::addCommand(): No such method %s::%s.",
+                 receiver->metaObject()->className(), signature.constData());
+        return false;
+    }
+
+    CommandHandler handler;
+    handler.receiver = receiver;
+    handler.method = receiver->metaObject()->method(index);
+    handler.minArgs = minArgs;
+    handler.maxArgs = maxArgs;
+    if (handler.method.parameterTypes() !=
+            (QList<QByteArray>() << "Dcp::DeviceRequest*")) {
+        qWarning("Dcp::DeviceServer::addCommand(): %s::%s must take a "
+                 "single Dcp::DeviceRequest pointer argument.",
+                 receiver->metaObject()->className(), signature.constData());
+        return false;
+    }
+
+    d->handlers[cmdType].insert(identifier, handler);
+    return true;
+}
+
+/*! \brief Registers a command object.
+
+    Commands of type \a cmdType with the given \a identifier are passed to
+    \a command, which must take exactly AbstractCommand::numArguments()
+    arguments. The server takes ownership of the command. An existing
+    handler for the same command is replaced.
+
+    Returns true if the command has been registered; otherwise returns
+    false.
+
+    \sa typedCommand(), getterCommand()
+ */
+bool DeviceServer::addCommand(CommandParser::CmdType cmdType,
+                              const QByteArray &identifier,
+                              AbstractCommand *command)
+{
+    if (!command || identifier.isEmpty()) {
+        qWarning("Dcp::DeviceServer::addCommand(): Invalid arguments.");
+        delete command;
+        return false;
+    }
+
+    CommandHandler handler;
+    handler.command = QSharedPointer<AbstractCommand>(command);
+    handler.minArgs = handler.maxArgs = command->numArguments();
+    d->handlers[cmdType].insert(identifier, handler);
+    return true;
+}
+
+/*! \brief Removes the handler of a command. */
+void DeviceServer::removeCommand(CommandParser::CmdType cmdType,
+                                 const QByteArray &identifier)
+{
+    d->handlers[cmdType].remove(identifier);
+}
+
+/*! \brief Returns true if a handler for the command is registered;
+           otherwise returns false.
+ */
+bool DeviceServer::hasCommand(CommandParser::CmdType cmdType,
+                              const QByteArray &identifier) const
+{
+    return d->handlers[cmdType].contains(identifier);
+}
+
+/*! \brief Returns the identifiers of all registered commands of the type
+           \a cmdType.
+ */
+QList<QByteArray> DeviceServer::identifiers(
+        CommandParser::CmdType cmdType) const
+{
+    return d->handlers[cmdType].keys();
+}
+
+/*! \brief Dispatches a single message.
+
+    This is called for every message received by the client. It can also be
+    used to pass messages to the server that were read by other means, and
+    it is the only way messages reach a server created with a ReplySink.
+ */
+void DeviceServer::handleMessage(const Message &msg)
+{
+    if (msg.isNull())
+        return;
+    if (msg.isReply()) {
+        emit replyReceived(msg);
+        return;
+    }
+
+    // the command is split in place, see DeviceRequestPrivate
+    const QByteArray data = msg.data();
+    const char * const end = data.constData() + data.size();
+    ArgumentTokenizer tokens(data.constData(), end);
+    const char *cmdBegin, *cmdEnd, *idBegin, *idEnd;
+    int cmdType = -1;
+    if (tokens.next(&cmdBegin, &cmdEnd) && tokens.next(&idBegin, &idEnd))
+        cmdType = d->commandType(cmdBegin, cmdEnd);
+    if (cmdType == -1) {
+        d->sink->sendAck(msg, AckUnknownCommandError);
+        return;
+    }
+
+    // copy the handler, it may be removed by the handler itself
+    const QHash<QByteArray, CommandHandler> &handlers = d->handlers[cmdType];
+    d->lookupKey.setRawData(idBegin, uint(idEnd - idBegin));
+    QHash<QByteArray, CommandHandler>::const_iterator it =
+            handlers.constFind(d->lookupKey);
+    if (it == handlers.constEnd() ||
+            (it.value().command.isNull() && !it.value().receiver)) {
+        d->sink->sendAck(msg, AckUnknownCommandError);
+        return;
+    }
+    CommandHandler handler = it.value();
+
+    int numArgs = 0;
+    const char *argBegin, *argEnd;
+    while (tokens.next(&argBegin, &argEnd))
+        ++numArgs;
+    if (numArgs < handler.minArgs || (handler.maxArgs != UnlimitedArguments &&
+                                      numArgs > handler.maxArgs)) {
+        d->sink->sendAck(msg, AckParameterError);
+        return;
+    }
+
+    DeviceRequestPrivate requestData(msg, CommandParser::CmdType(cmdType),
+                                     idBegin, idEnd, end);
+    DeviceRequest request(requestData);
+    if (!handler.command.isNull()) {
+        handler.command->invoke(&request, idEnd, end);
+    }
+    else if (!handler.method.invoke(handler.receiver, Qt::DirectConnection,
+                                    Q_ARG(Dcp::DeviceRequest *, &request))) {
+        d->sink->sendAck(msg, AckUnknownCommandError);
+        return;
+    }
+
+    if (request.ackErrorCode() != AckNoError) {
+        d->sink->sendAck(msg, request.ackErrorCode());
+        return;
+    }
+    d->sink->sendAck(msg, AckNoError);
+    if (!request.isDeferred())
+        d->sink->sendReply(msg, request.replyData(),
+                           request.replyErrorCode());
+}
+
+} // namespace Dcp
+
+// This include is neccessary with AUTOMOC because Q_PRIVATE_SLOT is used in
+// the header file.
+#include "moc_deviceserver.cpp"
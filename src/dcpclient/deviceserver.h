@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DCPCLIENT_DEVICESERVER_H
+#define DCPCLIENT_DEVICESERVER_H
+
+#include "dcpclient_export.h"
+#include "message.h"
+#include "messageparser.h"
+#include <QtCore/QObject>
+
+class QByteArray;
+template <typename T> class QList;
+
+namespace Dcp {
+
+class Client;
+class AbstractCommand;
+
+class DeviceRequestPrivate;
+class DCPCLIENT_EXPORT DeviceRequest
+{
+public:
+    DeviceRequest(const Message &msg, CommandParser::CmdType cmdType,
+                  const QByteArray &identifier,
+                  const QList<QByteArray> &arguments);
+    ~DeviceRequest();
+
+    Message message() const;
+    CommandParser::CmdType cmdType() const;
+    QByteArray identifier() const;
+    QList<QByteArray> arguments() const;
+    QByteArray argument(int i) const;
+    int numArguments() const;
+
+    void reject(int ackErrorCode = AckParameterError);
+    void setReply(const QByteArray &data, int errorCode = 0);
+    void defer();
+
+    int ackErrorCode() const;
+    QByteArray replyData() const;
+    int replyErrorCode() const;
+    bool isDeferred() const;
+
+private:
+    explicit DeviceRequest(DeviceRequestPrivate &dd);
+    Q_DISABLE_COPY(DeviceRequest)
+    friend class DeviceServer;
+    DeviceRequestPrivate * const d;
+};
+
+class DCPCLIENT_EXPORT ReplySink
+{
+public:
+    virtual ~ReplySink();
+    virtual void sendAck(const Message &command, int errorCode) = 0;
+    virtual void sendReply(const Message &command, const QByteArray &data,
+                           int errorCode) = 0;
+};
+
+class DeviceServerPrivate;
+class DCPCLIENT_EXPORT DeviceServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum { UnlimitedArguments = -1 };
+
+    explicit DeviceServer(Client *client, QObject *parent = 0);
+    explicit DeviceServer(ReplySink *sink, QObject *parent = 0);
+    virtual ~DeviceServer();
+
+    Client * client() const;
+    ReplySink * replySink() const;
+
+    bool addCommand(CommandParser::CmdType cmdType,
+                    const QByteArray &identifier, QObject *receiver,
+                    const char *member, int minArgs = 0, int maxArgs = 0);
+    bool addCommand(CommandParser::CmdType cmdType,
+                    const QByteArray &identifier, AbstractCommand *command);
+    void removeCommand(CommandParser::CmdType cmdType,
+                       const QByteArray &identifier);
+    bool hasCommand(CommandParser::CmdType cmdType,
+                    const QByteArray &identifier) const;
+    QList<QByteArray> identifiers(CommandParser::CmdType cmdType) const;
+
+    void handleMessage(const Message &msg);
+
+signals:
+    void replyReceived(const Dcp::Message &msg);
+
+private:
+    Q_PRIVATE_SLOT(d, void _k_messageReceived())
+    Q_DISABLE_COPY(DeviceServer)
+    friend class DeviceServerPrivate;
+    DeviceServerPrivate * const d;
+};
+
+} // namespace Dcp
+
+#endif // DCPCLIENT_DEVICESERVER_H
@@ -85,6 +85,8 @@ public:
             data(other.data) {}
     MessageData(quint16 flags_, quint32 snr_, const QByteArray &source_,
             const QByteArray &destination_, const QByteArray &data_);
+    MessageData(const MessageData &command, quint16 flags_,
+            const QByteArray &data_);
 
     bool isNull;
     quint16 flags;
@@ -110,6 +112,32 @@ MessageData::MessageData(quint16 flags_, quint32 snr_,
     stripRight(destination);
 }
 
+/*! \internal
+    \brief Creates the data of a reply to a command message.
+
+    Source and destination are swapped; they are already truncated and
+    stripped in the command and are only copied.
+ */
+MessageData::MessageData(const MessageData &command, quint16 flags_,
+        const QByteArray &data_)
+    : isNull(false),
+      flags(flags_),
+      snr(command.snr),
+      source(command.destination),
+      destination(command.source),
+      data(data_)
+{
+}
+
+// Shared data of the most frequent replies; copies of these byte arrays
+// don't allocate memory.
+static const QByteArray ackNoErrorData(ackTemplate(AckNoError));
+static const QByteArray ackUnknownCommandData(
+        ackTemplate(AckUnknownCommandError));
+static const QByteArray ackParameterErrorData(ackTemplate(AckParameterError));
+static const QByteArray ackWrongModeData(ackTemplate(AckWrongModeError));
+static const QByteArray finData("0 FIN");
+
 // -------------------------------------------------------------------------
 
 /*! \brief Creates a null-message, i.e. isNull() returns true.
@@ -121,6 +149,14 @@ Message::Message()
 {
 }
 
+/*! \internal
+    \brief Creates a message with the given data.
+ */
+Message::Message(MessageData *data)
+    : d(data)
+{
+}
+
 /*! \brief Copy constructor. */
 Message::Message(const Message &other)
     : d(other.d)
@@ -241,6 +277,15 @@ void Message::setUserFlags(quint8 flags)
     d->flags |= quint16(flags) << 8;
 }
 
+/*! \brief Returns true if the PaceFlag is set; otherwise returns false.
+
+    \sa Client::setPacing()
+ */
+bool Message::isPaced() const
+{
+    return (d->flags & PaceFlag) != 0;
+}
+
 /*! \brief Returns true if the UrgentFlag is set; otherwise returns false. */
 bool Message::isUrgent() const
 {
@@ -384,10 +429,27 @@ Message Message::fromByteArray(const QByteArray &rawMsg)
  */
 Message Message::ackMessage(int errorCode) const
 {
-    return Message(
-        d->snr, d->destination, d->source,
-        QByteArray::number(errorCode) + " ACK",
-        d->flags | ReplyFlag | UrgentFlag);
+    QByteArray data;
+    switch (errorCode)
+    {
+    case AckNoError:
+        data = ackNoErrorData;
+        break;
+    case AckUnknownCommandError:
+        data = ackUnknownCommandData;
+        break;
+    case AckParameterError:
+        data = ackParameterErrorData;
+        break;
+    case AckWrongModeError:
+        data = ackWrongModeData;
+        break;
+    default:
+        data = QByteArray::number(errorCode) + " ACK";
+        break;
+    }
+    return Message(new MessageData(*d, d->flags | ReplyFlag | UrgentFlag,
+                                   data));
 }
 
 /*! \brief Creates a reply message.
@@ -412,10 +474,21 @@ Message Message::ackMessage(int errorCode) const
  */
 Message Message::replyMessage(const QByteArray &data, int errorCode) const
 {
-    return Message(
-        d->snr, d->destination, d->source,
-        QByteArray::number(errorCode) + " " + (data.isEmpty() ? "FIN" : data),
-        d->flags | ReplyFlag);
+    if (errorCode == 0 && data.isEmpty())
+        return Message(new MessageData(*d, d->flags | ReplyFlag, finData));
+
+    // error code and data are written into a single buffer
+    char prefix[MaxIntSize + 1];
+    char *p = formatInt(prefix, errorCode);
+    *p++ = ' ';
+    QByteArray replyData;
+    replyData.reserve(int(p - prefix) + (data.isEmpty() ? 3 : data.size()));
+    replyData.append(prefix, int(p - prefix));
+    if (data.isEmpty())
+        replyData.append("FIN");
+    else
+        replyData.append(data);
+    return Message(new MessageData(*d, d->flags | ReplyFlag, replyData));
 }
 
 /*! \brief QTextStream output operator for Dcp::Message objects.
@@ -437,7 +510,7 @@ Message Message::replyMessage(const QByteArray &data, int errorCode) const
 QTextStream & operator << (QTextStream &os, const Dcp::Message &msg)
 {
     return os
-        << ((msg.flags() & Dcp::Message::PaceFlag) != 0 ? "p" : "-")
+        << (msg.isPaced() ? "p" : "-")
         << ((msg.flags() & Dcp::Message::GrecoFlag) != 0 ? "g" : "-")
         << (msg.isUrgent() ? "u" : "-")
         << (msg.isReply() ? "r" : "-")
@@ -467,7 +540,7 @@ QTextStream & operator << (QTextStream &os, const Dcp::Message &msg)
 QDebug operator << (QDebug debug, const Dcp::Message &msg)
 {
     debug.nospace()
-        << ((msg.flags() & Dcp::Message::PaceFlag) != 0 ? "p" : "-")
+        << (msg.isPaced() ? "p" : "-")
         << ((msg.flags() & Dcp::Message::GrecoFlag) != 0 ? "g" : "-")
         << (msg.isUrgent() ? "u" : "-")
         << (msg.isReply() ? "r" : "-")
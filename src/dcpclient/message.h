@@ -82,6 +82,7 @@ public:
     quint8 userFlags() const;
     void setUserFlags(quint8 flags);
 
+    bool isPaced() const;
     bool isUrgent() const;
     bool isReply() const;
 
@@ -105,6 +106,7 @@ public:
                          int errorCode = 0) const;
 
 private:
+    explicit Message(MessageData *data);
     QSharedDataPointer<MessageData> d;
 };
 
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "reconnectpolicy.h"
+#include <QtCore/QtGlobal>
+
+namespace Dcp {
+
+/*! \class ReconnectPolicy
+    \brief Describes the delays between the reconnection attempts of a
+           Client.
+
+    The delay before the first reconnection attempt is initialDelay(); each
+    further attempt multiplies the delay by multiplier(), up to maxDelay().
+    If jitter() is enabled ("full jitter"), the actual delay is chosen
+    randomly between zero and this value. This spreads out the reconnection
+    attempts of many clients, which would otherwise all hit a restarted
+    server at the same moment.
+
+    The default policy starts with 1 second, doubles the delay after every
+    attempt up to 30 seconds and uses jitter.
+
+    \sa Client::setReconnectPolicy()
+ */
+
+/*! \internal
+    \brief Implicitly shared reconnect policy data.
+ */
+class ReconnectPolicyData : public QSharedData
+{
+public:
+    ReconnectPolicyData(int initialDelay_, double multiplier_, int maxDelay_,
+                        bool jitter_)
+        : initialDelay(initialDelay_), multiplier(multiplier_),
+          maxDelay(maxDelay_), jitter(jitter_) {}
+
+    int initialDelay;
+    double multiplier;
+    int maxDelay;
+    bool jitter;
+};
+
+/*! \brief Creates the default reconnect policy. */
+ReconnectPolicy::ReconnectPolicy()
+    : d(new ReconnectPolicyData(1000, 2.0, 30000, true))
+{
+}
+
+/*! \brief Creates a reconnect policy.
+
+    \param initialDelay the delay before the first attempt in milliseconds
+    \param multiplier the factor applied to the delay after each attempt
+    \param maxDelay the maximum delay in milliseconds
+    \param jitter randomize the delays if true
+ */
+ReconnectPolicy::ReconnectPolicy(int initialDelay, double multiplier,
+                                 int maxDelay, bool jitter)
+    : d(new ReconnectPolicyData(qMax(initialDelay, 0),
+                                qMax(multiplier, 1.0),
+                                qMax(maxDelay, qMax(initialDelay, 0)),
+                                jitter))
+{
+}
+
+/*! \brief Creates a copy of the \a other reconnect policy. */
+ReconnectPolicy::ReconnectPolicy(const ReconnectPolicy &other)
+    : d(other.d)
+{
+}
+
+/*! \brief Destroys the reconnect policy. */
+ReconnectPolicy::~ReconnectPolicy()
+{
+}
+
+/*! \brief Assigns the \a other reconnect policy to this one. */
+ReconnectPolicy & ReconnectPolicy::operator=(const ReconnectPolicy &other)
+{
+    d = other.d;
+    return *this;
+}
+
+bool ReconnectPolicy::operator==(const ReconnectPolicy &other) const
+{
+    return d->initialDelay == other.d->initialDelay
+            && d->multiplier == other.d->multiplier
+            && d->maxDelay == other.d->maxDelay
+            && d->jitter == other.d->jitter;
+}
+
+bool ReconnectPolicy::operator!=(const ReconnectPolicy &other) const
+{
+    return !operator==(other);
+}
+
+/*! \brief Returns the delay before the first reconnection attempt in
+           milliseconds.
+ */
+int ReconnectPolicy::initialDelay() const
+{
+    return d->initialDelay;
+}
+
+/*! \brief Sets the delay before the first reconnection attempt in
+           milliseconds.
+ */
+void ReconnectPolicy::setInitialDelay(int msecs)
+{
+    d->initialDelay = qMax(msecs, 0);
+    if (d->maxDelay < d->initialDelay)
+        d->maxDelay = d->initialDelay;
+}
+
+/*! \brief Returns the factor that is applied to the delay after each
+           reconnection attempt.
+ */
+double ReconnectPolicy::multiplier() const
+{
+    return d->multiplier;
+}
+
+/*! \brief Sets the factor that is applied to the delay after each
+           reconnection attempt. Values smaller than 1 are ignored.
+ */
+void ReconnectPolicy::setMultiplier(double multiplier)
+{
+    d->multiplier = qMax(multiplier, 1.0);
+}
+
+/*! \brief Returns the maximum delay between reconnection attempts in
+           milliseconds.
+ */
+int ReconnectPolicy::maxDelay() const
+{
+    return d->maxDelay;
+}
+
+/*! \brief Sets the maximum delay between reconnection attempts in
+           milliseconds.
+ */
+void ReconnectPolicy::setMaxDelay(int msecs)
+{
+    d->maxDelay = qMax(msecs, d->initialDelay);
+}
+
+/*! \brief Returns true if the delays are randomized; otherwise returns
+           false.
+ */
+bool ReconnectPolicy::jitter() const
+{
+    return d->jitter;
+}
+
+/*! \brief Enables or disables the randomization of the delays. */
+void ReconnectPolicy::setJitter(bool enable)
+{
+    d->jitter = enable;
+}
+
+/*! \brief Returns the delay before the reconnection attempt with the given
+           number, without jitter.
+
+    The first attempt has the number 0.
+ */
+int ReconnectPolicy::delay(int attempt) const
+{
+    double value = d->initialDelay;
+    for (int i = 0; i < attempt && i < 64 && value < d->maxDelay; ++i)
+        value *= d->multiplier;
+    return value < d->maxDelay ? int(value) : d->maxDelay;
+}
+
+/*! \brief Returns the delay before the reconnection attempt with the given
+           number, using \a random to choose the jittered delay.
+
+    If jitter() is disabled, this is the same as delay(int).
+ */
+int ReconnectPolicy::delay(int attempt, quint32 random) const
+{
+    int value = delay(attempt);
+    if (!d->jitter || value <= 0)
+        return value;
+    return int(random % quint32(value + 1));
+}
+
+/*! \brief Returns a policy with a constant delay of \a msecs milliseconds
+           and no jitter.
+ */
+ReconnectPolicy ReconnectPolicy::fixedInterval(int msecs)
+{
+    return ReconnectPolicy(msecs, 1.0, msecs, false);
+}
+
+} // namespace Dcp
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DCPCLIENT_RECONNECTPOLICY_H
+#define DCPCLIENT_RECONNECTPOLICY_H
+
+#include "dcpclient_export.h"
+#include <QtCore/QSharedDataPointer>
+
+namespace Dcp {
+
+class ReconnectPolicyData;
+class DCPCLIENT_EXPORT ReconnectPolicy
+{
+public:
+    ReconnectPolicy();
+    ReconnectPolicy(int initialDelay, double multiplier, int maxDelay,
+                    bool jitter = true);
+    ReconnectPolicy(const ReconnectPolicy &other);
+    ~ReconnectPolicy();
+    ReconnectPolicy & operator=(const ReconnectPolicy &other);
+    bool operator==(const ReconnectPolicy &other) const;
+    bool operator!=(const ReconnectPolicy &other) const;
+
+    int initialDelay() const;
+    void setInitialDelay(int msecs);
+    double multiplier() const;
+    void setMultiplier(double multiplier);
+    int maxDelay() const;
+    void setMaxDelay(int msecs);
+    bool jitter() const;
+    void setJitter(bool enable);
+
+    int delay(int attempt) const;
+    int delay(int attempt, quint32 random) const;
+
+    static ReconnectPolicy fixedInterval(int msecs);
+
+private:
+    QSharedDataPointer<ReconnectPolicyData> d;
+};
+
+} // namespace Dcp
+
+#endif // DCPCLIENT_RECONNECTPOLICY_H
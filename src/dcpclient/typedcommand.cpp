@@ -0,0 +1,371 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "typedcommand.h"
+#include <cerrno>
+#include <climits>
+#include <clocale>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+namespace Dcp {
+
+/*! \class AbstractCommand
+    \brief Base class of command handlers that are owned by a DeviceServer.
+
+    Commands are registered with DeviceServer::addCommand(). The server
+    checks that the command has numArguments() arguments before invoke()
+    is called.
+
+    Usually commands are not implemented directly, but created by the
+    typedCommand() and getterCommand() templates, which convert the
+    arguments of a command to the parameter types of a member function.
+
+    \sa DeviceServer
+ */
+
+/*! \fn int AbstractCommand::numArguments() const
+    \brief Returns the number of arguments the command takes.
+ */
+
+/*! \fn void AbstractCommand::invoke(DeviceRequest *request, const char *args, const char *end)
+    \brief Handles the command \a request.
+
+    The arguments are passed as the part of the message data between
+    \a args and \a end that follows the identifier. They are split and
+    converted in place, e.g. with ArgumentTokenizer and the parseArgument()
+    overloads for character ranges, so that no copy of the message data is
+    made.
+ */
+
+/*! \fn AbstractCommand * typedCommand(C *object, void (C::*function)(DeviceRequest *, A1, A2))
+    \brief Creates a command that calls a member function with typed
+           arguments.
+
+    The command arguments are converted with parseArgument() to the
+    parameter types of \a function, which are deduced at compile time.
+    They are read directly from the message data; only QByteArray and
+    QString arguments are copied.
+    Commands with arguments that cannot be converted are answered with a
+    Dcp::AckParameterError, without calling the function. There are
+    overloads for functions with zero to four typed parameters, following
+    the Dcp::DeviceRequest pointer.
+
+    Supported parameter types are bool, int, uint, qint64, quint64, double,
+    QByteArray and QString, optionally passed by const reference.
+
+    <b>Example:</b>
+    \code
+    void Camera::setExposure(Dcp::DeviceRequest *request, double secs,
+                             int frames);
+    ...
+    server.addCommand(Dcp::CommandParser::SetCmd, "exposure",
+                      Dcp::typedCommand(this, &Camera::setExposure));
+    \endcode
+
+    \sa getterCommand()
+ */
+
+/*! \fn AbstractCommand * getterCommand(const C *object, R (C::*function)() const)
+    \brief Creates a command without arguments that replies the value
+           returned by \a function.
+
+    The return value is converted with formatValue().
+
+    \sa typedCommand()
+ */
+
+/*! \brief Destroys the command. */
+AbstractCommand::~AbstractCommand()
+{
+}
+
+static bool equals(const char *begin, const char *end, const char *str)
+{
+    const size_t size = std::strlen(str);
+    return size_t(end - begin) == size && std::memcmp(begin, str, size) == 0;
+}
+
+// Parses the decimal digits between begin and end; returns false if there
+// are no digits, other characters, or if the value is larger than limit.
+static bool parseDigits(const char *begin, const char *end, quint64 limit,
+                        quint64 *value)
+{
+    if (begin == end)
+        return false;
+    quint64 result = 0;
+    for (const char *p = begin; p != end; ++p) {
+        if (*p < '0' || *p > '9')
+            return false;
+        const uint digit = uint(*p - '0');
+        if (result > (limit - digit) / 10)
+            return false;
+        result = result * 10 + digit;
+    }
+    *value = result;
+    return true;
+}
+
+static bool parseSigned(const char *begin, const char *end, qint64 min,
+                        qint64 max, qint64 *value)
+{
+    const bool negative = begin != end && *begin == '-';
+    if (begin != end && (*begin == '-' || *begin == '+'))
+        ++begin;
+    quint64 magnitude;
+    quint64 limit = negative ? quint64(-(min + 1)) + 1 : quint64(max);
+    if (!parseDigits(begin, end, limit, &magnitude))
+        return false;
+    *value = negative ? -qint64(magnitude - 1) - 1 : qint64(magnitude);
+    return true;
+}
+
+static bool parseUnsigned(const char *begin, const char *end, quint64 max,
+                          quint64 *value)
+{
+    if (begin != end && *begin == '+')
+        ++begin;
+    return parseDigits(begin, end, max, value);
+}
+
+/*! \brief Converts a command argument to a bool.
+
+    The values <code>1</code>, <code>true</code> and <code>on</code>, as well
+    as <code>0</code>, <code>false</code> and <code>off</code> are accepted.
+    Returns false if the characters between \a begin and \a end are not a
+    valid boolean value.
+ */
+bool parseArgument(const char *begin, const char *end, bool *value)
+{
+    if (equals(begin, end, "1") || equals(begin, end, "true") ||
+            equals(begin, end, "on"))
+        *value = true;
+    else if (equals(begin, end, "0") || equals(begin, end, "false") ||
+             equals(begin, end, "off"))
+        *value = false;
+    else
+        return false;
+    return true;
+}
+
+/*! \brief Converts a command argument to an int. */
+bool parseArgument(const char *begin, const char *end, int *value)
+{
+    qint64 result;
+    if (!parseSigned(begin, end, INT_MIN, INT_MAX, &result))
+        return false;
+    *value = int(result);
+    return true;
+}
+
+/*! \brief Converts a command argument to an unsigned int. */
+bool parseArgument(const char *begin, const char *end, uint *value)
+{
+    quint64 result;
+    if (!parseUnsigned(begin, end, UINT_MAX, &result))
+        return false;
+    *value = uint(result);
+    return true;
+}
+
+/*! \brief Converts a command argument to a 64 bit integer. */
+bool parseArgument(const char *begin, const char *end, qint64 *value)
+{
+    return parseSigned(begin, end, Q_INT64_C(-0x7fffffffffffffff) - 1,
+                       Q_INT64_C(0x7fffffffffffffff), value);
+}
+
+/*! \brief Converts a command argument to an unsigned 64 bit integer. */
+bool parseArgument(const char *begin, const char *end, quint64 *value)
+{
+    return parseUnsigned(begin, end, Q_UINT64_C(0xffffffffffffffff), value);
+}
+
+/*! \brief Converts a command argument to a double.
+
+    The argument is copied into a buffer on the stack for strtod(), with the
+    decimal point replaced by the one of the current locale, which is set by
+    QCoreApplication. Arguments longer than 63 characters are rejected.
+ */
+bool parseArgument(const char *begin, const char *end, double *value)
+{
+    char buffer[64];
+    const int size = int(end - begin);
+    if (size <= 0 || size >= int(sizeof(buffer)))
+        return false;
+
+    const char decimalPoint = *std::localeconv()->decimal_point;
+    for (int i = 0; i < size; ++i) {
+        if (begin[i] == decimalPoint && decimalPoint != '.')
+            return false;
+        buffer[i] = begin[i] == '.' ? decimalPoint : begin[i];
+    }
+    buffer[size] = '\0';
+
+    char *stop;
+    errno = 0;
+    const double result = std::strtod(buffer, &stop);
+    if (stop != buffer + size ||
+            (errno == ERANGE && std::fabs(result) == HUGE_VAL))
+        return false;
+    *value = result;
+    return true;
+}
+
+/*! \brief Copies a command argument into a byte array. */
+bool parseArgument(const char *begin, const char *end, QByteArray *value)
+{
+    *value = QByteArray(begin, int(end - begin));
+    return true;
+}
+
+/*! \brief Converts a command argument to a string.
+
+    The argument is interpreted as Latin-1 text.
+ */
+bool parseArgument(const char *begin, const char *end, QString *value)
+{
+    *value = QString::fromLatin1(begin, int(end - begin));
+    return true;
+}
+
+/*! \brief Converts a command argument to a bool.
+
+    This is an overloaded function; the conversions are the same as for
+    character ranges.
+ */
+bool parseArgument(const QByteArray &data, bool *value)
+{
+    return parseArgument(data.constData(), data.constData() + data.size(),
+                         value);
+}
+
+/*! \brief Converts a command argument to an int. */
+bool parseArgument(const QByteArray &data, int *value)
+{
+    return parseArgument(data.constData(), data.constData() + data.size(),
+                         value);
+}
+
+/*! \brief Converts a command argument to an unsigned int. */
+bool parseArgument(const QByteArray &data, uint *value)
+{
+    return parseArgument(data.constData(), data.constData() + data.size(),
+                         value);
+}
+
+/*! \brief Converts a command argument to a 64 bit integer. */
+bool parseArgument(const QByteArray &data, qint64 *value)
+{
+    return parseArgument(data.constData(), data.constData() + data.size(),
+                         value);
+}
+
+/*! \brief Converts a command argument to an unsigned 64 bit integer. */
+bool parseArgument(const QByteArray &data, quint64 *value)
+{
+    return parseArgument(data.constData(), data.constData() + data.size(),
+                         value);
+}
+
+/*! \brief Converts a command argument to a double. */
+bool parseArgument(const QByteArray &data, double *value)
+{
+    return parseArgument(data.constData(), data.constData() + data.size(),
+                         value);
+}
+
+/*! \brief Passes a command argument on unchanged. */
+bool parseArgument(const QByteArray &data, QByteArray *value)
+{
+    *value = data;
+    return true;
+}
+
+/*! \brief Converts a command argument to a string.
+
+    The argument is interpreted as Latin-1 text.
+ */
+bool parseArgument(const QByteArray &data, QString *value)
+{
+    *value = QString::fromLatin1(data.constData(), data.size());
+    return true;
+}
+
+/*! \brief Converts a bool to reply data (<code>1</code> or
+           <code>0</code>).
+ */
+QByteArray formatValue(bool value)
+{
+    return value ? QByteArray("1") : QByteArray("0");
+}
+
+/*! \brief Converts an int to reply data. */
+QByteArray formatValue(int value)
+{
+    return QByteArray::number(value);
+}
+
+/*! \brief Converts an unsigned int to reply data. */
+QByteArray formatValue(uint value)
+{
+    return QByteArray::number(value);
+}
+
+/*! \brief Converts a 64 bit integer to reply data. */
+QByteArray formatValue(qint64 value)
+{
+    return QByteArray::number(value);
+}
+
+/*! \brief Converts an unsigned 64 bit integer to reply data. */
+QByteArray formatValue(quint64 value)
+{
+    return QByteArray::number(value);
+}
+
+/*! \brief Converts a double to reply data.
+
+    The value is formatted with up to 15 significant digits.
+ */
+QByteArray formatValue(double value)
+{
+    return QByteArray::number(value, 'g', 15);
+}
+
+/*! \brief Returns \a value unchanged. */
+QByteArray formatValue(const QByteArray &value)
+{
+    return value;
+}
+
+/*! \brief Converts a string to Latin-1 reply data. */
+QByteArray formatValue(const QString &value)
+{
+    return value.toLatin1();
+}
+
+} // namespace Dcp
@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DCPCLIENT_TYPEDCOMMAND_H
+#define DCPCLIENT_TYPEDCOMMAND_H
+
+#include "dcpclient_export.h"
+#include "deviceserver.h"
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+
+namespace Dcp {
+
+DCPCLIENT_EXPORT bool parseArgument(const QByteArray &data, bool *value);
+DCPCLIENT_EXPORT bool parseArgument(const QByteArray &data, int *value);
+DCPCLIENT_EXPORT bool parseArgument(const QByteArray &data, uint *value);
+DCPCLIENT_EXPORT bool parseArgument(const QByteArray &data, qint64 *value);
+DCPCLIENT_EXPORT bool parseArgument(const QByteArray &data, quint64 *value);
+DCPCLIENT_EXPORT bool parseArgument(const QByteArray &data, double *value);
+DCPCLIENT_EXPORT bool parseArgument(const QByteArray &data, QByteArray *value);
+DCPCLIENT_EXPORT bool parseArgument(const QByteArray &data, QString *value);
+
+DCPCLIENT_EXPORT bool parseArgument(const char *begin, const char *end,
+                                    bool *value);
+DCPCLIENT_EXPORT bool parseArgument(const char *begin, const char *end,
+                                    int *value);
+DCPCLIENT_EXPORT bool parseArgument(const char *begin, const char *end,
+                                    uint *value);
+DCPCLIENT_EXPORT bool parseArgument(const char *begin, const char *end,
+                                    qint64 *value);
+DCPCLIENT_EXPORT bool parseArgument(const char *begin, const char *end,
+                                    quint64 *value);
+DCPCLIENT_EXPORT bool parseArgument(const char *begin, const char *end,
+                                    double *value);
+DCPCLIENT_EXPORT bool parseArgument(const char *begin, const char *end,
+                                    QByteArray *value);
+DCPCLIENT_EXPORT bool parseArgument(const char *begin, const char *end,
+                                    QString *value);
+
+DCPCLIENT_EXPORT QByteArray formatValue(bool value);
+DCPCLIENT_EXPORT QByteArray formatValue(int value);
+DCPCLIENT_EXPORT QByteArray formatValue(uint value);
+DCPCLIENT_EXPORT QByteArray formatValue(qint64 value);
+DCPCLIENT_EXPORT QByteArray formatValue(quint64 value);
+DCPCLIENT_EXPORT QByteArray formatValue(double value);
+DCPCLIENT_EXPORT QByteArray formatValue(const QByteArray &value);
+DCPCLIENT_EXPORT QByteArray formatValue(const QString &value);
+
+// Splits message data into words separated by spaces, without copying it.
+class ArgumentTokenizer
+{
+public:
+    ArgumentTokenizer(const char *begin, const char *end)
+        : m_pos(begin), m_end(end) {}
+
+    bool next(const char **begin, const char **end) {
+        while (m_pos != m_end && *m_pos == ' ')
+            ++m_pos;
+        if (m_pos == m_end)
+            return false;
+        *begin = m_pos;
+        while (m_pos != m_end && *m_pos != ' ')
+            ++m_pos;
+        *end = m_pos;
+        return true;
+    }
+
+private:
+    const char *m_pos;
+    const char *m_end;
+};
+
+template <typename T>
+inline bool parseNextArgument(ArgumentTokenizer *tokens, T *value)
+{
+    const char *begin, *end;
+    return tokens->next(&begin, &end) && parseArgument(begin, end, value);
+}
+
+class DCPCLIENT_EXPORT AbstractCommand
+{
+public:
+    virtual ~AbstractCommand();
+    virtual int numArguments() const = 0;
+    virtual void invoke(DeviceRequest *request, const char *args,
+                        const char *end) = 0;
+};
+
+// handler parameters like const QByteArray & are parsed into plain values
+template <typename T> struct ArgumentType { typedef T Type; };
+template <typename T> struct ArgumentType<const T &> { typedef T Type; };
+template <typename T> struct ArgumentType<T &> { typedef T Type; };
+
+template <class C>
+class Command0 : public AbstractCommand
+{
+public:
+    typedef void (C::*Function)(DeviceRequest *);
+
+    Command0(C *object, Function function)
+        : m_object(object), m_function(function) {}
+
+    int numArguments() const { return 0; }
+    void invoke(DeviceRequest *request, const char *, const char *) {
+        (m_object->*m_function)(request);
+    }
+
+private:
+    C *m_object;
+    Function m_function;
+};
+
+template <class C, typename A1>
+class Command1 : public AbstractCommand
+{
+public:
+    typedef void (C::*Function)(DeviceRequest *, A1);
+    typedef typename ArgumentType<A1>::Type T1;
+
+    Command1(C *object, Function function)
+        : m_object(object), m_function(function) {}
+
+    int numArguments() const { return 1; }
+    void invoke(DeviceRequest *request, const char *args, const char *end) {
+        ArgumentTokenizer tokens(args, end);
+        T1 a1 = T1();
+        if (!parseNextArgument(&tokens, &a1)) {
+            request->reject(AckParameterError);
+            return;
+        }
+        (m_object->*m_function)(request, a1);
+    }
+
+private:
+    C *m_object;
+    Function m_function;
+};
+
+template <class C, typename A1, typename A2>
+class Command2 : public AbstractCommand
+{
+public:
+    typedef void (C::*Function)(DeviceRequest *, A1, A2);
+    typedef typename ArgumentType<A1>::Type T1;
+    typedef typename ArgumentType<A2>::Type T2;
+
+    Command2(C *object, Function function)
+        : m_object(object), m_function(function) {}
+
+    int numArguments() const { return 2; }
+    void invoke(DeviceRequest *request, const char *args, const char *end) {
+        ArgumentTokenizer tokens(args, end);
+        T1 a1 = T1();
+        T2 a2 = T2();
+        if (!parseNextArgument(&tokens, &a1) ||
+                !parseNextArgument(&tokens, &a2)) {
+            request->reject(AckParameterError);
+            return;
+        }
+        (m_object->*m_function)(request, a1, a2);
+    }
+
+private:
+    C *m_object;
+    Function m_function;
+};
+
+template <class C, typename A1, typename A2, typename A3>
+class Command3 : public AbstractCommand
+{
+public:
+    typedef void (C::*Function)(DeviceRequest *, A1, A2, A3);
+    typedef typename ArgumentType<A1>::Type T1;
+    typedef typename ArgumentType<A2>::Type T2;
+    typedef typename ArgumentType<A3>::Type T3;
+
+    Command3(C *object, Function function)
+        : m_object(object), m_function(function) {}
+
+    int numArguments() const { return 3; }
+    void invoke(DeviceRequest *request, const char *args, const char *end) {
+        ArgumentTokenizer tokens(args, end);
+        T1 a1 = T1();
+        T2 a2 = T2();
+        T3 a3 = T3();
+        if (!parseNextArgument(&tokens, &a1) ||
+                !parseNextArgument(&tokens, &a2) ||
+                !parseNextArgument(&tokens, &a3)) {
+            request->reject(AckParameterError);
+            return;
+        }
+        (m_object->*m_function)(request, a1, a2, a3);
+    }
+
+private:
+    C *m_object;
+    Function m_function;
+};
+
+template <class C, typename A1, typename A2, typename A3, typename A4>
+class Command4 : public AbstractCommand
+{
+public:
+    typedef void (C::*Function)(DeviceRequest *, A1, A2, A3, A4);
+    typedef typename ArgumentType<A1>::Type T1;
+    typedef typename ArgumentType<A2>::Type T2;
+    typedef typename ArgumentType<A3>::Type T3;
+    typedef typename ArgumentType<A4>::Type T4;
+
+    Command4(C *object, Function function)
+        : m_object(object), m_function(function) {}
+
+    int numArguments() const { return 4; }
+    void invoke(DeviceRequest *request, const char *args, const char *end) {
+        ArgumentTokenizer tokens(args, end);
+        T1 a1 = T1();
+        T2 a2 = T2();
+        T3 a3 = T3();
+        T4 a4 = T4();
+        if (!parseNextArgument(&tokens, &a1) ||
+                !parseNextArgument(&tokens, &a2) ||
+                !parseNextArgument(&tokens, &a3) ||
+                !parseNextArgument(&tokens, &a4)) {
+            request->reject(AckParameterError);
+            return;
+        }
+        (m_object->*m_function)(request, a1, a2, a3, a4);
+    }
+
+private:
+    C *m_object;
+    Function m_function;
+};
+
+template <class C, typename R>
+class GetterCommand : public AbstractCommand
+{
+public:
+    typedef R (C::*Function)() const;
+
+    GetterCommand(const C *object, Function function)
+        : m_object(object), m_function(function) {}
+
+    int numArguments() const { return 0; }
+    void invoke(DeviceRequest *request, const char *, const char *) {
+        request->setReply(formatValue((m_object->*m_function)()));
+    }
+
+private:
+    const C *m_object;
+    Function m_function;
+};
+
+template <class C>
+inline AbstractCommand * typedCommand(
+        C *object, void (C::*function)(DeviceRequest *))
+{
+    return new Command0<C>(object, function);
+}
+
+template <class C, typename A1>
+inline AbstractCommand * typedCommand(
+        C *object, void (C::*function)(DeviceRequest *, A1))
+{
+    return new Command1<C, A1>(object, function);
+}
+
+template <class C, typename A1, typename A2>
+inline AbstractCommand * typedCommand(
+        C *object, void (C::*function)(DeviceRequest *, A1, A2))
+{
+    return new Command2<C, A1, A2>(object, function);
+}
+
+template <class C, typename A1, typename A2, typename A3>
+inline AbstractCommand * typedCommand(
+        C *object, void (C::*function)(DeviceRequest *, A1, A2, A3))
+{
+    return new Command3<C, A1, A2, A3>(object, function);
+}
+
+template <class C, typename A1, typename A2, typename A3, typename A4>
+inline AbstractCommand * typedCommand(
+        C *object, void (C::*function)(DeviceRequest *, A1, A2, A3, A4))
+{
+    return new Command4<C, A1, A2, A3, A4>(object, function);
+}
+
+template <class C, typename R>
+inline AbstractCommand * getterCommand(
+        const C *object, R (C::*function)() const)
+{
+    return new GetterCommand<C, R>(object, function);
+}
+
+} // namespace Dcp
+
+#endif // DCPCLIENT_TYPEDCOMMAND_H
@@ -33,7 +33,7 @@ DcpDump::DcpDump(QObject *parent)
     : QObject(parent)
 {
     m_dcp.setAutoReconnect(true);
-    m_dcp.setReconnectInterval(5000);
+    m_dcp.setReconnectPolicy(Dcp::ReconnectPolicy(500, 2.0, 5000));
 
     connect(&m_dcp, SIGNAL(connected()), SLOT(connected()));
     connect(&m_dcp, SIGNAL(disconnected()), SLOT(disconnected()));
@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "dcptimeprobe.h"
+#include <dcpclient/message.h>
+#include <QtCore>
+
+static QTextStream cout(stdout, QIODevice::WriteOnly);
+
+/* Microseconds since the epoch; see probeTimeUsecs() in dcptimeserver.cpp. */
+static qint64 probeTimeUsecs()
+{
+    static QElapsedTimer timer;
+    static qint64 startTime = 0;
+    if (!timer.isValid()) {
+        startTime = QDateTime::currentMSecsSinceEpoch() * 1000;
+        timer.start();
+    }
+#if QT_VERSION >= QT_VERSION_CHECK(4, 8, 0)
+    return startTime + timer.nsecsElapsed() / 1000;
+#else
+    return startTime + timer.elapsed() * 1000;
+#endif
+}
+
+DcpTimeProbe::Stats::Stats()
+{
+    reset();
+}
+
+void DcpTimeProbe::Stats::reset()
+{
+    sent = received = lost = errors = 0;
+    rtt.reset();
+    bestRtt = -1;
+    bestOffset = 0;
+    offsetSum = 0;
+    minOffset = maxOffset = 0;
+}
+
+DcpTimeProbe::DcpTimeProbe(QObject *parent)
+    : QObject(parent),
+      m_target("dcptime"),
+      m_timeout(5000000),
+      m_out(&cout)
+{
+    m_dcp.setAutoReconnect(true);
+    connect(&m_dcp, SIGNAL(error(Dcp::Client::Error)),
+                    SLOT(error(Dcp::Client::Error)));
+    connect(&m_dcp, SIGNAL(stateChanged(Dcp::Client::State)),
+                    SLOT(stateChanged(Dcp::Client::State)));
+    connect(&m_dcp, SIGNAL(messageReceived()), SLOT(messageReceived()));
+
+    connect(&m_probeTimer, SIGNAL(timeout()), SLOT(sendProbe()));
+    connect(&m_summaryTimer, SIGNAL(timeout()), SLOT(printSummary()));
+    setRate(10);
+    setSummaryInterval(10);
+}
+
+DcpTimeProbe::~DcpTimeProbe()
+{
+    m_dcp.disconnectFromServer();
+}
+
+void DcpTimeProbe::setRate(double rate)
+{
+    int interval = rate > 0 ? qRound(1000.0 / rate) : 1000;
+    m_probeTimer.setInterval(qMax(interval, 1));
+}
+
+void DcpTimeProbe::setSummaryInterval(int secs)
+{
+    m_summaryTimer.setInterval(qMax(secs, 1) * 1000);
+}
+
+void DcpTimeProbe::connectToServer(const QString &serverName,
+                                   quint16 serverPort,
+                                   const QByteArray &deviceName)
+{
+    m_dcp.connectToServer(serverName, serverPort, deviceName);
+    m_summaryTimer.start();
+}
+
+void DcpTimeProbe::error(Dcp::Client::Error error)
+{
+    cout << "Error: " << m_dcp.errorString() << "." << endl;
+}
+
+void DcpTimeProbe::stateChanged(Dcp::Client::State state)
+{
+    switch (state)
+    {
+    case Dcp::Client::ConnectingState:
+        cout << "Connecting [" << m_dcp.serverName() << ":"
+             << m_dcp.serverPort() << "]..." << endl;
+        break;
+    case Dcp::Client::ConnectedState:
+        cout << "Connected [" << m_dcp.deviceName() << "]." << endl;
+        m_probeTimer.start();
+        break;
+    case Dcp::Client::UnconnectedState:
+        cout << "Disconnected." << endl;
+        m_probeTimer.stop();
+        break;
+    default:
+        break;
+    }
+}
+
+void DcpTimeProbe::sendProbe()
+{
+    qint64 t1 = probeTimeUsecs();
+    Dcp::Message msg = m_dcp.sendMessage(m_target,
+        "get probe " + QByteArray::number(t1));
+    m_pending.insert(msg.snr(), t1);
+    m_interval.sent++;
+    m_total.sent++;
+}
+
+void DcpTimeProbe::messageReceived()
+{
+    while (m_dcp.messagesAvailable() > 0)
+    {
+        qint64 t4 = probeTimeUsecs();
+        Dcp::Message msg = m_dcp.readMessage();
+
+        // only replies to our own probes are of interest; ACKs are skipped
+        // because the probe reply carries all the timestamps
+        if (!m_parser.parse(msg) || m_parser.isAckReply())
+            continue;
+        QHash<quint32, qint64>::iterator it = m_pending.find(msg.snr());
+        if (it == m_pending.end())
+            continue;
+        qint64 t1 = it.value();
+        m_pending.erase(it);
+
+        QList<QByteArray> args = m_parser.arguments();
+        bool ok = m_parser.errorCode() == 0 && args.size() == 3
+                && args[0].toLongLong() == t1;
+        qint64 t2 = ok ? args[1].toLongLong(&ok) : 0;
+        qint64 t3 = ok ? args[2].toLongLong(&ok) : 0;
+        if (!ok || t3 < t2) {
+            m_interval.errors++;
+            m_total.errors++;
+            continue;
+        }
+
+        qint64 rtt = (t4 - t1) - (t3 - t2);
+        qint64 offset = ((t2 - t1) + (t3 - t4)) / 2;
+
+        Stats *stats[2] = { &m_interval, &m_total };
+        for (int i = 0; i < 2; ++i) {
+            Stats &s = *stats[i];
+            s.rtt.record(rtt);
+            s.offsetSum += double(offset);
+            if (s.received == 0 || offset < s.minOffset)
+                s.minOffset = offset;
+            if (s.received == 0 || offset > s.maxOffset)
+                s.maxOffset = offset;
+
+            // like the NTP clock filter, trust the offset of the probe with
+            // the smallest round-trip time, as it has the least queueing
+            if (s.bestRtt < 0 || rtt < s.bestRtt) {
+                s.bestRtt = rtt;
+                s.bestOffset = offset;
+            }
+            s.received++;
+        }
+    }
+}
+
+void DcpTimeProbe::expireProbes(qint64 now)
+{
+    QHash<quint32, qint64>::iterator it = m_pending.begin();
+    while (it != m_pending.end()) {
+        if (now - it.value() > m_timeout) {
+            m_interval.lost++;
+            m_total.lost++;
+            it = m_pending.erase(it);
+        }
+        else
+            ++it;
+    }
+}
+
+void DcpTimeProbe::printSummary()
+{
+    expireProbes(probeTimeUsecs());
+    writeSummary("interval", m_interval);
+    m_interval.reset();
+}
+
+void DcpTimeProbe::printTotals()
+{
+    expireProbes(probeTimeUsecs());
+    writeSummary("total", m_total);
+}
+
+void DcpTimeProbe::writeSummary(const char *label, const Stats &stats)
+{
+    /* One line of key=value pairs per summary, all times in microseconds,
+     * so that the output can easily be fed into other tools.
+     */
+    QTextStream &out = *m_out;
+    out << QDateTime::currentDateTimeUtc().toString("yyyy-MM-ddTHH:mm:ss")
+        << "Z " << label
+        << " sent=" << stats.sent
+        << " received=" << stats.received
+        << " lost=" << stats.lost
+        << " errors=" << stats.errors;
+    if (stats.received > 0) {
+        const LatencyHistogram &h = stats.rtt;
+        out << " rtt_min=" << h.min()
+            << " rtt_mean=" << qRound64(h.mean())
+            << " rtt_p50=" << h.percentile(50)
+            << " rtt_p90=" << h.percentile(90)
+            << " rtt_p99=" << h.percentile(99)
+            << " rtt_p999=" << h.percentile(99.9)
+            << " rtt_max=" << h.max()
+            << " offset=" << stats.bestOffset
+            << " offset_mean="
+            << qRound64(stats.offsetSum / double(stats.received))
+            << " offset_min=" << stats.minOffset
+            << " offset_max=" << stats.maxOffset;
+    }
+    out << endl;
+}
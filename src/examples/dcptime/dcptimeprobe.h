@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DCPTIMEPROBE_H
+#define DCPTIMEPROBE_H
+
+#include "latencyhistogram.h"
+#include <dcpclient/client.h>
+#include <dcpclient/messageparser.h>
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QTimer>
+
+class QTextStream;
+
+/* Sends "get probe" commands to a DcpTimeServer at a fixed rate and
+ * measures the round-trip time through the hub as well as the clock offset
+ * between the two hosts, using the same four timestamps as NTP:
+ *
+ *   t1  probe sent by this client      t2  probe received by the server
+ *   t4  reply received by this client  t3  reply sent by the server
+ *
+ *   rtt    = (t4 - t1) - (t3 - t2)
+ *   offset = ((t2 - t1) + (t3 - t4)) / 2
+ *
+ * Probes are sent open-loop, independent of outstanding replies. A summary
+ * line is written after every interval and a cumulative one on exit.
+ */
+class DcpTimeProbe : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DcpTimeProbe(QObject *parent = 0);
+    virtual ~DcpTimeProbe();
+
+    void setTarget(const QByteArray &target) { m_target = target; }
+    void setRate(double rate);
+    void setSummaryInterval(int secs);
+    void setTimeout(int secs) { m_timeout = qint64(secs) * 1000000; }
+    void setOutput(QTextStream *out) { m_out = out; }
+
+    void connectToServer(const QString &serverName, quint16 serverPort,
+                         const QByteArray &deviceName);
+    void printTotals();
+
+protected slots:
+    void error(Dcp::Client::Error error);
+    void stateChanged(Dcp::Client::State state);
+    void messageReceived();
+    void sendProbe();
+    void printSummary();
+
+private:
+    struct Stats {
+        Stats();
+        void reset();
+        qint64 sent;
+        qint64 received;
+        qint64 lost;
+        qint64 errors;
+        LatencyHistogram rtt;
+        qint64 bestRtt;
+        qint64 bestOffset;
+        double offsetSum;
+        qint64 minOffset;
+        qint64 maxOffset;
+    };
+
+    void expireProbes(qint64 now);
+    void writeSummary(const char *label, const Stats &stats);
+
+    Q_DISABLE_COPY(DcpTimeProbe)
+    Dcp::Client m_dcp;
+    Dcp::ReplyParser m_parser;
+    QTimer m_probeTimer;
+    QTimer m_summaryTimer;
+    QByteArray m_target;
+    qint64 m_timeout;
+    QTextStream *m_out;
+    QHash<quint32, qint64> m_pending;   // snr -> t1
+    Stats m_interval;
+    Stats m_total;
+};
+
+#endif // DCPTIMEPROBE_H
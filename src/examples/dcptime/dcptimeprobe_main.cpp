@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "dcptimeprobe.h"
+#include <QtCore>
+#include <csignal>
+
+static QTextStream cout(stdout, QIODevice::WriteOnly);
+static QTextStream cerr(stderr, QIODevice::WriteOnly);
+
+static void exitHandler(int param) {
+    // shut down the application
+    QCoreApplication::exit(0);
+}
+
+class CmdLineOptions
+{
+public:
+    CmdLineOptions()
+        : serverName("localhost"),
+          serverPort(2001),
+          deviceName("dcptimeprobe"),
+          target("dcptime"),
+          rate(10),
+          interval(10),
+          timeout(5),
+          help(false)
+    {
+    }
+
+    bool parse()
+    {
+        QString appName = qApp->applicationName();
+        QStringList args = qApp->arguments();
+        for (QStringList::const_iterator it = args.begin()+1;
+             it != args.end(); ++it)
+        {
+            if (*it == "-h" || *it == "--help" || *it == "-help") {
+                printHelp();
+                help = true;
+                return true;
+            }
+            else if (*it == "-s") {
+                if (++it == args.end()) {
+                    printReqArg("-s");
+                    return false;
+                }
+                serverName = *it;
+            }
+            else if (*it == "-p") {
+                if (++it == args.end()) {
+                    printReqArg("-p");
+                    return false;
+                }
+                bool ok;
+                ushort value = it->toUShort(&ok);
+                if (!ok) {
+                    cerr << appName << ": argument of option `-p' must be "
+                         << "an integer.\n" << moreInfo() << endl;
+                    return false;
+                }
+                serverPort = quint16(value);
+            }
+            else if (*it == "-n") {
+                if (++it == args.end()) {
+                    printReqArg("-n");
+                    return false;
+                }
+                deviceName = it->toLatin1();
+            }
+            else if (*it == "-t") {
+                if (++it == args.end()) {
+                    printReqArg("-t");
+                    return false;
+                }
+                target = it->toLatin1();
+            }
+            else if (*it == "-r") {
+                if (++it == args.end()) {
+                    printReqArg("-r");
+                    return false;
+                }
+                bool ok;
+                rate = it->toDouble(&ok);
+                if (!ok || rate <= 0 || rate > 1000) {
+                    cerr << appName << ": argument of option `-r' must be "
+                         << "a number between 0 and 1000.\n" << moreInfo()
+                         << endl;
+                    return false;
+                }
+            }
+            else if (*it == "-i" || *it == "-w") {
+                QString opt = *it;
+                if (++it == args.end()) {
+                    printReqArg(opt);
+                    return false;
+                }
+                bool ok;
+                int value = it->toInt(&ok);
+                if (!ok || value < 1) {
+                    cerr << appName << ": argument of option `" << opt
+                         << "' must be a positive integer.\n" << moreInfo()
+                         << endl;
+                    return false;
+                }
+                (opt == "-i" ? interval : timeout) = value;
+            }
+            else if (*it == "-o") {
+                if (++it == args.end()) {
+                    printReqArg("-o");
+                    return false;
+                }
+                outputFile = *it;
+            }
+            else if (it->startsWith('-')) {
+                cerr << appName << ": unknown option `" << *it << "'.\n"
+                     << moreInfo() << endl;
+                return false;
+            }
+            else {
+                cerr << appName << ": invalid argument `" << *it << "'.\n"
+                     << moreInfo() << endl;
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    static void printHelp() {
+        cout << "Usage: " << qApp->applicationName()
+             << " [-s server] [-p port] [-n name] [-t target] [-r rate]\n"
+             << "       [-i interval] [-w timeout] [-o file]\n"
+             << "\n"
+             << "  -t  device name of the DcpTimeServer (default: dcptime)\n"
+             << "  -r  probes per second (default: 10)\n"
+             << "  -i  seconds between summaries (default: 10)\n"
+             << "  -w  seconds until a probe is counted as lost (default: 5)\n"
+             << "  -o  append summaries to file instead of stdout"
+             << endl;
+    }
+
+    static void printReqArg(const QString &optionName) {
+        cerr << qApp->applicationName() << ": option `" << optionName
+             << "' requires an argument.\n" << moreInfo() << endl;
+    }
+
+    static QString moreInfo() {
+        return QString("Try `%1 --help' for more information.")
+                .arg(qApp->applicationName());
+    }
+
+    QString serverName;
+    quint16 serverPort;
+    QByteArray deviceName;
+    QByteArray target;
+    double rate;
+    int interval;
+    int timeout;
+    QString outputFile;
+    bool help;
+};
+
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName(QFileInfo(app.arguments()[0]).fileName());
+
+    // use custom signal handler for SIGINT and SIGTERM
+    signal(SIGINT, exitHandler);
+    signal(SIGTERM, exitHandler);
+
+    CmdLineOptions opts;
+    if (!opts.parse())
+        return 1;
+    else if (opts.help)
+        return 0;
+
+    QFile file;
+    QTextStream fileStream;
+    if (!opts.outputFile.isEmpty()) {
+        file.setFileName(opts.outputFile);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+            cerr << app.applicationName() << ": cannot open `"
+                 << opts.outputFile << "': " << file.errorString() << endl;
+            return 1;
+        }
+        fileStream.setDevice(&file);
+    }
+
+    DcpTimeProbe probe;
+    probe.setTarget(opts.target);
+    probe.setRate(opts.rate);
+    probe.setSummaryInterval(opts.interval);
+    probe.setTimeout(opts.timeout);
+    if (file.isOpen())
+        probe.setOutput(&fileStream);
+    probe.connectToServer(opts.serverName, opts.serverPort, opts.deviceName);
+
+    int ret = app.exec();
+    probe.printTotals();
+    return ret;
+}
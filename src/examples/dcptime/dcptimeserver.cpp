@@ -29,15 +29,54 @@
 
 static QTextStream cout(stdout, QIODevice::WriteOnly);
 
+/* Wall clock time in microseconds since the epoch. The wall clock is only
+ * read once; later values are derived from a monotonic timer, so that
+ * probe timestamps have microsecond resolution and never jump backwards.
+ */
+static qint64 probeTimeUsecs()
+{
+    static QElapsedTimer timer;
+    static qint64 startTime = 0;
+    if (!timer.isValid()) {
+        startTime = QDateTime::currentMSecsSinceEpoch() * 1000;
+        timer.start();
+    }
+#if QT_VERSION >= QT_VERSION_CHECK(4, 8, 0)
+    return startTime + timer.nsecsElapsed() / 1000;
+#else
+    return startTime + timer.elapsed() * 1000;
+#endif
+}
+
 DcpTimeServer::DcpTimeServer(QObject *parent)
-    : QObject(parent), m_timeMode("utc")
+    : QObject(parent), m_server(&m_dcp), m_timeMode("utc"),
+      m_modeSubscribed(false)
 {
     m_dcp.setAutoReconnect(true);
     connect(&m_dcp, SIGNAL(error(Dcp::Client::Error)),
                     SLOT(error(Dcp::Client::Error)));
     connect(&m_dcp, SIGNAL(stateChanged(Dcp::Client::State)),
                     SLOT(stateChanged(Dcp::Client::State)));
-    connect(&m_dcp, SIGNAL(messageReceived()), SLOT(messageReceived()));
+
+    // get probe takes the client's send time in microseconds as single
+    // argument, all other get commands have no additional argument; reply
+    // messages are ignored
+    const char *getTime = SLOT(getTime(Dcp::DeviceRequest *));
+    m_server.addCommand(Dcp::CommandParser::GetCmd, "mode",
+                        Dcp::getterCommand(this, &DcpTimeServer::timeMode));
+    m_server.addCommand(Dcp::CommandParser::GetCmd, "time", this, getTime);
+    m_server.addCommand(Dcp::CommandParser::GetCmd, "date", this, getTime);
+    m_server.addCommand(Dcp::CommandParser::GetCmd, "datetime", this, getTime);
+    m_server.addCommand(Dcp::CommandParser::GetCmd, "julian",
+                        this, SLOT(getJulian(Dcp::DeviceRequest *)));
+    m_server.addCommand(Dcp::CommandParser::GetCmd, "probe",
+                        Dcp::typedCommand(this, &DcpTimeServer::getProbe));
+    m_server.addCommand(Dcp::CommandParser::SetCmd, "mode",
+                        this, SLOT(setMode(Dcp::DeviceRequest *)), 1, 1);
+    m_server.addCommand(Dcp::CommandParser::DefCmd, "mode",
+                        this, SLOT(defMode(Dcp::DeviceRequest *)));
+    m_server.addCommand(Dcp::CommandParser::UndefCmd, "mode",
+                        this, SLOT(defMode(Dcp::DeviceRequest *)));
 }
 
 DcpTimeServer::~DcpTimeServer()
@@ -69,6 +108,8 @@ void DcpTimeServer::stateChanged(Dcp::Client::State state)
         cout << "Connected [" << m_dcp.deviceName() << "]." << endl;
         break;
     case Dcp::Client::UnconnectedState:
+        // the hub renews subscriptions when we are registered again
+        m_modeSubscribed = false;
         cout << "Disconnected." << endl;
         break;
     default:
@@ -76,93 +117,68 @@ void DcpTimeServer::stateChanged(Dcp::Client::State state)
     }
 }
 
-void DcpTimeServer::messageReceived()
+QDateTime DcpTimeServer::currentDateTime() const
 {
-    Dcp::Message msg = m_dcp.readMessage();
+    return (m_timeMode == "local") ?
+        QDateTime::currentDateTime() : QDateTime::currentDateTimeUtc();
+}
 
-    // ignore reply messages
-    if (msg.isReply())
-        return;
+void DcpTimeServer::getTime(Dcp::DeviceRequest *request)
+{
+    QDateTime now = currentDateTime();
+    QByteArray identifier = request->identifier();
+    if (identifier == "time")
+        request->setReply(now.toString("HH:mm:ss.zzz").toLatin1());
+    else if (identifier == "date")
+        request->setReply(now.toString("yyyy-MM-dd").toLatin1());
+    else
+        request->setReply(
+            now.toString("yyyy-MM-ddTHH:mm:ss.zzz").toLatin1());
+}
 
-    // parse command messages
-    if (!m_parser.parse(msg)) {
-        m_dcp.sendMessage(msg.ackMessage(Dcp::AckUnknownCommandError));
-        return;
-    }
+void DcpTimeServer::getJulian(Dcp::DeviceRequest *request)
+{
+    QDateTime now = currentDateTime().toUTC();
+    double julian = now.date().toJulianDay() - 0.5;
+    julian += now.time().hour() / 24.0;
+    julian += now.time().minute() / (24.0 * 60.0);
+    julian += now.time().second() / (24.0 * 3600.0);
+    julian += now.time().msec() / (24.0 * 3600000.0);
+    request->setReply(QByteArray::number(julian, 'f', 8));
+}
 
-    // get current date and time
-    QDateTime now = (m_timeMode == "local") ?
-        QDateTime::currentDateTime() : QDateTime::currentDateTimeUtc();
+void DcpTimeServer::getProbe(Dcp::DeviceRequest *request, qint64 sendTime)
+{
+    // take the receive time before doing anything else; the message has
+    // only been parsed since it was read from the socket
+    qint64 recvTime = probeTimeUsecs();
+
+    // reply: <client send time> <receive time> <send time>
+    QByteArray data = QByteArray::number(sendTime);
+    data += ' ';
+    data += QByteArray::number(recvTime);
+    data += ' ';
+    data += QByteArray::number(probeTimeUsecs());
+    request->setReply(data);
+}
 
-    // handle command messages
-    QList<QByteArray> args = m_parser.arguments();
-    QByteArray identifier = m_parser.identifier();
-    static const QList<QByteArray> getters = QList<QByteArray>()
-            << "mode" << "time" << "date" << "datetime" << "julian";
-    switch (m_parser.cmdType())
-    {
-    case Dcp::CommandParser::GetCmd:
-        // check for valid identifier
-        if (!getters.contains(identifier)) {
-            m_dcp.sendMessage(msg.ackMessage(Dcp::AckUnknownCommandError));
-            return;
-        }
-
-        // all supported get commands have no additional argument
-        if (!args.isEmpty()) {
-            m_dcp.sendMessage(msg.ackMessage(Dcp::AckParameterError));
-            return;
-        }
-
-        // command is valid
-        m_dcp.sendMessage(msg.ackMessage());
-
-        if (identifier == "mode") {
-            m_dcp.sendMessage(msg.replyMessage(m_timeMode));
-        }
-        else if (identifier == "time") {
-            m_dcp.sendMessage(msg.replyMessage(
-                now.toString("HH:mm:ss.zzz").toLatin1()));
-        }
-        else if (identifier == "date") {
-            m_dcp.sendMessage(msg.replyMessage(
-                now.toString("yyyy-MM-dd").toLatin1()));
-        }
-        else if (identifier == "datetime") {
-            m_dcp.sendMessage(msg.replyMessage(
-                now.toString("yyyy-MM-ddTHH:mm:ss.zzz").toLatin1()));
-        }
-        else if (identifier == "julian") {
-            now = now.toUTC();
-            double julian = now.date().toJulianDay() - 0.5;
-            julian += now.time().hour() / 24.0;
-            julian += now.time().minute() / (24.0 * 60.0);
-            julian += now.time().second() / (24.0 * 3600.0);
-            julian += now.time().msec() / (24.0 * 3600000.0);
-            m_dcp.sendMessage(msg.replyMessage(
-                QByteArray::number(julian, 'f', 8)));
-        }
-        break;
+void DcpTimeServer::setMode(Dcp::DeviceRequest *request)
+{
+    QByteArray mode = request->argument(0);
+    if (mode != "local" && mode != "utc") {
+        request->reject(Dcp::AckParameterError);
+        return;
+    }
+    m_timeMode = mode;
 
-    case Dcp::CommandParser::SetCmd:
-        // only set mode command with one argument
-        if (identifier != "mode") {
-            m_dcp.sendMessage(msg.ackMessage(Dcp::AckUnknownCommandError));
-        }
-        else if (args.size() != 1 || (args[0] != "local" && args[0] != "utc")) {
-            m_dcp.sendMessage(msg.ackMessage(Dcp::AckParameterError));
-        }
-        else {
-            m_dcp.sendMessage(msg.ackMessage());
-            m_timeMode = args[0];
-            m_dcp.sendMessage(msg.replyMessage("FIN"));
-        }
-        break;
+    // publish the new mode, the hub passes it on to all subscribers
+    if (m_modeSubscribed)
+        m_dcp.sendMessage(QByteArray(), "def mode " + m_timeMode);
+}
 
-    case Dcp::CommandParser::DefCmd:
-    case Dcp::CommandParser::UndefCmd:
-        // there are no supported def or undef commands
-        m_dcp.sendMessage(msg.ackMessage(Dcp::AckUnknownCommandError));
-        break;
-    }
+void DcpTimeServer::defMode(Dcp::DeviceRequest *request)
+{
+    // the hub sends def mode when the first client subscribes to the mode
+    // and undef mode when the last subscription is cancelled
+    m_modeSubscribed = request->cmdType() == Dcp::CommandParser::DefCmd;
 }
@@ -27,10 +27,12 @@
 #define DCPTIMESERVER_H
 
 #include <dcpclient/client.h>
-#include <dcpclient/messageparser.h>
+#include <dcpclient/deviceserver.h>
+#include <dcpclient/typedcommand.h>
 #include <QObject>
 #include <QString>
 #include <QByteArray>
+#include <QDateTime>
 
 class DcpTimeServer : public QObject
 {
@@ -45,13 +47,21 @@ public:
 protected slots:
     void error(Dcp::Client::Error error);
     void stateChanged(Dcp::Client::State state);
-    void messageReceived();
+    void getTime(Dcp::DeviceRequest *request);
+    void getJulian(Dcp::DeviceRequest *request);
+    void setMode(Dcp::DeviceRequest *request);
+    void defMode(Dcp::DeviceRequest *request);
 
 private:
     Q_DISABLE_COPY(DcpTimeServer)
+    QDateTime currentDateTime() const;
+    QByteArray timeMode() const { return m_timeMode; }
+    void getProbe(Dcp::DeviceRequest *request, qint64 sendTime);
+
     Dcp::Client m_dcp;
-    Dcp::CommandParser m_parser;
+    Dcp::DeviceServer m_server;
     QByteArray m_timeMode;
+    bool m_modeSubscribed;
 };
 
 #endif // DCPTIMESERVER_H
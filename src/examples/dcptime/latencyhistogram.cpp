@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "latencyhistogram.h"
+
+enum {
+    SubBucketBits = 6,
+    SubBucketCount = 1 << SubBucketBits,   // buckets per power of two
+    LinearCount = 2 * SubBucketCount,      // values recorded exactly
+    BucketCount = LinearCount + (63 - SubBucketBits) * SubBucketCount
+};
+
+LatencyHistogram::LatencyHistogram()
+    : m_buckets(BucketCount, 0),
+      m_count(0),
+      m_min(0),
+      m_max(0),
+      m_sum(0)
+{
+}
+
+int LatencyHistogram::bucketIndex(qint64 value)
+{
+    if (value < LinearCount)
+        return value < 0 ? 0 : int(value);
+
+    // position of the most significant bit
+    int msb = 0;
+    for (quint64 v = quint64(value); v > 1; v >>= 1)
+        ++msb;
+
+    // keep SubBucketBits+1 significant bits of the value
+    int shift = msb - SubBucketBits;
+    int sub = int(value >> shift) - SubBucketCount;
+    return LinearCount + (shift - 1) * SubBucketCount + sub;
+}
+
+qint64 LatencyHistogram::bucketValue(int index)
+{
+    if (index < LinearCount)
+        return index;
+
+    // report the highest value that maps to the bucket
+    int shift = (index - LinearCount) / SubBucketCount + 1;
+    qint64 sub = (index - LinearCount) % SubBucketCount + SubBucketCount;
+    return (sub << shift) + ((qint64(1) << shift) - 1);
+}
+
+void LatencyHistogram::record(qint64 value)
+{
+    if (value < 0)
+        value = 0;
+
+    ++m_buckets[bucketIndex(value)];
+    if (m_count == 0 || value < m_min)
+        m_min = value;
+    if (m_count == 0 || value > m_max)
+        m_max = value;
+    m_sum += double(value);
+    ++m_count;
+}
+
+void LatencyHistogram::add(const LatencyHistogram &other)
+{
+    if (other.m_count == 0)
+        return;
+
+    for (int i = 0; i < BucketCount; ++i)
+        m_buckets[i] += other.m_buckets[i];
+    if (m_count == 0 || other.m_min < m_min)
+        m_min = other.m_min;
+    if (m_count == 0 || other.m_max > m_max)
+        m_max = other.m_max;
+    m_sum += other.m_sum;
+    m_count += other.m_count;
+}
+
+void LatencyHistogram::reset()
+{
+    m_buckets.fill(0);
+    m_count = 0;
+    m_min = 0;
+    m_max = 0;
+    m_sum = 0;
+}
+
+double LatencyHistogram::mean() const
+{
+    return m_count ? m_sum / double(m_count) : 0.0;
+}
+
+qint64 LatencyHistogram::percentile(double p) const
+{
+    if (m_count == 0)
+        return 0;
+
+    // number of values that must be at or below the result
+    qint64 rank = qint64(p / 100.0 * double(m_count) + 0.5);
+    if (rank < 1)
+        rank = 1;
+    else if (rank > m_count)
+        rank = m_count;
+
+    qint64 seen = 0;
+    for (int i = 0; i < BucketCount; ++i) {
+        seen += m_buckets[i];
+        if (seen >= rank)
+            return qBound(m_min, bucketValue(i), m_max);
+    }
+    return m_max;
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "capturefilter.h"
+#include "dcppacket.h"
+#include <cstring>
+
+CaptureFilter::CaptureFilter()
+{
+    clear();
+}
+
+void CaptureFilter::clear()
+{
+    m_tests = 0;
+    m_source.clear();
+    m_destination.clear();
+    m_device.clear();
+    m_flagsMask = 0;
+    m_flagsValue = 0;
+    m_prefix.clear();
+    m_sampleRate = 1;
+    m_sampleCount = 0;
+}
+
+void CaptureFilter::setSource(const QByteArray &source)
+{
+    Q_ASSERT(source.isEmpty() || source.size() == MessageDeviceNameSize);
+    m_source = source;
+    setTest(SourceTest, !source.isEmpty());
+}
+
+void CaptureFilter::setDestination(const QByteArray &destination)
+{
+    Q_ASSERT(destination.isEmpty() ||
+             destination.size() == MessageDeviceNameSize);
+    m_destination = destination;
+    setTest(DestinationTest, !destination.isEmpty());
+}
+
+/*
+    Matches packets which have the device as source or destination.
+ */
+void CaptureFilter::setDevice(const QByteArray &device)
+{
+    Q_ASSERT(device.isEmpty() || device.size() == MessageDeviceNameSize);
+    m_device = device;
+    setTest(DeviceTest, !device.isEmpty());
+}
+
+/*
+    Matches packets with (flags & mask) == value.
+ */
+void CaptureFilter::setFlags(quint16 mask, quint16 value)
+{
+    m_flagsMask = mask;
+    m_flagsValue = value & mask;
+    setTest(FlagsTest, mask != 0);
+}
+
+void CaptureFilter::setPayloadPrefix(const QByteArray &prefix)
+{
+    m_prefix = prefix;
+    setTest(PrefixTest, !prefix.isEmpty());
+}
+
+/*
+    Captures only every n-th packet that passes all other tests.
+ */
+void CaptureFilter::setSampleRate(int n)
+{
+    m_sampleRate = qMax(n, 1);
+    m_sampleCount = 0;
+}
+
+bool CaptureFilter::matches(const QByteArray &packet)
+{
+    if (isNull())
+        return true;
+    if (packet.size() < FullHeaderSize)
+        return false;
+
+    const char *msgHeader = packet.constData() + PacketHeaderSize;
+    const char *src = msgHeader + MessageSourcePos;
+    const char *dst = msgHeader + MessageDestinationPos;
+
+    if (m_tests & SourceTest) {
+        if (std::memcmp(src, m_source.constData(), MessageDeviceNameSize))
+            return false;
+    }
+    if (m_tests & DestinationTest) {
+        if (std::memcmp(dst, m_destination.constData(),
+                        MessageDeviceNameSize))
+            return false;
+    }
+    if (m_tests & DeviceTest) {
+        if (std::memcmp(src, m_device.constData(), MessageDeviceNameSize) &&
+                std::memcmp(dst, m_device.constData(), MessageDeviceNameSize))
+            return false;
+    }
+    if (m_tests & FlagsTest) {
+        quint16 flags = qFromBigEndian(*reinterpret_cast<const quint16 *>(
+            msgHeader + MessageFlagsPos));
+        if ((flags & m_flagsMask) != m_flagsValue)
+            return false;
+    }
+    if (m_tests & PrefixTest) {
+        if (packet.size() - FullHeaderSize < m_prefix.size() ||
+                std::memcmp(packet.constData() + FullHeaderSize,
+                            m_prefix.constData(), m_prefix.size()))
+            return false;
+    }
+
+    if (m_sampleRate > 1) {
+        if (++m_sampleCount < m_sampleRate)
+            return false;
+        m_sampleCount = 0;
+    }
+    return true;
+}
+
+void CaptureFilter::setTest(Test test, bool enable)
+{
+    if (enable)
+        m_tests |= test;
+    else
+        m_tests &= ~test;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DCPHUB_CAPTUREFILTER_H
+#define DCPHUB_CAPTUREFILTER_H
+
+#include <QtGlobal>
+#include <QByteArray>
+
+// Selects the packets that are captured by the debug output. The filter is
+// evaluated on the raw packet data; only the enabled tests are performed.
+class CaptureFilter
+{
+public:
+    CaptureFilter();
+
+    bool isNull() const { return m_tests == 0 && m_sampleRate <= 1; }
+    void clear();
+
+    // device names are expected as NUL-padded device keys
+    QByteArray source() const { return m_source; }
+    void setSource(const QByteArray &source);
+    QByteArray destination() const { return m_destination; }
+    void setDestination(const QByteArray &destination);
+    QByteArray device() const { return m_device; }
+    void setDevice(const QByteArray &device);
+
+    quint16 flagsMask() const { return m_flagsMask; }
+    quint16 flagsValue() const { return m_flagsValue; }
+    void setFlags(quint16 mask, quint16 value);
+
+    QByteArray payloadPrefix() const { return m_prefix; }
+    void setPayloadPrefix(const QByteArray &prefix);
+
+    int sampleRate() const { return m_sampleRate; }
+    void setSampleRate(int n);
+
+    bool matches(const QByteArray &packet);
+
+private:
+    enum Test {
+        SourceTest      = 0x01,
+        DestinationTest = 0x02,
+        DeviceTest      = 0x04,
+        FlagsTest       = 0x08,
+        PrefixTest      = 0x10
+    };
+
+    void setTest(Test test, bool enable);
+
+    int m_tests;
+    QByteArray m_source;
+    QByteArray m_destination;
+    QByteArray m_device;
+    quint16 m_flagsMask;
+    quint16 m_flagsValue;
+    QByteArray m_prefix;
+    int m_sampleRate;
+    int m_sampleCount;
+};
+
+#endif // DCPHUB_CAPTUREFILTER_H
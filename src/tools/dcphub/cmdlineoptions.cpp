@@ -35,6 +35,8 @@ CmdLineOptions::CmdLineOptions()
       port(2001),
       deviceName("dcphub"),
       debugFlags(DcpHub::NoDebug),
+      recordSegments(16),
+      recordSegmentSize(64),
       help(false)
 {
 }
@@ -109,6 +111,119 @@ bool CmdLineOptions::parse()
                 return false;
             }
         }
+        else if (*it == "-R") {
+            if (++it == args.end()) {
+                printReqArg("-R");
+                return false;
+            }
+
+            recordDir = *it;
+        }
+        else if (*it == "-N") {
+            if (++it == args.end()) {
+                printReqArg("-N");
+                return false;
+            }
+
+            bool ok;
+            int value = it->toInt(&ok);
+            if (!ok || value < 2) {
+                cerr << appName << ": argument of option `-N' must be "
+                     << "an integer greater than 1.\n" << moreInfo() << endl;
+                return false;
+            }
+
+            recordSegments = value;
+        }
+        else if (*it == "-Z") {
+            if (++it == args.end()) {
+                printReqArg("-Z");
+                return false;
+            }
+
+            bool ok;
+            int value = it->toInt(&ok);
+            if (!ok || value < 1 || value > 4095) {
+                cerr << appName << ": argument of option `-Z' must be "
+                     << "an integer between 1 and 4095.\n" << moreInfo()
+                     << endl;
+                return false;
+            }
+
+            recordSegmentSize = value;
+        }
+        else if (*it == "-u") {
+            if (++it == args.end()) {
+                printReqArg("-u");
+                return false;
+            }
+
+            handoffPath = *it;
+        }
+        else if (*it == "-T") {
+            if (++it == args.end()) {
+                printReqArg("-T");
+                return false;
+            }
+
+            takeOverPath = *it;
+        }
+        else if (*it == "-P") {
+            if (++it == args.end()) {
+                printReqArg("-P");
+                return false;
+            }
+
+            QString host = *it;
+            ushort value = 2001;
+            bool ok = true;
+            int pos = host.lastIndexOf(':');
+            if (pos != -1) {
+                value = host.mid(pos + 1).toUShort(&ok);
+                host.truncate(pos);
+            }
+            if (!ok || host.isEmpty()) {
+                cerr << appName << ": argument of option `-P' must be "
+                     << "of the form host[:port].\n" << moreInfo() << endl;
+                return false;
+            }
+
+            peerHosts.append(host);
+            peerPorts.append(quint16(value));
+        }
+        else if (*it == "-A") {
+            if (++it == args.end()) {
+                printReqArg("-A");
+                return false;
+            }
+
+            QHostAddress peerAddress;
+            if (!peerAddress.setAddress(*it)) {
+                cerr << appName << ": argument of option `-A' must be "
+                     << "a valid host address.\n" << moreInfo() << endl;
+                return false;
+            }
+            allowedPeers.append(peerAddress);
+        }
+        else if (*it == "-g") {
+            if (++it == args.end()) {
+                printReqArg("-g");
+                return false;
+            }
+
+            QByteArray value = it->toLatin1();
+            int pos = value.indexOf('=');
+            if (pos < 1) {
+                cerr << appName << ": argument of option `-g' must be "
+                     << "of the form name=dev1,dev2,....\n" << moreInfo()
+                     << endl;
+                return false;
+            }
+
+            groupNames.append(value.left(pos));
+            groupMembers.append(value.mid(pos + 1).split(','));
+            groupMembers.last().removeAll(QByteArray());
+        }
         else if (it->startsWith('-')) {
             cerr << appName << ": unknown option `" << *it << "'.\n"
                  << moreInfo() << endl;
@@ -129,6 +244,23 @@ void CmdLineOptions::printHelp()
 {
     cout << "Usage: " << qApp->applicationName()
          << " [-a address] [-p port] [-n name] [-d none|msg|pkg|full]"
+         << " [-R dir [-N segments] [-Z segment_mb]]"
+         << " [-u handoff_socket] [-T handoff_socket]"
+         << " [-P host[:port] ...] [-A address ...]"
+         << " [-g name=dev1,dev2,... ...]\n"
+         << "\n"
+         << "  -u  accept connection handoff requests on the Unix socket\n"
+         << "  -T  take over the connections of the hub listening on the\n"
+         << "      Unix socket, instead of listening on address and port\n"
+         << "  -P  link to the peer hub at host and port (default 2001),\n"
+         << "      may be given more than once\n"
+         << "  -A  accept links of peer hubs at the address, may be given\n"
+         << "      more than once; a peer link is only rate limited by a\n"
+         << "      limit set for the peer hub's name, which delays or drops\n"
+         << "      packets but never disconnects, and pair limits apply to\n"
+         << "      the remote source devices\n"
+         << "  -g  define a group; packets sent to the group name are passed\n"
+         << "      on to all devices of the group, may be given more than once"
          << endl;
 }
 
@@ -28,11 +28,12 @@
 
 #include "dcphub.h"  // for DcpHub::DebugFlags
 #include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QList>
 #include <QTextStream>
 #include <QHostAddress>
 
-class QString;
-
 class CmdLineOptions
 {
     QTextStream cout;
@@ -52,6 +53,16 @@ public:
     quint16 port;
     QByteArray deviceName;
     DcpHub::DebugFlags debugFlags;
+    QString recordDir;
+    int recordSegments;
+    int recordSegmentSize;  // in MiB
+    QString handoffPath;
+    QString takeOverPath;
+    QStringList peerHosts;
+    QList<quint16> peerPorts;
+    QList<QHostAddress> allowedPeers;
+    QList<QByteArray> groupNames;
+    QList<QList<QByteArray> > groupMembers;
     bool help;
 };
 
@@ -25,12 +25,39 @@
 
 #include "dcphub.h"
 #include "dcppacket.h"
+#include "packetlogger.h"
 #include <dcpclient/message.h>
-#include <dcpclient/messageparser.h>
 #include <dcpclient/version.h>
 #include <QtCore>
 #include <QTcpServer>
 #include <QTcpSocket>
+#include <QSocketNotifier>
+
+#ifdef Q_OS_UNIX
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
+// identifies the records exchanged during a connection handoff
+static const char HandoffRequest[] = "TAKEOVER 1";
+static const char HandoffDone[] = "DONE";
+static const char HandoffAbort[] = "ABORT ";
+static const char HandoffMagic[] = "DCPHUB-HANDOFF";
+enum { HandoffVersion = 6 };
+
+// control messages exchanged between peer hubs, see addPeer()
+static const char PeerHello[] = "PEER 1";
+enum { PeerDevicesPerPacket = 1000, PeerRetryInterval = 5000 };
+
+// maximum number of destination patterns resolved by routeToPattern()
+enum { PatternCacheSize = 1024 };
+
+// maximum number of pair limit buckets per connection
+enum { MaxPairLimitStates = 1024 };
 
 QByteArray joined(const QList<QByteArray> &list, char sep = ' ')
 {
@@ -55,22 +82,112 @@ QByteArray deviceKey(const QByteArray &deviceName, bool percentDecode = false)
     return key;
 }
 
+// Rate limits are stored by device key; "*" is used as wildcard.
+QByteArray limitKey(const QByteArray &deviceName)
+{
+    return deviceName == "*" ? deviceName : deviceKey(deviceName, true);
+}
+
+// Checks the message data of a raw packet without copying it.
+static bool hasDataPrefix(const QByteArray &data, const char *prefix)
+{
+    int len = int(qstrlen(prefix));
+    return data.size() >= int(FullHeaderSize) + len &&
+           qstrncmp(data.constData() + FullHeaderSize, prefix, len) == 0;
+}
+
+QByteArray limitKeyName(const QByteArray &key)
+{
+    int n = key.size();
+    while (n > 0 && (key[n-1] == '\0'))
+        n--;
+    return Dcp::percentEncodeSpaces(key.left(n));
+}
+
 DcpHub::DcpHub(QObject *parent)
     : QObject(parent),
       cout(stdout, QIODevice::WriteOnly),
       cerr(stderr, QIODevice::WriteOnly),
-      hexfmt(16, HexFormatter::ShowPosition | HexFormatter::ShowText, '.'),
+      m_logger(new PacketLogger(4 << 20, this)),
+      m_recordSegmentCount(0),
+      m_recordSegmentSize(0),
+      m_nextConnectionId(1),
       m_tcpServer(new QTcpServer(this)),
+      m_schedTimer(new QTimer(this)),
+      m_schedQuantum(4096),
+      m_schedBudget(256),
+      m_limitsVersion(0),
+      m_rateTimer(new QTimer(this)),
+      m_rateTimerDue(0),
+      m_handoffNotifier(0),
+      m_peerTimer(new QTimer(this)),
+      m_deviceListValid(false),
       m_serverDeviceName("dcphub"),
       m_printTimestamp(false),
-      m_debugFlags(NoDebug)
+      m_debugFlags(NoDebug),
+      m_commandServer(new Dcp::DeviceServer(this, this))
 {
+    m_schedTimer->setSingleShot(true);
+    m_schedTimer->setInterval(0);
+    m_rateTimer->setSingleShot(true);
+    m_peerTimer->setInterval(PeerRetryInterval);
+    m_clock.start();
+    m_logger->start();
     connect(m_tcpServer, SIGNAL(newConnection()), SLOT(newConnection()));
+    connect(m_schedTimer, SIGNAL(timeout()), SLOT(processReadySockets()));
+    connect(m_rateTimer, SIGNAL(timeout()), SLOT(processDelayedPackets()));
+    connect(m_peerTimer, SIGNAL(timeout()), SLOT(connectPeers()));
+
+    // commands sent to the hub device, see handleCommand()
+    const Dcp::CommandParser::CmdType get = Dcp::CommandParser::GetCmd;
+    const Dcp::CommandParser::CmdType set = Dcp::CommandParser::SetCmd;
+    const int unlimited = Dcp::DeviceServer::UnlimitedArguments;
+    Dcp::DeviceServer *server = m_commandServer;
+    server->addCommand(get, "devlist", this,
+                       SLOT(getDevList(Dcp::DeviceRequest *)));
+    server->addCommand(get, "devinfo", this,
+                       SLOT(getDevInfo(Dcp::DeviceRequest *)), 0, unlimited);
+    server->addCommand(get, "ratelimit", this,
+                       SLOT(getRateLimit(Dcp::DeviceRequest *)), 0, 2);
+    server->addCommand(get, "ratestats", this,
+                       SLOT(getRateStats(Dcp::DeviceRequest *)), 0, unlimited);
+    server->addCommand(get, "group", this,
+                       SLOT(getGroup(Dcp::DeviceRequest *)), 0, 1);
+    server->addCommand(get, "subscriptions", this,
+                       SLOT(getSubscriptions(Dcp::DeviceRequest *)), 0, 1);
+    server->addCommand(get, "debug", this,
+                       SLOT(getDebug(Dcp::DeviceRequest *)));
+    server->addCommand(get, "capture", this,
+                       SLOT(getCapture(Dcp::DeviceRequest *)));
+    server->addCommand(get, "logstats", this,
+                       SLOT(getLogStats(Dcp::DeviceRequest *)));
+    server->addCommand(get, "version", this,
+                       SLOT(getVersion(Dcp::DeviceRequest *)));
+    server->addCommand(get, "qtversion", this,
+                       SLOT(getQtVersion(Dcp::DeviceRequest *)));
+    server->addCommand(get, "echo", this,
+                       SLOT(getEcho(Dcp::DeviceRequest *)), 1, unlimited);
+    server->addCommand(set, "nop", this,
+                       SLOT(setNop(Dcp::DeviceRequest *)));
+    server->addCommand(set, "subscribe", this,
+                       SLOT(setSubscribe(Dcp::DeviceRequest *)), 2, 2);
+    server->addCommand(set, "unsubscribe", this,
+                       SLOT(setSubscribe(Dcp::DeviceRequest *)), 2, 2);
+    server->addCommand(set, "debug", this,
+                       SLOT(setDebug(Dcp::DeviceRequest *)), 1, 1);
+    server->addCommand(set, "capture", this,
+                       SLOT(setCapture(Dcp::DeviceRequest *)), 1, unlimited);
+    server->addCommand(set, "group", this,
+                       SLOT(setGroupMembers(Dcp::DeviceRequest *)),
+                       1, unlimited);
+    server->addCommand(set, "ratelimit", this,
+                       SLOT(setRateLimit(Dcp::DeviceRequest *)), 1, 5);
 }
 
 DcpHub::~DcpHub()
 {
     close();
+    m_logger->stop();
     delete m_tcpServer;
 }
 
@@ -87,8 +204,152 @@ bool DcpHub::listen(const QHostAddress &address, quint16 port)
     return true;
 }
 
+/*
+    Takes over the listening socket and all connections of the hub process
+    that listens for handoff requests on the Unix socket path. The device
+    registry and any data that was read but not yet routed by the previous
+    process are transferred as well, so that the devices do not notice the
+    change. Used instead of listen().
+ */
+bool DcpHub::takeOver(const QString &path)
+{
+    HandoffChannel channel;
+    QByteArray record;
+    int fd;
+    if (!channel.connectTo(path) || !channel.send(HandoffRequest) ||
+            !channel.receive(&record, &fd)) {
+        cerr << ts() << "Error: Cannot take over connections. "
+             << channel.errorString() << "." << endl;
+        return false;
+    }
+
+    if (record.startsWith(HandoffAbort)) {
+        cerr << ts() << "Error: Cannot take over connections. "
+             << record.mid(qstrlen(HandoffAbort)) << "." << endl;
+        return false;
+    }
+
+    QByteArray magic, serverName;
+    quint32 version, nextConnectionId, count;
+    QList<QByteArray> captureArgs;
+    QDataStream header(record);
+    header.setVersion(QDataStream::Qt_4_7);
+    header >> magic >> version;
+    if (magic == HandoffMagic && version == HandoffVersion)
+        header >> serverName >> nextConnectionId >> count >> m_subscriptions
+               >> m_groups >> m_deviceLimits >> m_pairLimits >> captureArgs;
+    CaptureFilter captureFilter;
+    bool captureOff = captureArgs.size() == 1 && captureArgs[0] == "off";
+    if (magic != HandoffMagic || version != HandoffVersion || fd == -1 ||
+            header.status() != QDataStream::Ok ||
+            (!captureOff && !parseCaptureFilter(captureArgs, &captureFilter))) {
+        cerr << ts() << "Error: Cannot take over connections. "
+             << "Invalid handoff data." << endl;
+        return false;
+    }
+    if (!m_tcpServer->setSocketDescriptor(fd)) {
+        cerr << ts() << "Error: Cannot take over listening socket. "
+             << m_tcpServer->errorString() << "." << endl;
+        return false;
+    }
+    m_serverDeviceName = serverName;
+    m_nextConnectionId = nextConnectionId;
+    m_captureFilter = captureFilter;
+    m_limitsVersion++;
+
+    QHash<QTcpSocket *, QByteArray> inputs;
+    QHash<QTcpSocket *, QByteArray> outputs;
+    for (quint32 i = 0; i < count; ++i)
+    {
+        if (!channel.receive(&record, &fd)) {
+            cerr << ts() << "Error: Cannot take over connections. "
+                 << channel.errorString() << "." << endl;
+            return false;
+        }
+
+        ClientInfo ci;
+        QString address;
+        quint32 aliasCount;
+        QByteArray input, output;
+        QDataStream in(record);
+        in.setVersion(QDataStream::Qt_4_7);
+        in >> ci.connectionId >> ci.device >> aliasCount;
+        for (quint32 j = 0; j < aliasCount && in.status() == QDataStream::Ok;
+             ++j) {
+            QByteArray alias;
+            in >> alias;
+            ci.aliases.append(alias);
+        }
+        in >> address >> ci.port >> input >> output;
+        ci.address.setAddress(address);
+
+        PeerAddress peerAddress;
+        quint32 remoteCount;
+        in >> ci.isPeer >> ci.peerHelloSent >> ci.peerName
+           >> peerAddress.first >> peerAddress.second >> remoteCount;
+        QList<QByteArray> remoteDevices;
+        for (quint32 j = 0; j < remoteCount && in.status() == QDataStream::Ok;
+             ++j) {
+            QByteArray key;
+            in >> key;
+            remoteDevices.append(key);
+        }
+
+        QTcpSocket *socket = new QTcpSocket(m_tcpServer);
+        if (fd == -1 || in.status() != QDataStream::Ok ||
+                !socket->setSocketDescriptor(fd)) {
+            cerr << ts() << "Error: Cannot take over connection ["
+                 << address << ":" << ci.port << "]." << endl;
+#ifdef Q_OS_UNIX
+            if (fd != -1)
+                ::close(fd);
+#endif
+            delete socket;
+            continue;
+        }
+        initSocket(socket);
+        m_socketMap.insert(socket, ci);
+        if (!ci.device.isEmpty())
+            m_deviceMap[ci.device] = socket;
+        foreach (const QByteArray &alias, ci.aliases)
+            m_deviceMap[alias] = socket;
+        foreach (const QByteArray &key, remoteDevices)
+            addRemoteDevice(socket, key);
+        if (!peerAddress.first.isEmpty())
+            m_peerLinks.insert(peerAddress, socket);
+        inputs.insert(socket, input);
+        outputs.insert(socket, output);
+    }
+    if (!m_peerLinks.isEmpty())
+        m_peerTimer->start();
+
+    // the previous process exits after this record
+    if (!channel.send(HandoffDone)) {
+        cerr << ts() << "Error: Cannot take over connections. "
+             << channel.errorString() << "." << endl;
+        return false;
+    }
+
+    // output that was not written by the previous process goes first
+    QHash<QTcpSocket *, QByteArray>::const_iterator it = outputs.constBegin();
+    for (; it != outputs.constEnd(); ++it)
+        if (!it.value().isEmpty())
+            queueWrite(it.key(), it.value());
+    flushWrites();
+
+    for (it = inputs.constBegin(); it != inputs.constEnd(); ++it)
+        restoreInput(it.key(), it.value());
+
+    cout << ts() << "Took over " << m_socketMap.size() << " connections ["
+         << m_tcpServer->serverAddress().toString() << ":"
+         << m_tcpServer->serverPort() << "]." << endl;
+    return true;
+}
+
 void DcpHub::close()
 {
+    m_peerTimer->stop();
+    flushWrites();
     QList<QTcpSocket *> socketList = m_socketMap.keys();
     foreach (QTcpSocket *socket, socketList)
         socket->disconnectFromHost();
@@ -99,386 +360,2132 @@ void DcpHub::close()
     m_tcpServer->close();
 }
 
-bool DcpHub::setDeviceName(const QByteArray &name)
+/*
+    Listens for handoff requests of a new hub process on the Unix socket
+    path, see takeOver().
+ */
+bool DcpHub::startHandoffServer(const QString &path)
 {
-    if (m_tcpServer->isListening() || name.isEmpty())
+    delete m_handoffNotifier;
+    m_handoffNotifier = 0;
+    if (!m_handoffServer.listen(path)) {
+        cerr << ts() << "Error: Cannot start handoff server. "
+             << m_handoffServer.errorString() << "." << endl;
         return false;
-    m_serverDeviceName = name;
-    m_serverDeviceName.truncate(MessageDeviceNameSize);
+    }
+    m_handoffPath = path;
+    m_handoffNotifier = new QSocketNotifier(m_handoffServer.descriptor(),
+                                            QSocketNotifier::Read, this);
+    connect(m_handoffNotifier, SIGNAL(activated(int)),
+            SLOT(handoffRequested()));
     return true;
 }
 
-void DcpHub::newConnection()
+void DcpHub::handoffRequested()
 {
-    QTcpSocket *socket = m_tcpServer->nextPendingConnection();
-    connect(socket, SIGNAL(disconnected()), SLOT(socketDisconnected()));
-    connect(socket, SIGNAL(readyRead()), SLOT(socketReadyRead()));
-    Q_ASSERT(!m_socketMap.contains(socket));
+    HandoffChannel channel;
+    if (!m_handoffServer.accept(&channel)) {
+        cerr << ts() << "Error: " << m_handoffServer.errorString() << "."
+             << endl;
+        return;
+    }
 
-    ClientInfo clientInfo = {
-        QByteArray(),
-        socket->peerAddress(),
-        socket->peerPort()
-    };
-    m_socketMap.insert(socket, clientInfo);
+    // release the path, so that the new process can listen on it
+    delete m_handoffNotifier;
+    m_handoffNotifier = 0;
+    m_handoffServer.close();
 
-    cout << ts() << "New connection [" << clientInfo.address.toString()
-         << ":" << clientInfo.port << "]." << endl;
+    cout << ts() << "Handing over connections..." << endl;
+    QString errorString;
+    if (handOver(&channel, &errorString)) {
+        emit handedOver();
+        return;
+    }
+
+    cerr << ts() << "Error: Handoff failed. " << errorString << "." << endl;
+    startHandoffServer(m_handoffPath);
 }
 
-void DcpHub::socketDisconnected()
+/*
+    Sends the listening socket, all connections and their state to the new
+    hub process. Returns true if the new process has taken over; the hub
+    then no longer owns any connections.
+ */
+bool DcpHub::handOver(HandoffChannel *channel, QString *errorString)
 {
-    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
-    if (!socket) {
-        qWarning("DcpHub::socketDisconnected(): Invalid sender.");
-        return;
+    Q_ASSERT(errorString);
+    QByteArray record;
+    if (!channel->receive(&record) || record != HandoffRequest) {
+        *errorString = channel->errorString();
+        return false;
     }
-    if (!m_socketMap.contains(socket)) {
-        qWarning("DcpHub::socketDisconnected(): Unknown socket.");
-        return;
+
+    // Output in the write queues is passed on to the new process, but the
+    // output already buffered by a QTcpSocket cannot be taken out of it.
+    // These buffers are flushed without blocking; if a connection cannot
+    // take all its data right now, the handoff is refused, so that no
+    // output is lost.
+    QList<QTcpSocket *> socketList;
+    foreach (QTcpSocket *socket, m_socketMap.keys()) {
+        if (socket->state() != QAbstractSocket::ConnectedState)
+            continue;
+        if (socket->bytesToWrite() > 0)
+            socket->flush();
+        if (socket->bytesToWrite() > 0) {
+            const ClientInfo &ci = m_socketMap.value(socket);
+            *errorString = QString("Connection [%1:%2] has unsent output, "
+                                   "try again later")
+                    .arg(ci.address.toString()).arg(ci.port);
+            channel->send(HandoffAbort + errorString->toLatin1());
+            return false;
+        }
+        socketList.append(socket);
     }
 
-    const ClientInfo clientInfo = m_socketMap.value(socket);
-    cout << "Disconnected device \""
-         << QString::fromLatin1(clientInfo.device) << "\" ["
-         << clientInfo.address.toString() << ":" << clientInfo.port << "]."
-         << endl;
+    // both processes must not write into the same segment files
+    bool recording = m_recorder.isOpen();
+    m_recorder.close();
 
-    if (!clientInfo.device.isEmpty()) {
-        Q_ASSERT(m_deviceMap.value(clientInfo.device) == socket);
-        m_deviceMap.remove(clientInfo.device);
+    QByteArray headerData;
+    QDataStream header(&headerData, QIODevice::WriteOnly);
+    header.setVersion(QDataStream::Qt_4_7);
+    header << QByteArray(HandoffMagic) << quint32(HandoffVersion)
+           << m_serverDeviceName << m_nextConnectionId
+           << quint32(socketList.size()) << m_subscriptions << m_groups
+           << m_deviceLimits << m_pairLimits << captureFilterArgs();
+    if (!channel->send(headerData, int(m_tcpServer->socketDescriptor()))) {
+        *errorString = channel->errorString();
+        if (recording)
+            startRecording(m_recordDir, m_recordSegmentCount,
+                           m_recordSegmentSize);
+        return false;
     }
-    m_socketMap.remove(socket);
-    socket->deleteLater();
-}
 
-void DcpHub::socketReadyRead()
-{
-    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
-    if (!socket) {
-        qWarning("DcpHub::socketReadyRead(): Invalid sender.");
-        return;
-    }
-    if (!m_socketMap.contains(socket)) {
-        qWarning("DcpHub::socketReadyRead(): Unknown socket.");
-        return;
+    // input that was read but not routed yet is passed on in stream order:
+    // delayed packets, a partial packet and the socket's read buffer
+    QHash<QTcpSocket *, QByteArray> inputs;
+    bool ok = true;
+    foreach (QTcpSocket *socket, socketList)
+    {
+        ClientInfo &ci = m_socketMap.find(socket).value();
+        QByteArray input;
+        foreach (const DcpPacket &packet, ci.delayedPackets)
+            input += packet.data();
+        input += ci.handoffBuffer;
+        input += socket->readAll();
+        ci.delayedPackets.clear();
+        ci.handoffBuffer.clear();
+        inputs.insert(socket, input);
+
+        // the write queue is only cleared if the handoff succeeds
+        QByteArray output;
+        foreach (const QByteArray &buf, ci.writeQueue)
+            output += buf;
+
+        QByteArray data;
+        QDataStream out(&data, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_4_7);
+        out << ci.connectionId << ci.device << quint32(ci.aliases.size());
+        foreach (const QByteArray &alias, ci.aliases)
+            out << alias;
+        out << ci.address.toString() << ci.port << input << output;
+        PeerAddress peerAddress = m_peerLinks.key(socket);
+        out << ci.isPeer << ci.peerHelloSent << ci.peerName
+            << peerAddress.first << peerAddress.second
+            << quint32(ci.remoteDevices.size());
+        foreach (const QByteArray &key, ci.remoteDevices)
+            out << key;
+        if (!channel->send(data, int(socket->socketDescriptor()))) {
+            ok = false;
+            break;
+        }
     }
 
-    DcpPacket packet;
-    while (readNextPacket(socket, &packet))
+    if (ok && channel->receive(&record) && record == HandoffDone)
     {
-        if (m_debugFlags & MessageDebug)
-            cout << packet.message() << endl;
+        // close the descriptors without shutting down the connections
+        foreach (QTcpSocket *socket, m_socketMap.keys()) {
+            socket->disconnect(this);
+            socket->deleteLater();
+        }
+        m_socketMap.clear();
+        m_deviceMap.clear();
+        m_remoteDevices.clear();
+        m_patternCache.clear();
+        m_peerLinks.clear();
+        m_subscriptions.clear();
+        m_groups.clear();
+        m_peerTimer->stop();
+        m_readyQueue.clear();
+        m_flushSockets.clear();
+        m_delayedSockets.clear();
+        m_tcpServer->close();
+        cout << ts() << "Handed over " << socketList.size()
+             << " connections." << endl;
+        return true;
+    }
 
-        if (m_debugFlags & PacketDebug)
-            cout << hexfmt(packet.data()) << endl;
+    // keep serving the connections
+    *errorString = channel->errorString();
+    QHash<QTcpSocket *, QByteArray>::const_iterator it = inputs.constBegin();
+    for (; it != inputs.constEnd(); ++it) {
+        m_delayedSockets.removeAll(it.key());
+        restoreInput(it.key(), it.value());
+    }
+    if (recording)
+        startRecording(m_recordDir, m_recordSegmentCount, m_recordSegmentSize);
+    return false;
+}
 
-        // register device if neccessary, disconnect on error
-        if (m_socketMap.value(socket).device.isEmpty()) {
-            if (!registerDeviceName(socket, packet.source())) {
-                socket->disconnectFromHost();
-                return;
-            }
+/*
+    Queues input that was read from the socket but not routed by a previous
+    hub process. Complete packets are queued as delayed packets, so that
+    they pass the rate limits before the socket is read again; a trailing
+    partial packet is completed by readHandoffPacket().
+ */
+void DcpHub::restoreInput(QTcpSocket *socket, const QByteArray &input)
+{
+    SocketMap::iterator it = m_socketMap.find(socket);
+    if (it == m_socketMap.end())
+        return;
+    ClientInfo &ci = it.value();
+
+    int pos = 0;
+    while (input.size() - pos >= int(FullHeaderSize))
+    {
+        quint32 pkgSize = FullHeaderSize + qFromBigEndian(
+            *reinterpret_cast<const quint32 *>(input.constData() + pos +
+                PacketHeaderSize + MessageDataLenPos));
+        if (pkgSize > MaxPacketSize) {
+            socket->disconnectFromHost();
+            return;
         }
+        if (input.size() - pos < int(pkgSize))
+            break;
+        ci.delayedPackets.enqueue(DcpPacket(input.mid(pos, pkgSize)));
+        pos += pkgSize;
+    }
+    ci.handoffBuffer = input.mid(pos);
 
-        processPacket(packet);
+    if (!ci.delayedPackets.isEmpty()) {
+        m_delayedSockets.append(socket);
+        startRateTimer(0);
     }
+    else
+        scheduleSocket(socket);
 }
 
-bool DcpHub::readNextPacket(QTcpSocket *socket, DcpPacket *packet)
+/*
+    Reads the rest of the partial packet in the socket's handoff buffer.
+    Only the missing bytes are read, so that the following packets are read
+    by processReadySockets() as usual. Returns true if the packet is
+    complete.
+ */
+bool DcpHub::readHandoffPacket(QTcpSocket *socket, DcpPacket *packet)
 {
-    Q_ASSERT(socket);
-    Q_ASSERT(packet);
-    packet->clear();
-
-    if (socket->bytesAvailable() < FullHeaderSize)
+    ClientInfo &ci = m_socketMap.find(socket).value();
+    QByteArray &buf = ci.handoffBuffer;
+    if (buf.size() < int(FullHeaderSize))
+        buf += socket->read(FullHeaderSize - buf.size());
+    if (buf.size() < int(FullHeaderSize))
         return false;
 
-    char header[FullHeaderSize];
-    socket->peek(header, FullHeaderSize);
-    quint32 msgDataSize = qFromBigEndian(*reinterpret_cast<const quint32 *>(
-        header + PacketHeaderSize + MessageDataLenPos));
-    quint32 pkgSize = FullHeaderSize + msgDataSize;
-
-    // invalid packet size -> disconnect
+    quint32 pkgSize = FullHeaderSize + qFromBigEndian(
+        *reinterpret_cast<const quint32 *>(buf.constData() +
+            PacketHeaderSize + MessageDataLenPos));
     if (pkgSize > MaxPacketSize) {
+        buf.clear();
         socket->disconnectFromHost();
         return false;
     }
-
-    // check if the full packet is available
-    if (socket->bytesAvailable() < pkgSize)
+    if (buf.size() < int(pkgSize))
+        buf += socket->read(pkgSize - buf.size());
+    if (buf.size() < int(pkgSize))
         return false;
 
-    packet->setData(socket->read(pkgSize));
+    packet->setData(buf);
+    buf.clear();
     return true;
 }
 
-bool DcpHub::registerDeviceName(QTcpSocket *socket, const QByteArray &name)
+/*
+    Defines a group of devices. Packets sent to the group name are passed on
+    to all members, sharing a single buffer; each connection receives the
+    packet only once, even if it serves several members. An empty member
+    list removes the group. Groups are local to the hub: a group spanning
+    peer hubs must be defined on each of them, since packets forwarded by a
+    peer are only delivered to local members. Returns false if the name is
+    invalid or used by a registered device.
+ */
+bool DcpHub::setGroup(const QByteArray &name, const QList<QByteArray> &members)
 {
-    Q_ASSERT(socket);
-
-    SocketMap::iterator iter = m_socketMap.find(socket);
-    if (iter == m_socketMap.end())
+    QByteArray key = deviceKey(name);
+    if (name.isEmpty() || isNullDeviceName(key) || isServerDeviceName(key) ||
+            m_deviceMap.contains(key))
         return false;
 
-    ClientInfo &ci = iter.value();
-    Q_ASSERT(ci.device.isEmpty());
+    if (members.isEmpty()) {
+        m_groups.remove(key);
+        return true;
+    }
 
-    if (isNullDeviceName(name) || isServerDeviceName(name)) {
-        cerr << "Device trying to register invalid name ["
-             << ci.address.toString() << ":" << ci.port << "]." << endl;
-        return false;
+    QList<QByteArray> &memberKeys = m_groups[key];
+    memberKeys.clear();
+    foreach (const QByteArray &member, members) {
+        QByteArray memberKey = deviceKey(member);
+        if (!memberKeys.contains(memberKey))
+            memberKeys.append(memberKey);
     }
+    return true;
+}
 
-    if (m_deviceMap.contains(name)) {
-        cerr << "Device name \"" << QString::fromLatin1(name)
-             << "\" already exists [" << ci.address.toString() << ":"
-             << ci.port << "]." << endl;
+bool DcpHub::setDeviceName(const QByteArray &name)
+{
+    if (m_tcpServer->isListening() || name.isEmpty())
         return false;
-    }
+    m_serverDeviceName = name;
+    m_serverDeviceName.truncate(MessageDeviceNameSize);
+    return true;
+}
 
-    ci.device = name;
-    m_deviceMap[name] = socket;
+/*
+    Sets the number of bytes a socket may read per scheduling round. Sockets
+    with larger packets accumulate their quantum over several rounds.
+ */
+void DcpHub::setSchedulerQuantum(int bytes)
+{
+    m_schedQuantum = qMax(bytes, 1);
+}
 
-    cout << "Registered device \"" << QString::fromLatin1(name) << "\" ["
-         << ci.address.toString() << ":" << ci.port << "]." << endl;
+/*
+    Sets the maximum number of packets that are processed before control is
+    returned to the event loop.
+ */
+void DcpHub::setSchedulerBudget(int packets)
+{
+    m_schedBudget = qMax(packets, 1);
+}
+
+/*
+    Starts recording all routed packets into a ring of segmentCount files of
+    segmentSize bytes in the directory dirName. The parameters are kept, so
+    that recording can be resumed if a handoff fails.
+ */
+bool DcpHub::startRecording(const QString &dirName, int segmentCount,
+                            qint64 segmentSize)
+{
+    m_recordDir = dirName;
+    m_recordSegmentCount = segmentCount;
+    m_recordSegmentSize = segmentSize;
+    if (!m_recorder.open(dirName, segmentCount, segmentSize)) {
+        cerr << ts() << "Error: Cannot start recording. "
+             << m_recorder.errorString() << "." << endl;
+        return false;
+    }
+    cout << ts() << "Recording to \"" << dirName << "\"." << endl;
     return true;
 }
 
-void DcpHub::processPacket(const DcpPacket &packet)
+void DcpHub::stopRecording()
 {
-    QByteArray device = packet.destination();
+    m_recorder.close();
+}
 
-    // send packet to its destination device
-    QTcpSocket *socket = m_deviceMap.value(device, 0);
-    if (socket) {
-        socket->write(packet.data());
+/*
+    Adds a link to the hub listening on host and port. Linked hubs exchange
+    the names of their registered devices and forward packets for devices of
+    the other hub over the link, so that devices connected to different hubs
+    can address each other by name. Only one of the two hubs needs to add the
+    link; it is reconnected if the connection fails.
+ */
+void DcpHub::addPeer(const QString &host, quint16 port)
+{
+    PeerAddress peerAddress(host, port);
+    if (m_peerLinks.contains(peerAddress))
         return;
-    }
+    m_peerLinks.insert(peerAddress, 0);
+    m_peerTimer->start();
+    connectPeers();
+}
 
-    // ignore packets with unknown device names
-    if (!isServerDeviceName(device))
-        return;
+/*
+    Allows peer hubs at the address to link to this hub. Links of peer hubs
+    are only accepted from these addresses; outgoing links established by
+    addPeer() are always accepted.
 
-    // handle packets addressed to the server itself
-    Dcp::Message msg = packet.message();
-    if (!msg.isNull() && !msg.isReply())
-        handleCommand(msg);
+    Packets of peer links pass the rate limits as well. The default device
+    limit "*" does not apply to them; only a device limit set for the name
+    of the peer hub limits the whole link, and its disconnect action drops
+    packets instead of tearing down the link. Pair limits are looked up by
+    the remote source device of each packet.
+ */
+void DcpHub::allowPeer(const QHostAddress &address)
+{
+    if (!m_allowedPeers.contains(address))
+        m_allowedPeers.append(address);
 }
 
-void DcpHub::sendMessage(QTcpSocket *socket, const Dcp::Message &msg)
+bool DcpHub::isAllowedPeer(const QHostAddress &address) const
 {
-    Q_ASSERT(socket);
-    if (msg.isNull()) {
-        qWarning("DcpHub::sendMessage(): Ignoring invalid message.");
-        return;
-    }
-    if (!msg.data().size() + FullHeaderSize > MaxPacketSize) {
-        qWarning("DcpHub::sendMessage(): Skipping large message. " \
-                 "Multi-packet messages are currently not supported.");
-        return;
-    }
-
-    char pkgHeader[PacketHeaderSize];
-    quint32 *pMsgSize = reinterpret_cast<quint32 *>(
-                pkgHeader + PacketMsgSizePos);
-    quint32 *pOffset = reinterpret_cast<quint32 *>(
-                pkgHeader + PacketOffsetPos);
+    if (m_allowedPeers.contains(address))
+        return true;
 
-    *pMsgSize = qToBigEndian(static_cast<quint32>(msg.data().size()));
-    *pOffset = 0;
+    // IPv4 clients of a dual-stack server have IPv4-mapped IPv6 addresses
+    QString str = address.toString();
+    return str.startsWith("::ffff:") &&
+           m_allowedPeers.contains(QHostAddress(str.mid(7)));
+}
 
-    if (m_debugFlags & MessageDebug)
-        cout << msg << endl;
+void DcpHub::connectPeers()
+{
+    QMap<PeerAddress, QTcpSocket *>::iterator it = m_peerLinks.begin();
+    for (; it != m_peerLinks.end(); ++it)
+    {
+        // failed connection attempts are retried on the next timeout
+        QTcpSocket *socket = it.value();
+        if (socket) {
+            if (socket->state() != QAbstractSocket::UnconnectedState ||
+                    m_socketMap.contains(socket))
+                continue;
+            socket->deleteLater();
+        }
 
-    if (m_debugFlags & PacketDebug) {
-        QBuffer buf;
-        buf.open(QIODevice::WriteOnly);
-        buf.write(pkgHeader, PacketHeaderSize);
-        buf.write(msg.toByteArray());
-        cout << hexfmt(buf.data()) << endl;
-        socket->write(buf.data());
-    } else {
-        socket->write(pkgHeader, PacketHeaderSize);
-        socket->write(msg.toByteArray());
+        socket = new QTcpSocket(this);
+        connect(socket, SIGNAL(connected()), SLOT(peerConnected()));
+        socket->connectToHost(it.key().first, it.key().second);
+        it.value() = socket;
     }
 }
 
-void DcpHub::handleCommand(const Dcp::Message &msg)
+void DcpHub::peerConnected()
 {
-    Q_ASSERT(!msg.isNull() && !msg.isReply());
-    Q_ASSERT(isServerDeviceName(msg.destination()));
-    QTcpSocket *socket = m_deviceMap.value(deviceKey(msg.source()), 0);
-    if (!socket) {
-        qWarning("DcpHub::handleCommand(): Unknown socket.");
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+    if (!socket || m_socketMap.contains(socket)) {
+        qWarning("DcpHub::peerConnected(): Invalid sender.");
         return;
     }
+    initSocket(socket);
 
-    Dcp::CommandParser cmd;
-    if (!cmd.parse(msg))
-        return;
+    ClientInfo clientInfo;
+    clientInfo.address = socket->peerAddress();
+    clientInfo.port = socket->peerPort();
+    clientInfo.connectionId = m_nextConnectionId++;
+    if (m_nextConnectionId == 0)
+        m_nextConnectionId = 1;
+    clientInfo.isPeer = true;
+    m_socketMap.insert(socket, clientInfo);
 
-    QByteArray identifier = cmd.identifier();
-    QList<QByteArray> args = cmd.arguments();
-    Dcp::CommandParser::CmdType cmdType = cmd.cmdType();
-    if (cmdType == Dcp::CommandParser::GetCmd)
-    {
-        // get devlist
-        //     returns: dev1 dev2 ...
-        if (identifier == "devlist")
-        {
-            if (cmd.hasArguments()) {
-                sendMessage(socket, msg.ackMessage(Dcp::AckParameterError));
-                return;
-            }
-            sendMessage(socket, msg.ackMessage());
-            sendMessage(socket, msg.replyMessage(joined(deviceList(true))));
-            return;
-        }
+    cout << ts() << "Connected to peer hub [" << clientInfo.address.toString()
+         << ":" << clientInfo.port << "]." << endl;
 
-        // get devinfo [dev1 [dev2 [...]]]
-        //     returns: [dev1 addr1 port1 [dev2 addr2 port2 [...]]] | FIN
-        //     errorcodes: -1 -> at least one device is unknown
-        //     notes: if no device is specified all devices are returned
-        if (identifier == "devinfo")
-        {
-            sendMessage(socket, msg.ackMessage());
-            if (args.isEmpty())
-                args = deviceList(true);
-            int errorCode = 0;
-            QList<QByteArray> result;
-            foreach (QByteArray device, args)
-            {
-                QByteArray key = deviceKey(device, true);
-                QTcpSocket *devSocket = m_deviceMap.value(key, 0);
-                if (devSocket) {
-                    Q_ASSERT(m_socketMap.contains(devSocket));
-                    ClientInfo info = m_socketMap.value(devSocket);
-                    result.append(device);
-                    result.append(info.address.toString().toLatin1());
-                    result.append(QByteArray::number(info.port));
-                }
-                else
-                    errorCode = -1;
-            }
-            sendMessage(socket, msg.replyMessage(joined(result), errorCode));
-            return;
-        }
+    sendPeerHello(socket);
+    flushWrites();
+}
 
-        // get debug
-        //     returns: ( none | msg | pkg | full )
-        if (identifier == "debug")
-        {
-            if (cmd.hasArguments()) {
-                sendMessage(socket, msg.ackMessage(Dcp::AckParameterError));
-                return;
-            }
-            sendMessage(socket, msg.ackMessage());
+void DcpHub::newConnection()
+{
+    QTcpSocket *socket = m_tcpServer->nextPendingConnection();
+    Q_ASSERT(!m_socketMap.contains(socket));
+    initSocket(socket);
 
-            QByteArray mode;
-            switch (m_debugFlags) {
-            case NoDebug:
-                mode = "none";
-                break;
-            case MessageDebug:
-                mode = "msg";
-                break;
-            case PacketDebug:
-                mode = "pkg";
-                break;
-            case FullDebug:
-                mode = "full";
-                break;
+    ClientInfo clientInfo;
+    clientInfo.address = socket->peerAddress();
+    clientInfo.port = socket->peerPort();
+    clientInfo.connectionId = m_nextConnectionId++;
+    if (m_nextConnectionId == 0)
+        m_nextConnectionId = 1;
+    m_socketMap.insert(socket, clientInfo);
+
+    cout << ts() << "New connection [" << clientInfo.address.toString()
+         << ":" << clientInfo.port << "]." << endl;
+}
+
+void DcpHub::initSocket(QTcpSocket *socket)
+{
+    connect(socket, SIGNAL(disconnected()), SLOT(socketDisconnected()));
+    connect(socket, SIGNAL(readyRead()), SLOT(socketReadyRead()));
+
+    // limit the input buffer, so that devices which are sending faster than
+    // they are scheduled are throttled by TCP flow control
+    socket->setReadBufferSize(4 * MaxPacketSize);
+}
+
+void DcpHub::socketDisconnected()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+    if (!socket) {
+        qWarning("DcpHub::socketDisconnected(): Invalid sender.");
+        return;
+    }
+    if (!m_socketMap.contains(socket)) {
+        qWarning("DcpHub::socketDisconnected(): Unknown socket.");
+        return;
+    }
+
+    const ClientInfo clientInfo = m_socketMap.value(socket);
+    QList<QByteArray> remoteNames;
+    if (clientInfo.isPeer) {
+        cout << "Disconnected peer hub \""
+             << QString::fromLatin1(clientInfo.peerName) << "\" ["
+             << clientInfo.address.toString() << ":" << clientInfo.port
+             << "]." << endl;
+        foreach (const QByteArray &key, clientInfo.remoteDevices)
+            if (removeRemoteDevice(socket, key))
+                remoteNames.append(key);
+    }
+    else {
+        cout << "Disconnected device \""
+             << QString::fromLatin1(clientInfo.device) << "\" ["
+             << clientInfo.address.toString() << ":" << clientInfo.port
+             << "]." << endl;
+    }
+
+    QList<QByteArray> names;
+    if (!clientInfo.device.isEmpty()) {
+        Q_ASSERT(m_deviceMap.value(clientInfo.device) == socket);
+        m_deviceMap.remove(clientInfo.device);
+        names.append(clientInfo.device);
+    }
+    foreach (const QByteArray &alias, clientInfo.aliases) {
+        Q_ASSERT(m_deviceMap.value(alias) == socket);
+        m_deviceMap.remove(alias);
+        names.append(alias);
+    }
+    if (clientInfo.scheduled)
+        m_readyQueue.removeAll(socket);
+    if (clientInfo.flushPending)
+        m_flushSockets.removeAll(socket);
+    if (!clientInfo.delayedPackets.isEmpty())
+        m_delayedSockets.removeAll(socket);
+    m_socketMap.remove(socket);
+
+    // outgoing peer links are reconnected by connectPeers()
+    QMap<PeerAddress, QTcpSocket *>::iterator it = m_peerLinks.begin();
+    for (; it != m_peerLinks.end(); ++it)
+        if (it.value() == socket)
+            it.value() = 0;
+    socket->deleteLater();
+
+    foreach (const QByteArray &name, names)
+        removeSubscriber(name);
+    if (!names.isEmpty())
+        devicesChanged('-', names, true);
+    if (!remoteNames.isEmpty())
+        devicesChanged('-', remoteNames, false);
+    flushWrites();
+}
+
+void DcpHub::socketReadyRead()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+    if (!socket) {
+        qWarning("DcpHub::socketReadyRead(): Invalid sender.");
+        return;
+    }
+    SocketMap::iterator it = m_socketMap.find(socket);
+    if (it == m_socketMap.end()) {
+        qWarning("DcpHub::socketReadyRead(): Unknown socket.");
+        return;
+    }
+
+    // sockets with delayed packets are rescheduled by processDelayedPackets()
+    if (it.value().delayedPackets.isEmpty())
+        scheduleSocket(socket);
+}
+
+/*
+    Adds the socket to the queue of sockets which are read by
+    processReadySockets().
+ */
+void DcpHub::scheduleSocket(QTcpSocket *socket)
+{
+    SocketMap::iterator it = m_socketMap.find(socket);
+    if (it == m_socketMap.end())
+        return;
+
+    // finish a packet that was partially read by a previous hub process
+    if (!it.value().handoffBuffer.isEmpty()) {
+        DcpPacket packet;
+        if (readHandoffPacket(socket, &packet)) {
+            it.value().delayedPackets.enqueue(packet);
+            m_delayedSockets.append(socket);
+            startRateTimer(0);
+        }
+        return;
+    }
+
+    // the packets are read by processReadySockets(), which schedules all
+    // readable sockets in a deficit round robin manner
+    if (!it.value().scheduled) {
+        it.value().scheduled = true;
+        m_readyQueue.enqueue(socket);
+    }
+    if (!m_schedTimer->isActive())
+        m_schedTimer->start();
+}
+
+/*
+    Reads and processes packets from all sockets in m_readyQueue. Each socket
+    gets a quantum of bytes per round (deficit round robin), and at most
+    m_schedBudget packets are processed before returning to the event loop.
+    Sockets that still have pending packets stay scheduled.
+ */
+void DcpHub::processReadySockets()
+{
+    int budget = m_schedBudget;
+    while (budget > 0 && !m_readyQueue.isEmpty())
+    {
+        QTcpSocket *socket = m_readyQueue.dequeue();
+        SocketMap::iterator it = m_socketMap.find(socket);
+        if (it == m_socketMap.end())
+            continue;
+
+        int deficit = it.value().deficit + m_schedQuantum;
+        bool drained = false;
+        bool quantumUsed = false;
+        DcpPacket packet;
+        while (budget > 0)
+        {
+            quint32 pkgSize = nextPacketSize(socket);
+            if (pkgSize == 0 || (pkgSize <= MaxPacketSize &&
+                                 socket->bytesAvailable() < pkgSize)) {
+                drained = true;
+                break;
+            }
+
+            // packet does not fit into this round's quantum
+            if (pkgSize <= MaxPacketSize && int(pkgSize) > deficit) {
+                quantumUsed = true;
+                break;
+            }
+
+            if (!readNextPacket(socket, &packet)) {
+                drained = true;
+                break;
+            }
+
+            deficit -= pkgSize;
+            budget--;
+            if (!handlePacket(socket, packet)) {
+                drained = true;
+                break;
+            }
+        }
+
+        // the socket may have been removed while handling the packets
+        it = m_socketMap.find(socket);
+        if (it == m_socketMap.end())
+            continue;
+
+        if (drained) {
+            it.value().deficit = 0;
+            it.value().scheduled = false;
+        } else {
+            // Only a turn that ended on the quantum keeps its deficit for
+            // the next packet. If the budget ended the turn, the remaining
+            // deficit is capped, so that it cannot build up burst credit.
+            it.value().deficit = quantumUsed ?
+                        deficit : qMin(deficit, m_schedQuantum);
+            m_readyQueue.enqueue(socket);
+        }
+    }
+
+    flushWrites();
+
+    if (!m_readyQueue.isEmpty())
+        m_schedTimer->start();
+}
+
+/*
+    Returns the size of the next packet, or 0 if the packet header has not
+    been received yet.
+ */
+quint32 DcpHub::nextPacketSize(QTcpSocket *socket) const
+{
+    if (socket->bytesAvailable() < FullHeaderSize)
+        return 0;
+
+    char header[FullHeaderSize];
+    socket->peek(header, FullHeaderSize);
+    quint32 msgDataSize = qFromBigEndian(*reinterpret_cast<const quint32 *>(
+        header + PacketHeaderSize + MessageDataLenPos));
+    return FullHeaderSize + msgDataSize;
+}
+
+/*
+    Handles a single packet that was received from socket. Returns false
+    if no more packets should be read from the socket.
+ */
+bool DcpHub::handlePacket(QTcpSocket *socket, const DcpPacket &packet)
+{
+    if (m_debugFlags != NoDebug)
+        logPacket(packet.data());
+
+    SocketMap::iterator it = m_socketMap.find(socket);
+    if (it == m_socketMap.end())
+        return false;
+
+    // control messages of peer hubs are sent to the null device
+    if (it.value().isPeer) {
+        if (isNullDeviceName(packet.destination()))
+            return handlePeerControl(socket, packet);
+    }
+    // register device if neccessary, disconnect on error
+    else if (it.value().device.isEmpty()) {
+        if (isNullDeviceName(packet.destination()) &&
+                packet.data().mid(FullHeaderSize) == PeerHello) {
+            // only hubs at allowed addresses may link to this hub
+            if (!isAllowedPeer(it.value().address)) {
+                cerr << ts() << "Rejected peer hub link ["
+                     << it.value().address.toString() << ":"
+                     << it.value().port << "]." << endl;
+                socket->disconnectFromHost();
+                return false;
+            }
+            it.value().isPeer = true;
+            return handlePeerControl(socket, packet);
+        }
+        if (!registerDeviceName(socket, packet.source())) {
+            socket->disconnectFromHost();
+            return false;
+        }
+    }
+    else if (isNullDeviceName(packet.destination()) &&
+             handleNameRequest(socket, packet))
+        return true;
+
+    return processPacket(socket, packet);
+}
+
+bool DcpHub::readNextPacket(QTcpSocket *socket, DcpPacket *packet)
+{
+    Q_ASSERT(socket);
+    Q_ASSERT(packet);
+    packet->clear();
+
+    if (socket->bytesAvailable() < FullHeaderSize)
+        return false;
+
+    char header[FullHeaderSize];
+    socket->peek(header, FullHeaderSize);
+    quint32 msgDataSize = qFromBigEndian(*reinterpret_cast<const quint32 *>(
+        header + PacketHeaderSize + MessageDataLenPos));
+    quint32 pkgSize = FullHeaderSize + msgDataSize;
+
+    // invalid packet size -> disconnect
+    if (pkgSize > MaxPacketSize) {
+        socket->disconnectFromHost();
+        return false;
+    }
+
+    // check if the full packet is available
+    if (socket->bytesAvailable() < pkgSize)
+        return false;
+
+    packet->setData(socket->read(pkgSize));
+    return true;
+}
+
+bool DcpHub::registerDeviceName(QTcpSocket *socket, const QByteArray &name)
+{
+    Q_ASSERT(socket);
+
+    SocketMap::iterator iter = m_socketMap.find(socket);
+    if (iter == m_socketMap.end())
+        return false;
+
+    ClientInfo &ci = iter.value();
+
+    if (isNullDeviceName(name) || isServerDeviceName(name)) {
+        cerr << "Device trying to register invalid name ["
+             << ci.address.toString() << ":" << ci.port << "]." << endl;
+        return false;
+    }
+
+    if (m_deviceMap.contains(name) || m_groups.contains(name)) {
+        cerr << "Device name \"" << QString::fromLatin1(name)
+             << "\" already exists [" << ci.address.toString() << ":"
+             << ci.port << "]." << endl;
+        return false;
+    }
+
+    // the first name is the device name of the connection, all further
+    // names are aliases registered by handleNameRequest()
+    if (ci.device.isEmpty())
+        ci.device = name;
+    else
+        ci.aliases.append(name);
+    m_deviceMap[name] = socket;
+
+    cout << "Registered device \"" << QString::fromLatin1(name) << "\" ["
+         << ci.address.toString() << ":" << ci.port << "]." << endl;
+    devicesChanged('+', QList<QByteArray>() << name, true);
+    resubscribe(name);
+    return true;
+}
+
+/*
+    Handles HELO and BYE messages to the null device, which are sent by an
+    already registered connection with a source name other than its own
+    device name. HELO registers the source name as an additional device name
+    of the connection, BYE releases it again. This allows a single connection
+    to serve many devices. Returns false if the packet is not a name request
+    and should be routed as usual.
+ */
+bool DcpHub::handleNameRequest(QTcpSocket *socket, const DcpPacket &packet)
+{
+    SocketMap::iterator iter = m_socketMap.find(socket);
+    if (iter == m_socketMap.end())
+        return false;
+
+    ClientInfo &ci = iter.value();
+    QByteArray name = packet.source();
+    if (name == ci.device)
+        return false;
+
+    QByteArray request = packet.data().mid(FullHeaderSize);
+    if (request == "HELO") {
+        // a failed registration only affects the alias, not the connection
+        if (!ci.aliases.contains(name))
+            registerDeviceName(socket, name);
+        return true;
+    }
+    else if (request == "BYE") {
+        if (ci.aliases.removeAll(name) > 0) {
+            m_deviceMap.remove(name);
+            cout << "Released device \"" << QString::fromLatin1(name)
+                 << "\" [" << ci.address.toString() << ":" << ci.port
+                 << "]." << endl;
+            devicesChanged('-', QList<QByteArray>() << name, true);
+            removeSubscriber(name);
+        }
+        return true;
+    }
+    return false;
+}
+
+/*
+    Enforces the rate limits of the source device and routes the packet.
+    Returns false if no more packets should be read from the socket, i.e. if
+    the packet was delayed or the device was disconnected.
+ */
+bool DcpHub::processPacket(QTcpSocket *socket, const DcpPacket &packet)
+{
+    SocketMap::iterator it = m_socketMap.find(socket);
+    if (it == m_socketMap.end())
+        return false;
+    ClientInfo &ci = it.value();
+
+    // keep the packet order while there are delayed packets
+    if (!ci.delayedPackets.isEmpty()) {
+        ci.delayedCount++;
+        ci.delayedPackets.enqueue(packet);
+        return false;
+    }
+
+    RateLimit::Action action;
+    int wait;
+    if (checkRateLimit(ci, packet, &action, &wait)) {
+        ci.passedCount++;
+        routePacket(ci.connectionId, packet, ci.isPeer);
+        return true;
+    }
+
+    switch (action) {
+    case RateLimit::DelayAction:
+        ci.delayedCount++;
+        ci.delayedPackets.enqueue(packet);
+        m_delayedSockets.append(socket);
+        startRateTimer(wait);
+        return false;
+    case RateLimit::DropAction:
+        ci.droppedCount++;
+        return true;
+    case RateLimit::DisconnectAction:
+        ci.droppedCount++;
+        cerr << ts() << "Rate limit exceeded by device \""
+             << QString::fromLatin1(ci.device) << "\" ["
+             << ci.address.toString() << ":" << ci.port << "]." << endl;
+        socket->disconnectFromHost();
+        return false;
+    }
+    return true;
+}
+
+/*
+    Sends the packets which were delayed by rate limits, as far as the
+    limits allow. Sockets without any delayed packets are scheduled for
+    reading again.
+ */
+void DcpHub::processDelayedPackets()
+{
+    QList<QTcpSocket *> socketList = m_delayedSockets;
+    m_delayedSockets.clear();
+
+    int nextWait = -1;
+    foreach (QTcpSocket *socket, socketList)
+    {
+        SocketMap::iterator it = m_socketMap.find(socket);
+        if (it == m_socketMap.end())
+            continue;
+        ClientInfo &ci = it.value();
+
+        bool disconnect = false;
+        while (!ci.delayedPackets.isEmpty())
+        {
+            RateLimit::Action action;
+            int wait;
+            if (checkRateLimit(ci, ci.delayedPackets.head(),
+                               &action, &wait)) {
+                ci.passedCount++;
+                routePacket(ci.connectionId, ci.delayedPackets.dequeue(),
+                            ci.isPeer);
+                continue;
             }
-            sendMessage(socket, msg.replyMessage(mode));
+
+            // the limits may have been changed in the meantime
+            if (action == RateLimit::DelayAction) {
+                if (nextWait < 0 || wait < nextWait)
+                    nextWait = wait;
+                break;
+            }
+            ci.droppedCount++;
+            ci.delayedPackets.dequeue();
+            if (action == RateLimit::DisconnectAction) {
+                ci.droppedCount += ci.delayedPackets.size();
+                ci.delayedPackets.clear();
+                disconnect = true;
+            }
+        }
+
+        if (disconnect)
+            socket->disconnectFromHost();
+        else if (!ci.delayedPackets.isEmpty())
+            m_delayedSockets.append(socket);
+        else
+            scheduleSocket(socket);
+    }
+
+    flushWrites();
+
+    if (nextWait >= 0)
+        startRateTimer(nextWait);
+}
+
+/*
+    Starts the rate timer, unless it is already running and expires earlier.
+ */
+void DcpHub::startRateTimer(int msecs)
+{
+    qint64 due = m_clock.elapsed() + msecs;
+    if (!m_rateTimer->isActive() || due < m_rateTimerDue) {
+        m_rateTimerDue = due;
+        m_rateTimer->start(msecs);
+    }
+}
+
+/*
+    Checks the device and pair limits of the client and consumes a token
+    from each bucket if the packet may pass. Otherwise the most severe
+    action of the exceeded limits and the time until the packet may pass
+    are returned.
+
+    A peer link carries the packets of many devices. It is only limited by
+    a device limit that is configured for the name of the peer hub, the
+    default limit "*" does not apply. Pair limits of peer traffic are
+    looked up by the source device of the packet. Peer links are never
+    disconnected, the disconnect action drops the packet instead.
+ */
+bool DcpHub::checkRateLimit(ClientInfo &ci, const DcpPacket &packet,
+                            RateLimit::Action *action, int *waitMsecs)
+{
+    Q_ASSERT(action);
+    Q_ASSERT(waitMsecs);
+
+    const QByteArray source = ci.isPeer ? packet.source() : ci.device;
+    const QByteArray destination = packet.destination();
+
+    // the limits were changed, reset the client's buckets
+    if (ci.limitsVersion != m_limitsVersion) {
+        ci.limitsVersion = m_limitsVersion;
+        ci.deviceLimit = RateLimitState(ci.isPeer ? peerLimit(ci.peerName)
+                                                  : deviceLimit(source));
+        ci.pairLimits.clear();
+    }
+
+    // Only destinations with a configured pair limit get a bucket; the
+    // destinations are chosen by the client, so unlimited ones must not
+    // create entries.
+    RateLimitState *pair = 0;
+    if (!m_pairLimits.isEmpty()) {
+        const PairKey key(source, destination);
+        QHash<PairKey, RateLimitState>::iterator pit = ci.pairLimits.find(key);
+        if (pit != ci.pairLimits.end()) {
+            pair = &pit.value();
+        }
+        else {
+            RateLimit limit = pairLimit(source, destination);
+            if (!limit.isNull()) {
+                if (ci.isPeer && limit.action == RateLimit::DisconnectAction)
+                    limit.action = RateLimit::DropAction;
+                if (ci.pairLimits.size() >= MaxPairLimitStates)
+                    ci.pairLimits.clear();
+                pair = &ci.pairLimits.insert(key,
+                                             RateLimitState(limit)).value();
+            }
+        }
+    }
+
+    const qint64 now = m_clock.elapsed();
+    RateLimitState &dev = ci.deviceLimit;
+    int devWait = dev.bucket.msecsUntilAvailable(now);
+    int pairWait = pair ? pair->bucket.msecsUntilAvailable(now) : 0;
+    if (devWait == 0 && pairWait == 0) {
+        dev.bucket.consume(now);
+        if (pair)
+            pair->bucket.consume(now);
+        return true;
+    }
+
+    *action = RateLimit::DelayAction;
+    if (devWait > 0)
+        *action = dev.limit.action;
+    if (pairWait > 0 && pair->limit.action > *action)
+        *action = pair->limit.action;
+    *waitMsecs = qMax(devWait, pairWait);
+    return false;
+}
+
+/*
+    Returns the configured limit of the device, or the default limit.
+ */
+RateLimit DcpHub::deviceLimit(const QByteArray &device) const
+{
+    DeviceLimitMap::const_iterator it = m_deviceLimits.find(device);
+    if (it == m_deviceLimits.constEnd())
+        it = m_deviceLimits.find("*");
+    return it != m_deviceLimits.constEnd() ? it.value() : RateLimit();
+}
+
+/*
+    Returns the limit of a peer link, i.e. the limit that is configured for
+    the name of the peer hub. The default limit is not used for peer links,
+    and the disconnect action is replaced by the drop action.
+ */
+RateLimit DcpHub::peerLimit(const QByteArray &peerName) const
+{
+    RateLimit limit = m_deviceLimits.value(peerName);
+    if (limit.action == RateLimit::DisconnectAction)
+        limit.action = RateLimit::DropAction;
+    return limit;
+}
+
+/*
+    Returns the configured limit for packets from source to destination,
+    falling back to the limit for packets from any device to destination.
+ */
+RateLimit DcpHub::pairLimit(const QByteArray &source,
+                            const QByteArray &destination) const
+{
+    PairLimitMap::const_iterator it = m_pairLimits.find(
+                qMakePair(source, destination));
+    if (it == m_pairLimits.constEnd())
+        it = m_pairLimits.find(qMakePair(QByteArray("*"), destination));
+    return it != m_pairLimits.constEnd() ? it.value() : RateLimit();
+}
+
+/*
+    Returns the configured limits as list of "src dst rate burst action"
+    tuples. Device limits use "*" as destination. Empty source or
+    destination keys match all limits.
+ */
+QList<QByteArray> DcpHub::rateLimitList(const QByteArray &source,
+                                        const QByteArray &destination) const
+{
+    QList<QByteArray> result;
+    if (destination.isEmpty() || destination == "*") {
+        DeviceLimitMap::const_iterator it;
+        for (it = m_deviceLimits.constBegin();
+             it != m_deviceLimits.constEnd(); ++it) {
+            if (!source.isEmpty() && it.key() != source)
+                continue;
+            result << limitKeyName(it.key()) << "*"
+                   << QByteArray::number(it.value().rate)
+                   << QByteArray::number(it.value().burst)
+                   << RateLimit::actionName(it.value().action);
+        }
+    }
+    if (destination != "*") {
+        PairLimitMap::const_iterator it;
+        for (it = m_pairLimits.constBegin();
+             it != m_pairLimits.constEnd(); ++it) {
+            if (!source.isEmpty() && it.key().first != source)
+                continue;
+            if (!destination.isEmpty() && it.key().second != destination)
+                continue;
+            result << limitKeyName(it.key().first)
+                   << limitKeyName(it.key().second)
+                   << QByteArray::number(it.value().rate)
+                   << QByteArray::number(it.value().burst)
+                   << RateLimit::actionName(it.value().action);
+        }
+    }
+    return result;
+}
+
+void DcpHub::routePacket(quint32 connectionId, const DcpPacket &packet,
+                         bool fromPeer)
+{
+    if (m_recorder.isOpen())
+        m_recorder.record(connectionId, packet.data());
+
+    QByteArray device = packet.destination();
+    bool isCommand = !(packet.flags() & DcpPacket::ReplyFlag);
+
+    // send packet to its destination device
+    QTcpSocket *socket = m_deviceMap.value(device, 0);
+    if (socket) {
+        queueWrite(socket, packet.data());
+        return;
+    }
+
+    // send packets for groups to all members, see setGroup()
+    GroupMap::const_iterator group = m_groups.constFind(device);
+    if (group != m_groups.constEnd()) {
+        fanOut(group.value(), packet.data(), fromPeer);
+        return;
+    }
+
+    // send packets for destination patterns like "cam*" to all matches
+    if (routeToPattern(device, packet.data(), fromPeer))
+        return;
+
+    // forward packets for devices of peer hubs; packets received from a peer
+    // are only delivered locally, so that they cannot loop between hubs
+    if (!fromPeer) {
+        socket = m_remoteDevices.value(device, 0);
+        if (socket) {
+            queueWrite(socket, packet.data());
             return;
         }
+    }
+
+    // parameter updates are sent to the null device
+    if (isNullDeviceName(device)) {
+        if (isCommand && hasDataPrefix(packet.data(), "def "))
+            publishUpdate(packet, fromPeer);
+        return;
+    }
+
+    // ignore packets with unknown device names
+    if (!isServerDeviceName(device))
+        return;
+
+    // handle packets addressed to the server itself
+    Dcp::Message msg = packet.message();
+    if (!msg.isNull() && !msg.isReply())
+        handleCommand(msg);
+}
+
+/*
+    Handles the control messages of a peer hub, which are sent to the null
+    device with the name of the peer hub as source:
+
+        PEER 1               link established, answered with our own hello
+        DEVS + dev1 dev2 ... devices registered at the peer hub
+        DEVS - dev1 dev2 ... devices released by the peer hub
+ */
+bool DcpHub::handlePeerControl(QTcpSocket *socket, const DcpPacket &packet)
+{
+    SocketMap::iterator iter = m_socketMap.find(socket);
+    if (iter == m_socketMap.end())
+        return false;
+
+    ClientInfo &ci = iter.value();
+    Q_ASSERT(ci.isPeer);
+
+    // parameter updates of devices connected to the peer hub
+    if (hasDataPrefix(packet.data(), "def "))
+        return processPacket(socket, packet);
+
+    QList<QByteArray> args = packet.data().mid(FullHeaderSize).split(' ');
+    if (args.value(0) == "PEER")
+    {
+        QByteArray name = packet.source();
+        if (args.size() != 2 || args[1] != "1" || isNullDeviceName(name) ||
+                isServerDeviceName(name)) {
+            cerr << "Invalid peer hub link [" << ci.address.toString() << ":"
+                 << ci.port << "]." << endl;
+            socket->disconnectFromHost();
+            return false;
+        }
+
+        if (ci.peerName.isEmpty()) {
+            ci.peerName = name;
+            cout << "Linked peer hub \"" << QString::fromLatin1(name)
+                 << "\" [" << ci.address.toString() << ":" << ci.port
+                 << "]." << endl;
+        }
+        if (addRemoteDevice(socket, name))
+            devicesChanged('+', QList<QByteArray>() << name, false);
+        if (!ci.peerHelloSent)
+            sendPeerHello(socket);
+        return true;
+    }
+    else if (args.value(0) == "DEVS" && args.size() >= 2)
+    {
+        bool add = args[1] == "+";
+        QList<QByteArray> changed;
+        for (int i = 2; i < args.size(); ++i) {
+            QByteArray key = deviceKey(args[i], true);
+            if (add ? addRemoteDevice(socket, key) :
+                      removeRemoteDevice(socket, key))
+                changed.append(key);
+        }
+        if (!changed.isEmpty())
+            devicesChanged(add ? '+' : '-', changed, false);
+        return true;
+    }
+
+    qWarning("DcpHub::handlePeerControl(): Ignoring unknown message.");
+    return true;
+}
+
+/*
+    Sends the hello message and the names of all local devices to the peer
+    hub. Changes are sent by notifyPeers() afterwards.
+ */
+void DcpHub::sendPeerHello(QTcpSocket *socket)
+{
+    SocketMap::iterator iter = m_socketMap.find(socket);
+    if (iter == m_socketMap.end())
+        return;
+
+    iter.value().peerHelloSent = true;
+    sendMessage(socket, Dcp::Message(0, m_serverDeviceName, QByteArray(),
+                                     PeerHello, quint16(0)));
+    sendPeerDevices(socket, '+', m_deviceMap.keys());
+}
+
+void DcpHub::sendPeerDevices(QTcpSocket *socket, char op,
+                             const QList<QByteArray> &keys)
+{
+    for (int i = 0; i < keys.size(); i += PeerDevicesPerPacket)
+    {
+        QByteArray data("DEVS ");
+        data += op;
+        int count = qMin(keys.size(), i + int(PeerDevicesPerPacket));
+        for (int j = i; j < count; ++j) {
+            data += ' ';
+            data += limitKeyName(keys[j]);
+        }
+        sendMessage(socket, Dcp::Message(0, m_serverDeviceName, QByteArray(),
+                                         data, quint16(0)));
+    }
+}
+
+void DcpHub::notifyPeers(char op, const QList<QByteArray> &keys)
+{
+    SocketMap::iterator it = m_socketMap.begin();
+    for (; it != m_socketMap.end(); ++it)
+        if (it.value().isPeer && it.value().peerHelloSent)
+            sendPeerDevices(it.key(), op, keys);
+}
+
+/*
+    Devices may be announced by more than one peer hub, e.g. if two hubs are
+    linked twice. Packets are forwarded to the first peer that announced the
+    device and to the next one if that peer releases it. Both functions
+    return true if the device became reachable or unreachable.
+ */
+bool DcpHub::addRemoteDevice(QTcpSocket *socket, const QByteArray &key)
+{
+    ClientInfo &ci = m_socketMap.find(socket).value();
+    if (isNullDeviceName(key) || ci.remoteDevices.contains(key))
+        return false;
+    ci.remoteDevices.append(key);
+    if (m_remoteDevices.contains(key))
+        return false;
+
+    m_remoteDevices.insert(key, socket);
+    m_patternCache.clear();
+    resubscribe(key);
+    return true;
+}
+
+bool DcpHub::removeRemoteDevice(QTcpSocket *socket, const QByteArray &key)
+{
+    ClientInfo &ci = m_socketMap.find(socket).value();
+    ci.remoteDevices.removeAll(key);
+    if (m_remoteDevices.value(key) != socket)
+        return false;
+
+    m_remoteDevices.remove(key);
+    m_patternCache.clear();
+    SocketMap::const_iterator it = m_socketMap.constBegin();
+    for (; it != m_socketMap.constEnd(); ++it) {
+        if (it.key() != socket && it.value().remoteDevices.contains(key)) {
+            m_remoteDevices.insert(key, it.key());
+            return false;
+        }
+    }
+    removeSubscriber(key);
+    return true;
+}
+
+/*
+    Called whenever device names are registered or released, locally or by
+    a peer hub. Local changes are announced to the peer hubs. Clients that
+    subscribed to the device list with "set subscribe <hub> devlist" receive
+    the change as "def devlist + dev1 dev2 ..." or "def devlist - dev1 dev2
+    ..." message to the null device. Subscribers behind a peer hub receive
+    the message addressed to their own name instead, since the peer hub has
+    no subscription to pass an update of this hub on.
+ */
+void DcpHub::devicesChanged(char op, const QList<QByteArray> &keys,
+                            bool local)
+{
+    m_patternCache.clear();
+    m_deviceListValid = false;
+    if (local)
+        notifyPeers(op, keys);
+
+    SubscriptionMap::const_iterator it = m_subscriptions.constFind(
+        SubscriptionKey(deviceKey(m_serverDeviceName), "devlist"));
+    if (it == m_subscriptions.constEnd())
+        return;
+
+    QByteArray data("def devlist ");
+    data += op;
+    foreach (const QByteArray &key, keys) {
+        data += ' ';
+        data += limitKeyName(key);
+    }
+
+    QList<QByteArray> localSubscribers;
+    foreach (const QByteArray &subscriber, it.value()) {
+        if (m_deviceMap.contains(subscriber))
+            localSubscribers.append(subscriber);
+        else if (QTcpSocket *socket = m_remoteDevices.value(subscriber, 0))
+            sendMessage(socket, Dcp::Message(0, m_serverDeviceName, subscriber,
+                                             data, quint16(0)));
+    }
+    if (!localSubscribers.isEmpty())
+        sendMessage(localSubscribers, Dcp::Message(0, m_serverDeviceName,
+                                                   QByteArray(), data,
+                                                   quint16(0)));
+}
+
+/*
+    Subscribes to or unsubscribes from a parameter of a device. Clients send
+    these requests as commands to the hub device, see handleCommand():
+
+        set subscribe <dev> <identifier>     subscribe to updates
+        set unsubscribe <dev> <identifier>   cancel the subscription
+
+    The device itself receives a def command from the hub when the first
+    client subscribes to a parameter and an undef command when the last
+    subscription is cancelled; it may ignore these commands and always
+    publish updates. All other def and undef commands are passed to the
+    device unchanged.
+
+    Updates are published by the device as "def <identifier> <value-list>"
+    messages to the null device. The hub sends each update unchanged to all
+    connections with subscribers, see publishUpdate(). Subscriptions to
+    devices of a peer hub are forwarded to the peer hub with the name of
+    this hub, so that each update is passed only once over the peer link.
+
+    The hub itself publishes the device list as parameter devlist, see
+    devicesChanged().
+
+    Returns false if the device or, for the hub, the parameter is unknown.
+    Subscriptions received from a peer hub are only accepted for local
+    devices.
+ */
+bool DcpHub::handleSubscription(QTcpSocket *socket,
+                                const QByteArray &subscriber,
+                                const QByteArray &publisher,
+                                const QByteArray &identifier, bool subscribe)
+{
+    bool isHub = isServerDeviceName(publisher);
+    if (isHub && identifier != "devlist")
+        return false;
+
+    SubscriptionKey key(publisher, identifier);
+    if (!subscribe)
+    {
+        SubscriptionMap::iterator it = m_subscriptions.find(key);
+        if (it != m_subscriptions.end() &&
+                it.value().removeAll(subscriber) > 0 &&
+                it.value().isEmpty()) {
+            m_subscriptions.erase(it);
+            sendSubscription(publisher, "undef", identifier);
+        }
+        return true;
+    }
 
-        // get version
-        //     returns: <version>
-        if (identifier == "version")
-        {
-            if (cmd.hasArguments()) {
-                sendMessage(socket, msg.ackMessage(Dcp::AckParameterError));
-                return;
-            }
-            sendMessage(socket, msg.ackMessage());
-            sendMessage(socket, msg.replyMessage(DCPCLIENT_VERSION_STRING));
-            return;
-        }
+    bool viaPeer = m_socketMap.value(socket).isPeer;
+    if (!isHub && !m_deviceMap.contains(publisher) &&
+            (viaPeer || !m_remoteDevices.contains(publisher)))
+        return false;
 
-        // get qtversion
-        //     returns: <qtversion>
-        if (identifier == "qtversion")
-        {
-            if (cmd.hasArguments()) {
-                sendMessage(socket, msg.ackMessage(Dcp::AckParameterError));
-                return;
-            }
-            sendMessage(socket, msg.ackMessage());
-            sendMessage(socket, msg.replyMessage(qVersion()));
-            return;
+    QList<QByteArray> &subscribers = m_subscriptions[key];
+    if (!subscribers.contains(subscriber)) {
+        subscribers.append(subscriber);
+        if (subscribers.size() == 1 && !isHub)
+            sendSubscription(publisher, "def", identifier);
+    }
+    return true;
+}
+
+/*
+    Sends a parameter update to all connections with subscribers. The packet
+    is queued unchanged, so that the connections share a single buffer, and
+    only once per connection, even if several of its device names or several
+    devices behind a peer hub have subscribed.
+ */
+void DcpHub::publishUpdate(const DcpPacket &packet, bool fromPeer)
+{
+    // def <identifier> <value-list>
+    QByteArray data = packet.data();
+    int start = FullHeaderSize + 4;
+    int end = data.indexOf(' ', start);
+    if (end == -1)
+        end = data.size();
+
+    SubscriptionMap::const_iterator it = m_subscriptions.constFind(
+        SubscriptionKey(packet.source(), data.mid(start, end - start)));
+    if (it != m_subscriptions.constEnd())
+        fanOut(it.value(), data, fromPeer);
+}
+
+/*
+    Queues the data once for each connection that serves at least one of the
+    devices. All connections share the same buffer. Data received from a peer
+    hub is only passed on to local devices.
+ */
+void DcpHub::fanOut(const QList<QByteArray> &devices, const QByteArray &data,
+                    bool fromPeer)
+{
+    QList<QTcpSocket *> sockets;
+    foreach (const QByteArray &device, devices)
+    {
+        QTcpSocket *socket = m_deviceMap.value(device, 0);
+        if (!socket && !fromPeer)
+            socket = m_remoteDevices.value(device, 0);
+        if (socket && !sockets.contains(socket)) {
+            sockets.append(socket);
+            queueWrite(socket, data);
         }
+    }
+}
 
-        // get echo <arg1> [<arg2> [...]]
-        //     returns: <arg1> [<arg2> [...]]
-        if (identifier == "echo")
-        {
-            if (!cmd.hasArguments()) {
-                sendMessage(socket, msg.ackMessage(Dcp::AckParameterError));
-                return;
-            }
-            sendMessage(socket, msg.ackMessage());
-            sendMessage(socket, msg.replyMessage(cmd.joinedArguments()));
-            return;
+/*
+    Handles destination names ending with '*', which address all registered
+    devices whose names start with the rest of the name. The matching devices
+    are found by a range scan over the sorted device maps, and the resulting
+    connections are cached per pattern, so that repeated packets to a pattern
+    are resolved by a single hash lookup. The cache is cleared whenever a
+    device name is registered or released. Returns false if the destination
+    is not a pattern.
+ */
+bool DcpHub::routeToPattern(const QByteArray &pattern, const QByteArray &data,
+                            bool fromPeer)
+{
+    int n = pattern.size();
+    while (n > 0 && pattern[n-1] == '\0')
+        n--;
+    if (n == 0 || pattern[n-1] != '*')
+        return false;
+
+    PatternCache::const_iterator cached = m_patternCache.constFind(pattern);
+    if (cached == m_patternCache.constEnd())
+    {
+        if (m_patternCache.size() >= PatternCacheSize)
+            m_patternCache.clear();
+
+        QByteArray prefix = pattern.left(n - 1);
+        PatternMatch match;
+        DeviceMap::const_iterator it = m_deviceMap.lowerBound(prefix);
+        for (; it != m_deviceMap.constEnd() && it.key().startsWith(prefix);
+             ++it)
+            if (!match.local.contains(it.value()))
+                match.local.append(it.value());
+        it = m_remoteDevices.lowerBound(prefix);
+        for (; it != m_remoteDevices.constEnd() &&
+               it.key().startsWith(prefix); ++it)
+            if (!m_deviceMap.contains(it.key()) &&
+                    !match.peers.contains(it.value()))
+                match.peers.append(it.value());
+        cached = m_patternCache.insert(pattern, match);
+    }
+
+    // packets received from a peer hub are only delivered locally
+    foreach (QTcpSocket *socket, cached.value().local)
+        queueWrite(socket, data);
+    if (!fromPeer) {
+        foreach (QTcpSocket *socket, cached.value().peers)
+            queueWrite(socket, data);
+    }
+    return true;
+}
+
+/*
+    Notifies a device with a def or undef command. For devices of a peer hub
+    the subscription of this hub is passed on to the peer hub instead.
+ */
+void DcpHub::sendSubscription(const QByteArray &publisher,
+                              const char *command,
+                              const QByteArray &identifier)
+{
+    if (QTcpSocket *socket = m_deviceMap.value(publisher, 0)) {
+        sendMessage(socket, Dcp::Message(0, m_serverDeviceName, publisher,
+            QByteArray(command) + ' ' + identifier, quint16(0)));
+        return;
+    }
+
+    QTcpSocket *socket = m_remoteDevices.value(publisher, 0);
+    if (!socket)
+        return;
+    QByteArray request = qstrcmp(command, "def") == 0 ?
+                "set subscribe " : "set unsubscribe ";
+    sendMessage(socket, Dcp::Message(0, m_serverDeviceName,
+        m_socketMap.value(socket).peerName,
+        request + limitKeyName(publisher) + ' ' + identifier, quint16(0)));
+}
+
+/*
+    Renews the subscriptions to a device that has been registered again,
+    e.g. after a reconnect.
+ */
+void DcpHub::resubscribe(const QByteArray &publisher)
+{
+    SubscriptionMap::const_iterator it = m_subscriptions.lowerBound(
+        SubscriptionKey(publisher, QByteArray()));
+    for (; it != m_subscriptions.constEnd() && it.key().first == publisher;
+         ++it)
+        sendSubscription(publisher, "def", it.key().second);
+}
+
+void DcpHub::removeSubscriber(const QByteArray &subscriber)
+{
+    SubscriptionMap::iterator it = m_subscriptions.begin();
+    while (it != m_subscriptions.end())
+    {
+        if (it.value().removeAll(subscriber) > 0 && it.value().isEmpty()) {
+            SubscriptionKey key = it.key();
+            it = m_subscriptions.erase(it);
+            sendSubscription(key.first, "undef", key.second);
         }
+        else
+            ++it;
+    }
+}
+
+/*
+    Appends data to the write queue of the socket. The queued data is written
+    by flushWrites(), which is called once per scheduling pass, so that all
+    packets for a destination are written with a single system call.
+ */
+void DcpHub::queueWrite(QTcpSocket *socket, const QByteArray &data)
+{
+    SocketMap::iterator it = m_socketMap.find(socket);
+    if (it == m_socketMap.end())
+        return;
+
+    ClientInfo &ci = it.value();
+    ci.writeQueue.append(data);
+    if (!ci.flushPending) {
+        ci.flushPending = true;
+        m_flushSockets.append(socket);
+    }
+}
+
+void DcpHub::flushWrites()
+{
+    QList<QTcpSocket *> socketList = m_flushSockets;
+    m_flushSockets.clear();
+
+    foreach (QTcpSocket *socket, socketList)
+    {
+        SocketMap::iterator it = m_socketMap.find(socket);
+        if (it == m_socketMap.end())
+            continue;
+
+        ClientInfo &ci = it.value();
+        QList<QByteArray> buffers = ci.writeQueue;
+        ci.writeQueue.clear();
+        ci.flushPending = false;
+        writeBuffers(socket, buffers);
     }
-    else if (cmdType == Dcp::CommandParser::SetCmd)
+}
+
+/*
+    Writes the buffers to the socket. If the socket's write buffer is empty,
+    the data is sent directly using vectored I/O. Everything that cannot be
+    sent immediately is passed to QTcpSocket::write().
+ */
+void DcpHub::writeBuffers(QTcpSocket *socket,
+                          const QList<QByteArray> &buffers)
+{
+    int first = 0;
+
+#ifdef Q_OS_UNIX
+    enum { MaxIoVecs = 64 };
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+
+    // bypassing the socket's write buffer is only allowed while it is empty,
+    // otherwise the data would be reordered
+    const int fd = int(socket->socketDescriptor());
+    if (fd >= 0 && socket->bytesToWrite() == 0 &&
+            socket->state() == QAbstractSocket::ConnectedState)
     {
-        // set nop
-        //     returns: FIN
-        if (identifier == "nop")
+        while (first < buffers.size())
         {
-            if (cmd.hasArguments()) {
-                sendMessage(socket, msg.ackMessage(Dcp::AckParameterError));
-                return;
+            struct iovec iov[MaxIoVecs];
+            const int count = qMin(buffers.size() - first, int(MaxIoVecs));
+            for (int i = 0; i < count; ++i) {
+                const QByteArray &buf = buffers.at(first + i);
+                iov[i].iov_base = const_cast<char *>(buf.constData());
+                iov[i].iov_len = buf.size();
             }
-            sendMessage(socket, msg.ackMessage());
-            sendMessage(socket, msg.replyMessage());
-            return;
-        }
 
-        // set debug ( none | msg | pkg | full )
-        //     returns: FIN
-        if (identifier == "debug")
-        {
-            if (args.size() != 1) {
-                sendMessage(socket, msg.ackMessage(Dcp::AckParameterError));
-                return;
+            struct msghdr mh;
+            memset(&mh, 0, sizeof(mh));
+            mh.msg_iov = iov;
+            mh.msg_iovlen = count;
+
+            ssize_t written;
+            do {
+                written = ::sendmsg(fd, &mh, flags);
+            } while (written < 0 && errno == EINTR);
+
+            // EAGAIN or error; QTcpSocket handles the rest
+            if (written < 0)
+                break;
+
+            const int last = first + count;
+            while (first < last && written >= buffers.at(first).size()) {
+                written -= buffers.at(first).size();
+                first++;
             }
-            QByteArray mode = args[0];
-            DebugFlags flags;
-            if (mode == "none" || mode == "off" || mode == "0")
-                flags = NoDebug;
-            else if (mode == "msg" || mode == "on" || mode == "1")
-                flags = MessageDebug;
-            else if (mode == "pkg")
-                flags = PacketDebug;
-            else if (mode == "full")
-                flags = FullDebug;
-            else {
-                sendMessage(socket, msg.ackMessage(Dcp::AckParameterError));
-                return;
+
+            // the kernel's send buffer is full
+            if (first < last) {
+                if (written > 0) {
+                    const QByteArray &buf = buffers.at(first);
+                    socket->write(buf.constData() + written,
+                                  buf.size() - written);
+                    first++;
+                }
+                break;
             }
-            sendMessage(socket, msg.ackMessage());
-            m_debugFlags = flags;
-            sendMessage(socket, msg.replyMessage());
+        }
+    }
+#endif
+
+    for (; first < buffers.size(); ++first)
+        socket->write(buffers.at(first));
+}
+
+void DcpHub::sendMessage(QTcpSocket *socket, const Dcp::Message &msg)
+{
+    Q_ASSERT(socket);
+    QByteArray data = packetData(msg);
+    if (data.isEmpty())
+        return;
+
+    if (m_debugFlags != NoDebug)
+        logPacket(data);
+    if (m_recorder.isOpen())
+        m_recorder.record(0, data);
+
+    queueWrite(socket, data);
+}
+
+/*
+    Sends the message to several devices, encoding it only once; see
+    fanOut().
+ */
+void DcpHub::sendMessage(const QList<QByteArray> &devices,
+                         const Dcp::Message &msg)
+{
+    QByteArray data = packetData(msg);
+    if (data.isEmpty())
+        return;
+
+    if (m_debugFlags != NoDebug)
+        logPacket(data);
+    if (m_recorder.isOpen())
+        m_recorder.record(0, data);
+
+    fanOut(devices, data, false);
+}
+
+QByteArray DcpHub::packetData(const Dcp::Message &msg) const
+{
+    if (msg.isNull()) {
+        qWarning("DcpHub::sendMessage(): Ignoring invalid message.");
+        return QByteArray();
+    }
+    if (!msg.data().size() + FullHeaderSize > MaxPacketSize) {
+        qWarning("DcpHub::sendMessage(): Skipping large message. " \
+                 "Multi-packet messages are currently not supported.");
+        return QByteArray();
+    }
+
+    char pkgHeader[PacketHeaderSize];
+    quint32 *pMsgSize = reinterpret_cast<quint32 *>(
+                pkgHeader + PacketMsgSizePos);
+    quint32 *pOffset = reinterpret_cast<quint32 *>(
+                pkgHeader + PacketOffsetPos);
+
+    *pMsgSize = qToBigEndian(static_cast<quint32>(msg.data().size()));
+    *pOffset = 0;
+
+    QByteArray msgData = msg.toByteArray();
+    QByteArray data;
+    data.reserve(PacketHeaderSize + msgData.size());
+    data.append(pkgHeader, PacketHeaderSize);
+    data.append(msgData);
+    return data;
+}
+
+/*
+    Passes the packet to the logger thread if it matches the capture filter.
+    The PacketLogger flags correspond to the DebugFlags.
+ */
+void DcpHub::logPacket(const QByteArray &data)
+{
+    if (m_captureFilter.matches(data))
+        m_logger->log(data, m_debugFlags);
+}
+
+/*
+    Parses the arguments of the "set capture" command. The arguments are
+    key-value pairs: src, dst and dev take a device name, flags takes a
+    value with an optional mask (<value>[/<mask>]), prefix takes a
+    percent-encoded payload prefix and sample the sampling rate n, i.e.
+    only one in n matching packets is captured.
+ */
+bool DcpHub::parseCaptureFilter(const QList<QByteArray> &args,
+                                CaptureFilter *filter) const
+{
+    Q_ASSERT(filter);
+    filter->clear();
+    if (args.isEmpty() || args.size() % 2 != 0)
+        return false;
+
+    for (int i = 0; i < args.size(); i += 2)
+    {
+        const QByteArray &key = args[i];
+        const QByteArray &value = args[i+1];
+        if (key == "src")
+            filter->setSource(deviceKey(value, true));
+        else if (key == "dst")
+            filter->setDestination(deviceKey(value, true));
+        else if (key == "dev")
+            filter->setDevice(deviceKey(value, true));
+        else if (key == "flags") {
+            int sep = value.indexOf('/');
+            bool okValue, okMask = true;
+            uint flags = value.left(sep).toUInt(&okValue, 0);
+            uint mask = sep < 0 ? flags : value.mid(sep+1).toUInt(&okMask, 0);
+            if (!okValue || !okMask || flags > 0xffff || mask > 0xffff ||
+                    mask == 0)
+                return false;
+            filter->setFlags(quint16(mask), quint16(flags));
+        }
+        else if (key == "prefix")
+            filter->setPayloadPrefix(QByteArray::fromPercentEncoding(value));
+        else if (key == "sample") {
+            bool ok;
+            int n = value.toInt(&ok);
+            if (!ok || n < 1)
+                return false;
+            filter->setSampleRate(n);
+        }
+        else
+            return false;
+    }
+    return true;
+}
+
+QList<QByteArray> DcpHub::captureFilterArgs() const
+{
+    const CaptureFilter &f = m_captureFilter;
+    QList<QByteArray> result;
+    if (!f.source().isEmpty())
+        result << "src" << limitKeyName(f.source());
+    if (!f.destination().isEmpty())
+        result << "dst" << limitKeyName(f.destination());
+    if (!f.device().isEmpty())
+        result << "dev" << limitKeyName(f.device());
+    if (f.flagsMask() != 0)
+        result << "flags" << "0x" + QByteArray::number(f.flagsValue(), 16) +
+                  "/0x" + QByteArray::number(f.flagsMask(), 16);
+    if (!f.payloadPrefix().isEmpty())
+        result << "prefix" << f.payloadPrefix().toPercentEncoding();
+    if (f.sampleRate() > 1)
+        result << "sample" << QByteArray::number(f.sampleRate());
+    if (result.isEmpty())
+        result << "off";
+    return result;
+}
+
+/*
+    Passes a command sent to the hub device to the command server. The
+    commands are registered in the constructor; the handlers follow below.
+    The ACKs and replies are sent to the connection of the sender by
+    sendAck() and sendReply().
+ */
+void DcpHub::handleCommand(const Dcp::Message &msg)
+{
+    Q_ASSERT(!msg.isNull() && !msg.isReply());
+    Q_ASSERT(isServerDeviceName(msg.destination()));
+    if (!commandSocket(msg)) {
+        qWarning("DcpHub::handleCommand(): Unknown socket.");
+        return;
+    }
+    m_commandServer->handleMessage(msg);
+}
+
+/*
+    Returns the connection of the sender of a command. Commands of devices
+    connected to a peer hub are answered via the peer.
+ */
+QTcpSocket * DcpHub::commandSocket(const Dcp::Message &msg) const
+{
+    QByteArray sourceKey = deviceKey(msg.source());
+    QTcpSocket *socket = m_deviceMap.value(sourceKey, 0);
+    if (!socket)
+        socket = m_remoteDevices.value(sourceKey, 0);
+    return socket;
+}
+
+void DcpHub::sendAck(const Dcp::Message &command, int errorCode)
+{
+    if (QTcpSocket *socket = commandSocket(command))
+        sendMessage(socket, command.ackMessage(errorCode));
+}
+
+void DcpHub::sendReply(const Dcp::Message &command, const QByteArray &data,
+                       int errorCode)
+{
+    if (QTcpSocket *socket = commandSocket(command))
+        sendMessage(socket, command.replyMessage(data, errorCode));
+}
+
+// get devlist
+//     returns: dev1 dev2 ...
+void DcpHub::getDevList(Dcp::DeviceRequest *request)
+{
+    request->setReply(deviceListSnapshot());
+}
+
+// get devinfo [dev1 [dev2 [...]]]
+//     returns: [dev1 addr1 port1 [dev2 addr2 port2 [...]]] | FIN
+//     errorcodes: -1 -> at least one device is unknown
+//     notes: if no device is specified all devices are returned,
+//            devices of peer hubs are listed with the peer's address
+void DcpHub::getDevInfo(Dcp::DeviceRequest *request)
+{
+    QList<QByteArray> args = request->arguments();
+    if (args.isEmpty())
+        args = deviceList(true, true);
+    int errorCode = 0;
+    QList<QByteArray> result;
+    foreach (QByteArray device, args)
+    {
+        QByteArray key = deviceKey(device, true);
+        QTcpSocket *devSocket = m_deviceMap.value(key, 0);
+        if (!devSocket)
+            devSocket = m_remoteDevices.value(key, 0);
+        if (devSocket) {
+            Q_ASSERT(m_socketMap.contains(devSocket));
+            ClientInfo info = m_socketMap.value(devSocket);
+            result.append(device);
+            result.append(info.address.toString().toLatin1());
+            result.append(QByteArray::number(info.port));
+        }
+        else
+            errorCode = -1;
+    }
+    request->setReply(joined(result), errorCode);
+}
+
+// get ratelimit [<src> [<dst>]]
+//     returns: [src1 dst1 rate1 burst1 action1 [...]]
+//     notes: device limits are returned with "*" as destination,
+//            "*" as source refers to the default limits
+void DcpHub::getRateLimit(Dcp::DeviceRequest *request)
+{
+    int numArgs = request->numArguments();
+    QByteArray src = numArgs < 1 ? QByteArray() :
+                                   limitKey(request->argument(0));
+    QByteArray dst = numArgs < 2 ? QByteArray() :
+                                   limitKey(request->argument(1));
+    request->setReply(joined(rateLimitList(src, dst)));
+}
+
+// get ratestats [dev1 [dev2 [...]]]
+//     returns: [dev1 passed1 delayed1 dropped1 [...]] | FIN
+//     errorcodes: -1 -> at least one device is unknown
+//     notes: if no device is specified all devices are returned
+void DcpHub::getRateStats(Dcp::DeviceRequest *request)
+{
+    QList<QByteArray> args = request->arguments();
+    if (args.isEmpty())
+        args = deviceList(true);
+    int errorCode = 0;
+    QList<QByteArray> result;
+    foreach (QByteArray device, args)
+    {
+        QByteArray key = deviceKey(device, true);
+        QTcpSocket *devSocket = m_deviceMap.value(key, 0);
+        if (devSocket) {
+            Q_ASSERT(m_socketMap.contains(devSocket));
+            const ClientInfo &info = m_socketMap.find(devSocket).value();
+            result.append(device);
+            result.append(QByteArray::number(info.passedCount));
+            result.append(QByteArray::number(info.delayedCount));
+            result.append(QByteArray::number(info.droppedCount));
+        }
+        else
+            errorCode = -1;
+    }
+    request->setReply(joined(result), errorCode);
+}
+
+// get group [name]
+//     returns: [dev1 [dev2 [...]]] | FIN
+//     errorcodes: -1 -> unknown group
+//     notes: without a name the names of all groups are returned
+void DcpHub::getGroup(Dcp::DeviceRequest *request)
+{
+    QList<QByteArray> result;
+    int errorCode = 0;
+    if (request->numArguments() == 0) {
+        foreach (const QByteArray &key, m_groups.keys())
+            result.append(limitKeyName(key));
+    }
+    else {
+        GroupMap::const_iterator it =
+                m_groups.constFind(deviceKey(request->argument(0), true));
+        if (it != m_groups.constEnd()) {
+            foreach (const QByteArray &key, it.value())
+                result.append(limitKeyName(key));
+        }
+        else
+            errorCode = -1;
+    }
+    request->setReply(joined(result), errorCode);
+}
+
+// get subscriptions [dev]
+//     returns: [dev1 param1 subscribers1 [...]] | FIN
+//     notes: subscribers of a peer hub are counted as one
+void DcpHub::getSubscriptions(Dcp::DeviceRequest *request)
+{
+    QByteArray key = request->numArguments() == 0 ?
+                QByteArray() : deviceKey(request->argument(0), true);
+    QList<QByteArray> result;
+    SubscriptionMap::const_iterator it = m_subscriptions.constBegin();
+    for (; it != m_subscriptions.constEnd(); ++it) {
+        if (!key.isEmpty() && it.key().first != key)
+            continue;
+        result.append(limitKeyName(it.key().first));
+        result.append(it.key().second);
+        result.append(QByteArray::number(it.value().size()));
+    }
+    request->setReply(joined(result));
+}
+
+// get debug
+//     returns: ( none | msg | pkg | full )
+void DcpHub::getDebug(Dcp::DeviceRequest *request)
+{
+    QByteArray mode;
+    switch (m_debugFlags) {
+    case NoDebug:
+        mode = "none";
+        break;
+    case MessageDebug:
+        mode = "msg";
+        break;
+    case PacketDebug:
+        mode = "pkg";
+        break;
+    case FullDebug:
+        mode = "full";
+        break;
+    }
+    request->setReply(mode);
+}
+
+// get capture
+//     returns: off | <key1> <value1> [<key2> <value2> [...]]
+void DcpHub::getCapture(Dcp::DeviceRequest *request)
+{
+    request->setReply(joined(captureFilterArgs()));
+}
+
+// get logstats
+//     returns: <dropped>
+//     notes: number of packets that were not shown by the debug
+//            output because the logger thread fell behind
+void DcpHub::getLogStats(Dcp::DeviceRequest *request)
+{
+    request->setReply(QByteArray::number(m_logger->droppedCount()));
+}
+
+// get version
+//     returns: <version>
+void DcpHub::getVersion(Dcp::DeviceRequest *request)
+{
+    request->setReply(DCPCLIENT_VERSION_STRING);
+}
+
+// get qtversion
+//     returns: <qtversion>
+void DcpHub::getQtVersion(Dcp::DeviceRequest *request)
+{
+    request->setReply(qVersion());
+}
+
+// get echo <arg1> [<arg2> [...]]
+//     returns: <arg1> [<arg2> [...]]
+void DcpHub::getEcho(Dcp::DeviceRequest *request)
+{
+    request->setReply(joined(request->arguments()));
+}
+
+// set nop
+//     returns: FIN
+void DcpHub::setNop(Dcp::DeviceRequest *request)
+{
+    Q_UNUSED(request)
+}
+
+// set subscribe <dev> <identifier>
+// set unsubscribe <dev> <identifier>
+//     returns: FIN | dev1 dev2 ...
+//     errors: -1 unknown device
+//     notes: see handleSubscription(); subscribing to the devlist
+//            parameter of the hub returns the current device list
+void DcpHub::setSubscribe(Dcp::DeviceRequest *request)
+{
+    Dcp::Message msg = request->message();
+    bool subscribe = request->identifier() == "subscribe";
+    QByteArray publisher = deviceKey(request->argument(0), true);
+    bool ok = handleSubscription(commandSocket(msg), deviceKey(msg.source()),
+                                 publisher, request->argument(1), subscribe);
+    QByteArray reply;
+    if (ok && subscribe && isServerDeviceName(publisher))
+        reply = deviceListSnapshot();
+    request->setReply(reply, ok ? 0 : -1);
+}
+
+// set debug ( none | msg | pkg | full )
+//     returns: FIN
+void DcpHub::setDebug(Dcp::DeviceRequest *request)
+{
+    QByteArray mode = request->argument(0);
+    if (mode == "none" || mode == "off" || mode == "0")
+        m_debugFlags = NoDebug;
+    else if (mode == "msg" || mode == "on" || mode == "1")
+        m_debugFlags = MessageDebug;
+    else if (mode == "pkg")
+        m_debugFlags = PacketDebug;
+    else if (mode == "full")
+        m_debugFlags = FullDebug;
+    else
+        request->reject(Dcp::AckParameterError);
+}
+
+// set capture ( off | <key1> <value1> [<key2> <value2> [...]] )
+//     returns: FIN
+//     notes: keys are src, dst, dev, flags, prefix and sample; the
+//            filter selects the packets shown by the debug output
+void DcpHub::setCapture(Dcp::DeviceRequest *request)
+{
+    QList<QByteArray> args = request->arguments();
+    CaptureFilter filter;
+    if (!(args.size() == 1 && args[0] == "off") &&
+            !parseCaptureFilter(args, &filter)) {
+        request->reject(Dcp::AckParameterError);
+        return;
+    }
+    m_captureFilter = filter;
+}
+
+// set group <name> [<dev1> [<dev2> [...]]]
+//     returns: FIN
+//     errorcodes: -1 -> invalid name or name used by a device
+//     notes: without devices the group is removed
+void DcpHub::setGroupMembers(Dcp::DeviceRequest *request)
+{
+    QList<QByteArray> args = request->arguments();
+    QByteArray name = QByteArray::fromPercentEncoding(args.takeFirst());
+    QMutableListIterator<QByteArray> it(args);
+    while (it.hasNext()) {
+        QByteArray &member = it.next();
+        member = QByteArray::fromPercentEncoding(member);
+    }
+    int errorCode = setGroup(name, args) ? 0 : -1;
+    request->setReply(QByteArray(), errorCode);
+}
+
+// set ratelimit <src> [<dst>] ( <rate> <burst> <action> | off )
+//     returns: FIN
+//     notes: <src> and <dst> may be "*" for all devices, <rate> is
+//            given in packets per second, <action> is one of
+//            delay, drop or disconnect; a link of a peer hub is
+//            only limited by the name of the peer hub, never by "*",
+//            and is never disconnected; pair limits of peer traffic
+//            use the remote source device
+void DcpHub::setRateLimit(Dcp::DeviceRequest *request)
+{
+    QList<QByteArray> args = request->arguments();
+    bool off = args.last() == "off";
+    int limitArgs = off ? 1 : 3;
+    if (args.size() - limitArgs != 1 && args.size() - limitArgs != 2) {
+        request->reject(Dcp::AckParameterError);
+        return;
+    }
+
+    QByteArray src = limitKey(args[0]);
+    QByteArray dst = args.size() - limitArgs == 2 ?
+                limitKey(args[1]) : QByteArray("*");
+    RateLimit limit;
+    if (!off) {
+        int i = args.size() - limitArgs;
+        bool okRate, okBurst;
+        limit.rate = args[i].toDouble(&okRate);
+        limit.burst = args[i+1].toDouble(&okBurst);
+        if (!okRate || !okBurst || limit.rate <= 0.0 || limit.burst < 1.0 ||
+                !RateLimit::parseAction(args[i+2], &limit.action)) {
+            request->reject(Dcp::AckParameterError);
             return;
         }
     }
 
-    sendMessage(socket, msg.ackMessage(Dcp::AckUnknownCommandError));
+    if (dst == "*") {
+        if (off)
+            m_deviceLimits.remove(src);
+        else
+            m_deviceLimits.insert(src, limit);
+    } else {
+        if (off)
+            m_pairLimits.remove(qMakePair(src, dst));
+        else
+            m_pairLimits.insert(qMakePair(src, dst), limit);
+    }
+    m_limitsVersion++;
 }
 
 QString DcpHub::ts() const
@@ -512,9 +2519,29 @@ bool DcpHub::isServerDeviceName(const QByteArray &name) const
     return true;
 }
 
-QList<QByteArray> DcpHub::deviceList(bool percentEncoded)
+/*
+    Returns the encoded device list, including the devices of peer hubs. The
+    list is only built again after devicesChanged().
+ */
+QByteArray DcpHub::deviceListSnapshot()
+{
+    if (!m_deviceListValid) {
+        m_deviceListSnapshot = joined(deviceList(true, true));
+        m_deviceListValid = true;
+    }
+    return m_deviceListSnapshot;
+}
+
+QList<QByteArray> DcpHub::deviceList(bool percentEncoded, bool includeRemote)
 {
     QList<QByteArray> devList = m_deviceMap.keys();
+    if (includeRemote) {
+        DeviceMap::const_iterator it = m_remoteDevices.constBegin();
+        for (; it != m_remoteDevices.constEnd(); ++it)
+            if (!m_deviceMap.contains(it.key()))
+                devList.append(it.key());
+        qSort(devList);
+    }
     QMutableListIterator<QByteArray> it(devList);
     while (it.hasNext()) {
         QByteArray &dev = it.next();
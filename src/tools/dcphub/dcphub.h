@@ -26,22 +26,29 @@
 #ifndef DCPHUB_H
 #define DCPHUB_H
 
-#include "hexformatter.h"
+#include "dcppacket.h"
+#include "ratelimit.h"
+#include "capturefilter.h"
+#include "flightrecorder.h"
+#include "handoffchannel.h"
+#include <dcpclient/deviceserver.h>
 #include <QObject>
 #include <QByteArray>
 #include <QMap>
+#include <QHash>
+#include <QPair>
+#include <QQueue>
+#include <QElapsedTimer>
 #include <QTextStream>
 #include <QHostAddress>
 
 class QTcpServer;
 class QTcpSocket;
-class DcpPacket;
+class QTimer;
+class QSocketNotifier;
+class PacketLogger;
 
-namespace Dcp {
-    class Message;
-}
-
-class DcpHub : public QObject
+class DcpHub : public QObject, public Dcp::ReplySink
 {
     Q_OBJECT
 
@@ -58,50 +65,227 @@ public:
 
     bool listen(const QHostAddress &address = QHostAddress::Any,
                 quint16 port = 2001);
+    bool takeOver(const QString &path);
     void close();
 
+    bool startHandoffServer(const QString &path);
+    void addPeer(const QString &host, quint16 port = 2001);
+    void allowPeer(const QHostAddress &address);
+    bool setGroup(const QByteArray &name, const QList<QByteArray> &members);
+
     QByteArray deviceName() const { return m_serverDeviceName; }
     bool setDeviceName(const QByteArray &name);
 
     DebugFlags debugFlags() const { return m_debugFlags; }
     void setDebugFlags(DebugFlags mode) { m_debugFlags = mode; }
 
+    int schedulerQuantum() const { return m_schedQuantum; }
+    void setSchedulerQuantum(int bytes);
+    int schedulerBudget() const { return m_schedBudget; }
+    void setSchedulerBudget(int packets);
+
+    bool startRecording(const QString &dirName, int segmentCount,
+                        qint64 segmentSize);
+    void stopRecording();
+
+signals:
+    void handedOver();
+
 protected slots:
     void newConnection();
     void socketDisconnected();
     void socketReadyRead();
+    void processReadySockets();
+    void processDelayedPackets();
+    void handoffRequested();
+    void connectPeers();
+    void peerConnected();
+
+    // commands sent to the hub device, see handleCommand()
+    void getDevList(Dcp::DeviceRequest *request);
+    void getDevInfo(Dcp::DeviceRequest *request);
+    void getRateLimit(Dcp::DeviceRequest *request);
+    void getRateStats(Dcp::DeviceRequest *request);
+    void getGroup(Dcp::DeviceRequest *request);
+    void getSubscriptions(Dcp::DeviceRequest *request);
+    void getDebug(Dcp::DeviceRequest *request);
+    void getCapture(Dcp::DeviceRequest *request);
+    void getLogStats(Dcp::DeviceRequest *request);
+    void getVersion(Dcp::DeviceRequest *request);
+    void getQtVersion(Dcp::DeviceRequest *request);
+    void getEcho(Dcp::DeviceRequest *request);
+    void setNop(Dcp::DeviceRequest *request);
+    void setSubscribe(Dcp::DeviceRequest *request);
+    void setDebug(Dcp::DeviceRequest *request);
+    void setCapture(Dcp::DeviceRequest *request);
+    void setGroupMembers(Dcp::DeviceRequest *request);
+    void setRateLimit(Dcp::DeviceRequest *request);
 
 protected:
+    void initSocket(QTcpSocket *socket);
+    quint32 nextPacketSize(QTcpSocket *socket) const;
     bool readNextPacket(QTcpSocket *socket, DcpPacket *packet);
+    bool handlePacket(QTcpSocket *socket, const DcpPacket &packet);
+    void scheduleSocket(QTcpSocket *socket);
+    bool handOver(HandoffChannel *channel, QString *errorString);
+    void restoreInput(QTcpSocket *socket, const QByteArray &input);
+    bool readHandoffPacket(QTcpSocket *socket, DcpPacket *packet);
     bool registerDeviceName(QTcpSocket *socket, const QByteArray &name);
-    void processPacket(const DcpPacket &packet);
+    bool handleNameRequest(QTcpSocket *socket, const DcpPacket &packet);
+    bool processPacket(QTcpSocket *socket, const DcpPacket &packet);
+    void routePacket(quint32 connectionId, const DcpPacket &packet,
+                     bool fromPeer = false);
+    bool handlePeerControl(QTcpSocket *socket, const DcpPacket &packet);
+    bool isAllowedPeer(const QHostAddress &address) const;
+    void sendPeerHello(QTcpSocket *socket);
+    void sendPeerDevices(QTcpSocket *socket, char op,
+                         const QList<QByteArray> &keys);
+    void notifyPeers(char op, const QList<QByteArray> &keys);
+    bool addRemoteDevice(QTcpSocket *socket, const QByteArray &key);
+    bool removeRemoteDevice(QTcpSocket *socket, const QByteArray &key);
+    void devicesChanged(char op, const QList<QByteArray> &keys, bool local);
+    bool handleSubscription(QTcpSocket *socket, const QByteArray &subscriber,
+                            const QByteArray &publisher,
+                            const QByteArray &identifier, bool subscribe);
+    void publishUpdate(const DcpPacket &packet, bool fromPeer);
+    void fanOut(const QList<QByteArray> &devices, const QByteArray &data,
+                bool fromPeer);
+    bool routeToPattern(const QByteArray &pattern, const QByteArray &data,
+                        bool fromPeer);
+    void sendSubscription(const QByteArray &publisher, const char *command,
+                          const QByteArray &identifier);
+    void resubscribe(const QByteArray &publisher);
+    void removeSubscriber(const QByteArray &subscriber);
+    void queueWrite(QTcpSocket *socket, const QByteArray &data);
+    void flushWrites();
+    void writeBuffers(QTcpSocket *socket, const QList<QByteArray> &buffers);
     void sendMessage(QTcpSocket *socket, const Dcp::Message &msg);
+    void sendMessage(const QList<QByteArray> &devices,
+                     const Dcp::Message &msg);
+    QByteArray packetData(const Dcp::Message &msg) const;
     void handleCommand(const Dcp::Message &msg);
+    QTcpSocket * commandSocket(const Dcp::Message &msg) const;
+    void sendAck(const Dcp::Message &command, int errorCode);
+    void sendReply(const Dcp::Message &command, const QByteArray &data,
+                   int errorCode);
 
     QString ts() const;
     bool isNullDeviceName(const QByteArray &name) const;
     bool isServerDeviceName(const QByteArray &name) const;
-    QList<QByteArray> deviceList(bool percentEncoded);
+    QList<QByteArray> deviceList(bool percentEncoded,
+                                 bool includeRemote = false);
+    QByteArray deviceListSnapshot();
+
+    // source and destination device of a pair limit
+    typedef QPair<QByteArray, QByteArray> PairKey;
 
     struct ClientInfo {
+        ClientInfo()
+            : port(0), connectionId(0), deficit(0), scheduled(false),
+              flushPending(false),
+              isPeer(false), peerHelloSent(false), limitsVersion(-1),
+              passedCount(0), delayedCount(0), droppedCount(0) {}
+
         QByteArray device;
+        QList<QByteArray> aliases;  // additional device names
         QHostAddress address;
         quint16 port;
+        quint32 connectionId;
+        int deficit;     // DRR deficit counter in bytes
+        bool scheduled;  // socket is in m_readyQueue
+
+        // outgoing packets, written by flushWrites()
+        QList<QByteArray> writeQueue;
+        bool flushPending;  // socket is in m_flushSockets
+
+        // link to another hub, see addPeer()
+        bool isPeer;
+        bool peerHelloSent;
+        QByteArray peerName;
+        QList<QByteArray> remoteDevices;  // devices announced by the peer
+
+        // rate limits, resolved from m_deviceLimits and m_pairLimits
+        int limitsVersion;
+        RateLimitState deviceLimit;
+        QHash<PairKey, RateLimitState> pairLimits;
+        QQueue<DcpPacket> delayedPackets;
+        QByteArray handoffBuffer;  // partial packet read by the previous hub
+        qulonglong passedCount;
+        qulonglong delayedCount;
+        qulonglong droppedCount;
     };
 
     typedef QMap<QTcpSocket *, ClientInfo> SocketMap;
     typedef QMap<QByteArray, QTcpSocket *> DeviceMap;
+    typedef QMap<QByteArray, RateLimit> DeviceLimitMap;
+    typedef QPair<QString, quint16> PeerAddress;
+    typedef QPair<QByteArray, QByteArray> SubscriptionKey;
+    typedef QMap<SubscriptionKey, QList<QByteArray> > SubscriptionMap;
+    typedef QMap<QByteArray, QList<QByteArray> > GroupMap;
+
+    // connections serving the devices matched by a destination pattern
+    struct PatternMatch {
+        QList<QTcpSocket *> local;
+        QList<QTcpSocket *> peers;
+    };
+    typedef QHash<QByteArray, PatternMatch> PatternCache;
+    typedef QMap<PairKey, RateLimit> PairLimitMap;
+
+    bool checkRateLimit(ClientInfo &ci, const DcpPacket &packet,
+                        RateLimit::Action *action, int *waitMsecs);
+    void startRateTimer(int msecs);
+    RateLimit deviceLimit(const QByteArray &device) const;
+    RateLimit peerLimit(const QByteArray &peerName) const;
+    RateLimit pairLimit(const QByteArray &source,
+                        const QByteArray &destination) const;
+    QList<QByteArray> rateLimitList(const QByteArray &source,
+                                    const QByteArray &destination) const;
+    void logPacket(const QByteArray &data);
+    bool parseCaptureFilter(const QList<QByteArray> &args,
+                            CaptureFilter *filter) const;
+    QList<QByteArray> captureFilterArgs() const;
 
 private:
     Q_DISABLE_COPY(DcpHub)
     QTextStream cout, cerr;
-    HexFormatter hexfmt;
+    PacketLogger * const m_logger;
+    CaptureFilter m_captureFilter;
+    FlightRecorder m_recorder;
+    QString m_recordDir;  // recording parameters, see startRecording()
+    int m_recordSegmentCount;
+    qint64 m_recordSegmentSize;
+    quint32 m_nextConnectionId;
     QTcpServer * const m_tcpServer;
     SocketMap m_socketMap;
     DeviceMap m_deviceMap;
+    QQueue<QTcpSocket *> m_readyQueue;
+    QTimer * const m_schedTimer;
+    int m_schedQuantum;
+    int m_schedBudget;
+    QList<QTcpSocket *> m_flushSockets;
+    DeviceLimitMap m_deviceLimits;
+    PairLimitMap m_pairLimits;
+    int m_limitsVersion;
+    QList<QTcpSocket *> m_delayedSockets;
+    QTimer * const m_rateTimer;
+    qint64 m_rateTimerDue;
+    QElapsedTimer m_clock;
+    HandoffChannel m_handoffServer;
+    QSocketNotifier *m_handoffNotifier;
+    QString m_handoffPath;
+    DeviceMap m_remoteDevices;  // devices of peer hubs, by peer socket
+    QMap<PeerAddress, QTcpSocket *> m_peerLinks;  // outgoing peer links
+    QList<QHostAddress> m_allowedPeers;  // addresses of incoming peer links
+    QTimer * const m_peerTimer;
+    SubscriptionMap m_subscriptions;  // subscribers by device and parameter
+    GroupMap m_groups;  // members by group name
+    PatternCache m_patternCache;  // cleared when the devices change
+    QByteArray m_deviceListSnapshot;  // encoded reply to get devlist
+    bool m_deviceListValid;
     QByteArray m_serverDeviceName;
     bool m_printTimestamp;
     DebugFlags m_debugFlags;
+    Dcp::DeviceServer * const m_commandServer;
 };
 
 #endif // DCPHUB_H
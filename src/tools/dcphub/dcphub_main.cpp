@@ -51,8 +51,38 @@ int main(int argc, char **argv)
     DcpHub dcpHub;
     dcpHub.setDeviceName(opts.deviceName);
     dcpHub.setDebugFlags(opts.debugFlags);
-    if (!dcpHub.listen(opts.address, opts.port))
+    if (!opts.takeOverPath.isEmpty()) {
+        if (!dcpHub.takeOver(opts.takeOverPath))
+            return 1;
+    }
+    else if (!dcpHub.listen(opts.address, opts.port))
         return 1;
 
+    // start recording after a takeover, when the old hub has stopped
+    if (!opts.recordDir.isEmpty() &&
+            !dcpHub.startRecording(opts.recordDir, opts.recordSegments,
+                                   qint64(opts.recordSegmentSize) << 20))
+        return 1;
+    if (!opts.handoffPath.isEmpty() &&
+            !dcpHub.startHandoffServer(opts.handoffPath))
+        return 1;
+
+    // groups given on the command line replace groups of a previous hub; a
+    // failure must not drop the connections that have been taken over
+    for (int i = 0; i < opts.groupNames.size(); ++i) {
+        if (!dcpHub.setGroup(opts.groupNames[i], opts.groupMembers[i])) {
+            QTextStream cerr(stderr, QIODevice::WriteOnly);
+            cerr << "Warning: Cannot define group \""
+                 << QString::fromLatin1(opts.groupNames[i]) << "\"." << endl;
+        }
+    }
+    foreach (const QHostAddress &address, opts.allowedPeers)
+        dcpHub.allowPeer(address);
+    for (int i = 0; i < opts.peerHosts.size(); ++i)
+        dcpHub.addPeer(opts.peerHosts[i], opts.peerPorts[i]);
+
+    // exit after the connections have been handed over to a new process
+    QObject::connect(&dcpHub, SIGNAL(handedOver()), &app, SLOT(quit()));
+
     return app.exec();
 }
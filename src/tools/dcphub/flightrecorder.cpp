@@ -0,0 +1,292 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "flightrecorder.h"
+#include "dcppacket.h"
+#include <QDir>
+#include <QDateTime>
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <string.h>
+#endif
+
+FlightRecorder::FlightRecorder()
+    : m_segmentCount(0),
+      m_segmentSize(0),
+      m_segmentIndex(-1),
+      m_sequence(0),
+      m_map(0),
+      m_header(0),
+      m_index(0),
+      m_writePos(0),
+      m_epoch(0)
+{
+}
+
+FlightRecorder::~FlightRecorder()
+{
+    close();
+}
+
+/*
+    Opens a recording in the given directory. Existing segments are reused;
+    recording continues after the segment with the highest sequence number.
+ */
+bool FlightRecorder::open(const QString &dirName, int segmentCount,
+                          qint64 segmentSize)
+{
+    close();
+
+    if (segmentCount < 2 || segmentSize < (1 << 20) ||
+            segmentSize > Q_INT64_C(0xffffffff)) {
+        m_errorString = "Invalid segment count or size";
+        return false;
+    }
+
+    QDir dir(dirName);
+    if (!dir.exists() && !dir.mkpath(".")) {
+        m_errorString = QString("Cannot create directory %1").arg(dirName);
+        return false;
+    }
+
+    m_dirName = dirName;
+    m_segmentCount = segmentCount;
+    m_segmentSize = segmentSize;
+
+    // find the most recent segment
+    int lastIndex = -1;
+    m_sequence = 0;
+    for (int i = 0; i < segmentCount; ++i) {
+        QFile file(segmentFileName(i));
+        if (!file.open(QIODevice::ReadOnly))
+            continue;
+        RecordSegmentHeader header;
+        if (file.read(reinterpret_cast<char *>(&header), sizeof(header))
+                != qint64(sizeof(header)))
+            continue;
+        if (std::memcmp(header.magic, RecordMagic, sizeof(RecordMagic)))
+            continue;
+        if (header.sequence >= m_sequence) {
+            m_sequence = header.sequence + 1;
+            lastIndex = i;
+        }
+    }
+
+    // timestamps are taken from a monotonic clock, starting at the current
+    // wall clock time
+    m_epoch = QDateTime::currentMSecsSinceEpoch() * Q_INT64_C(1000000);
+    m_clock.start();
+
+    return openSegment((lastIndex + 1) % segmentCount);
+}
+
+void FlightRecorder::close()
+{
+    closeSegment();
+    m_segmentIndex = -1;
+}
+
+/*
+    Appends a packet to the current segment; switches to the next segment if
+    the current one is full.
+ */
+void FlightRecorder::record(quint32 connectionId, const QByteArray &packet)
+{
+    if (!m_map)
+        return;
+
+    const quint32 packetSize = packet.size();
+    const quint32 size = recordSize(packetSize);
+    if (m_writePos + size > quint64(m_segmentSize)) {
+        if (!openSegment((m_segmentIndex + 1) % m_segmentCount)) {
+            qWarning("Flight recorder stopped: %s",
+                     qPrintable(m_errorString));
+            return;
+        }
+        if (m_writePos + size > quint64(m_segmentSize))
+            return;
+    }
+
+#if QT_VERSION >= QT_VERSION_CHECK(4, 8, 0)
+    const qint64 timestamp = m_epoch + m_clock.nsecsElapsed();
+#else
+    const qint64 timestamp = m_epoch + m_clock.elapsed() * Q_INT64_C(1000000);
+#endif
+    RecordHeader *rec = reinterpret_cast<RecordHeader *>(m_map + m_writePos);
+    rec->packetSize = packetSize;
+    rec->connectionId = connectionId;
+    rec->timestamp = timestamp;
+    std::memcpy(m_map + m_writePos + sizeof(RecordHeader),
+                packet.constData(), packetSize);
+
+    // update the index of the block in which the record starts
+    RecordBlockIndex &block =
+            m_index[(m_writePos - m_header->dataStart) / RecordBlockSize];
+    if (block.recordCount == 0) {
+        block.firstTimestamp = timestamp;
+        block.firstRecord = m_writePos;
+    }
+    block.lastTimestamp = timestamp;
+    block.recordCount++;
+    if (packetSize >= quint32(FullHeaderSize)) {
+        const char *msgHeader = packet.constData() + PacketHeaderSize;
+        quint16 flags = qFromBigEndian(*reinterpret_cast<const quint16 *>(
+            msgHeader + MessageFlagsPos));
+        block.flags |= flags;
+        recordDeviceBits(msgHeader + MessageSourcePos, block.deviceFilter);
+        recordDeviceBits(msgHeader + MessageDestinationPos,
+                         block.deviceFilter);
+
+        int errorCode;
+        if ((flags & DcpPacket::ReplyFlag) &&
+                recordReplyErrorCode(packet.constData() + FullHeaderSize,
+                                     packetSize - FullHeaderSize, &errorCode) &&
+                errorCode > 0)
+            block.flags |= BlockHasErrorReplies;
+    }
+
+    // the record is published by updating the segment header
+    m_writePos += size;
+    if (m_header->recordCount == 0)
+        m_header->firstTimestamp = timestamp;
+    m_header->lastTimestamp = timestamp;
+    m_header->recordCount++;
+    m_header->dataEnd = m_writePos;
+}
+
+// Allocates the blocks of the open segment file. posix_fallocate() is only
+// used on Linux, other platforms write the whole segment with zeros.
+bool FlightRecorder::reserveSegment()
+{
+#ifdef Q_OS_LINUX
+    int err = posix_fallocate(m_file.handle(), 0, m_segmentSize);
+    if (err != 0) {
+        m_errorString = QString("Cannot allocate segment %1: %2")
+                .arg(m_file.fileName()).arg(QString::fromLocal8Bit(
+                                                strerror(err)));
+        return false;
+    }
+    return true;
+#else
+    const QByteArray zeros(64 * 1024, '\0');
+    if (!m_file.seek(0)) {
+        m_errorString = QString("Cannot allocate segment %1: %2")
+                .arg(m_file.fileName()).arg(m_file.errorString());
+        return false;
+    }
+    qint64 remaining = m_segmentSize;
+    while (remaining > 0) {
+        qint64 n = qMin(remaining, qint64(zeros.size()));
+        if (m_file.write(zeros.constData(), n) != n) {
+            m_errorString = QString("Cannot allocate segment %1: %2")
+                    .arg(m_file.fileName()).arg(m_file.errorString());
+            return false;
+        }
+        remaining -= n;
+    }
+    if (!m_file.flush()) {
+        m_errorString = QString("Cannot allocate segment %1: %2")
+                .arg(m_file.fileName()).arg(m_file.errorString());
+        return false;
+    }
+    return true;
+#endif
+}
+
+QString FlightRecorder::segmentFileName(int index) const
+{
+    return QDir(m_dirName).filePath(
+                QString("segment-%1.dcprec").arg(index, 3, 10, QChar('0')));
+}
+
+bool FlightRecorder::openSegment(int index)
+{
+    closeSegment();
+
+    m_file.setFileName(segmentFileName(index));
+    if (!m_file.open(QIODevice::ReadWrite) ||
+            !m_file.resize(m_segmentSize)) {
+        m_errorString = QString("Cannot open segment %1: %2")
+                .arg(m_file.fileName()).arg(m_file.errorString());
+        m_file.close();
+        return false;
+    }
+
+    // Reserve all blocks of the segment before it is mapped. Writing to a
+    // page of a sparse file raises SIGBUS if the disk is full, while a
+    // failing reservation only stops the recording.
+    if (!reserveSegment()) {
+        m_file.close();
+        return false;
+    }
+
+    m_map = m_file.map(0, m_segmentSize);
+    if (!m_map) {
+        m_errorString = QString("Cannot map segment %1: %2")
+                .arg(m_file.fileName()).arg(m_file.errorString());
+        m_file.close();
+        return false;
+    }
+
+    // the block index follows the header and covers the rest of the segment
+    const quint32 headerSize = sizeof(RecordSegmentHeader);
+    const quint32 blockCount = quint32(
+        (m_segmentSize - headerSize + RecordBlockSize - 1) / RecordBlockSize);
+    const quint32 dataStart =
+        (headerSize + blockCount * sizeof(RecordBlockIndex) +
+         RecordAlignment - 1) & ~quint32(RecordAlignment - 1);
+
+    // the magic is written last, so that readers never see a partially
+    // initialized segment header
+    m_header = reinterpret_cast<RecordSegmentHeader *>(m_map);
+    m_index = reinterpret_cast<RecordBlockIndex *>(m_map + headerSize);
+    std::memset(m_map, 0, dataStart);
+    m_header->version = RecordFormatVersion;
+    m_header->headerSize = headerSize;
+    m_header->sequence = m_sequence++;
+    m_header->segmentSize = m_segmentSize;
+    m_header->dataEnd = dataStart;
+    m_header->blockCount = blockCount;
+    m_header->dataStart = dataStart;
+    std::memcpy(m_header->magic, RecordMagic, sizeof(RecordMagic));
+
+    m_segmentIndex = index;
+    m_writePos = dataStart;
+    return true;
+}
+
+void FlightRecorder::closeSegment()
+{
+    if (m_map) {
+        m_file.unmap(m_map);
+        m_map = 0;
+        m_header = 0;
+        m_index = 0;
+    }
+    if (m_file.isOpen())
+        m_file.close();
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DCPHUB_FLIGHTRECORDER_H
+#define DCPHUB_FLIGHTRECORDER_H
+
+#include "recordformat.h"
+#include <QtGlobal>
+#include <QByteArray>
+#include <QString>
+#include <QFile>
+#include <QElapsedTimer>
+
+// Appends packets to memory mapped segment files. Recording does not need
+// any locks or system calls, except when switching to the next segment.
+class FlightRecorder
+{
+public:
+    FlightRecorder();
+    ~FlightRecorder();
+
+    bool open(const QString &dirName, int segmentCount, qint64 segmentSize);
+    void close();
+    bool isOpen() const { return m_map != 0; }
+    QString errorString() const { return m_errorString; }
+
+    void record(quint32 connectionId, const QByteArray &packet);
+
+private:
+    Q_DISABLE_COPY(FlightRecorder)
+    QString segmentFileName(int index) const;
+    bool openSegment(int index);
+    bool reserveSegment();
+    void closeSegment();
+
+    QString m_dirName;
+    int m_segmentCount;
+    qint64 m_segmentSize;
+    int m_segmentIndex;
+    quint64 m_sequence;
+    QFile m_file;
+    uchar *m_map;
+    RecordSegmentHeader *m_header;
+    RecordBlockIndex *m_index;
+    quint32 m_writePos;
+    qint64 m_epoch;
+    QElapsedTimer m_clock;
+    QString m_errorString;
+};
+
+#endif // DCPHUB_FLIGHTRECORDER_H
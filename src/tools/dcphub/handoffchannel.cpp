@@ -0,0 +1,362 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "handoffchannel.h"
+#include <QtEndian>
+#include <QFile>
+
+#ifdef Q_OS_UNIX
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
+enum {
+    ChannelTimeout = 10,        // seconds
+    MaxRecordSize = 64 << 20
+};
+
+HandoffChannel::HandoffChannel()
+    : m_fd(-1)
+{
+}
+
+HandoffChannel::~HandoffChannel()
+{
+    close();
+}
+
+void HandoffChannel::close()
+{
+#ifdef Q_OS_UNIX
+    if (m_fd != -1)
+        ::close(m_fd);
+    if (!m_path.isEmpty())
+        ::unlink(QFile::encodeName(m_path).constData());
+#endif
+    m_fd = -1;
+    m_path.clear();
+}
+
+bool HandoffChannel::setError(const QString &what)
+{
+#ifdef Q_OS_UNIX
+    m_errorString = what + ": " + QString::fromLocal8Bit(strerror(errno));
+#else
+    m_errorString = what;
+#endif
+    return false;
+}
+
+#ifdef Q_OS_UNIX
+
+static bool makeAddress(const QString &path, sockaddr_un *addr)
+{
+    QByteArray name = QFile::encodeName(path);
+    if (name.size() >= int(sizeof(addr->sun_path)))
+        return false;
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path, name.constData(), name.size());
+    return true;
+}
+
+bool HandoffChannel::listen(const QString &path)
+{
+    close();
+    sockaddr_un addr;
+    if (!makeAddress(path, &addr)) {
+        m_errorString = "Socket path too long";
+        return false;
+    }
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+        return setError("Cannot create socket");
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    // remove a stale socket file of a previous process
+    ::unlink(addr.sun_path);
+    if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1
+            || ::listen(fd, 1) == -1) {
+        setError("Cannot listen on " + path);
+        ::close(fd);
+        return false;
+    }
+
+    m_fd = fd;
+    m_path = path;
+    return true;
+}
+
+bool HandoffChannel::accept(HandoffChannel *channel)
+{
+    Q_ASSERT(channel);
+    channel->close();
+
+    int fd;
+    do {
+        fd = ::accept(m_fd, 0, 0);
+    } while (fd == -1 && errno == EINTR);
+    if (fd == -1)
+        return setError("Cannot accept connection");
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    channel->m_fd = fd;
+    channel->setTimeout(ChannelTimeout);
+    return true;
+}
+
+bool HandoffChannel::connectTo(const QString &path)
+{
+    close();
+    sockaddr_un addr;
+    if (!makeAddress(path, &addr)) {
+        m_errorString = "Socket path too long";
+        return false;
+    }
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+        return setError("Cannot create socket");
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&addr),
+                  sizeof(addr)) == -1) {
+        setError("Cannot connect to " + path);
+        ::close(fd);
+        return false;
+    }
+
+    m_fd = fd;
+    setTimeout(ChannelTimeout);
+    return true;
+}
+
+void HandoffChannel::setTimeout(int secs)
+{
+    timeval tv;
+    tv.tv_sec = secs;
+    tv.tv_usec = 0;
+    ::setsockopt(m_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    ::setsockopt(m_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+bool HandoffChannel::readFully(char *buf, int size)
+{
+    while (size > 0) {
+        ssize_t n = ::recv(m_fd, buf, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            if (n == 0)
+                errno = ECONNRESET;
+            return setError("Cannot receive record");
+        }
+        buf += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool HandoffChannel::writeFully(const char *buf, int size)
+{
+    while (size > 0) {
+#ifdef MSG_NOSIGNAL
+        ssize_t n = ::send(m_fd, buf, size, MSG_NOSIGNAL);
+#else
+        ssize_t n = ::send(m_fd, buf, size, 0);
+#endif
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return setError("Cannot send record");
+        buf += n;
+        size -= n;
+    }
+    return true;
+}
+
+/*
+    Sends a record, optionally passing the file descriptor passFd. The
+    descriptor is attached to the first byte of the record's length prefix.
+ */
+bool HandoffChannel::send(const QByteArray &data, int passFd)
+{
+    if (m_fd == -1) {
+        m_errorString = "Channel is not open";
+        return false;
+    }
+
+    quint32 size = qToBigEndian(quint32(data.size()));
+    char sizeBuf[4];
+    memcpy(sizeBuf, &size, 4);
+
+    iovec iov[2];
+    iov[0].iov_base = sizeBuf;
+    iov[0].iov_len = 4;
+    iov[1].iov_base = const_cast<char *>(data.constData());
+    iov[1].iov_len = data.size();
+
+    union {
+        cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = iov;
+    mh.msg_iovlen = 2;
+    if (passFd != -1) {
+        memset(&control, 0, sizeof(control));
+        mh.msg_control = control.buf;
+        mh.msg_controllen = sizeof(control.buf);
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &passFd, sizeof(int));
+    }
+
+    ssize_t n;
+    do {
+#ifdef MSG_NOSIGNAL
+        n = ::sendmsg(m_fd, &mh, MSG_NOSIGNAL);
+#else
+        n = ::sendmsg(m_fd, &mh, 0);
+#endif
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+        return setError("Cannot send record");
+
+    // the rest of a partially sent record has no ancillary data
+    int total = 4 + data.size();
+    if (n < 4 && !writeFully(sizeBuf + n, 4 - int(n)))
+        return false;
+    int sent = qMax(int(n) - 4, 0);
+    return n >= total || writeFully(data.constData() + sent,
+                                    data.size() - sent);
+}
+
+/*
+    Receives a record. If passedFd is not null, it is set to the file
+    descriptor passed with the record, or -1 if there was none.
+ */
+bool HandoffChannel::receive(QByteArray *data, int *passedFd)
+{
+    Q_ASSERT(data);
+    if (passedFd)
+        *passedFd = -1;
+    if (m_fd == -1) {
+        m_errorString = "Channel is not open";
+        return false;
+    }
+
+    char sizeBuf[4];
+    iovec iov;
+    iov.iov_base = sizeBuf;
+    iov.iov_len = 4;
+
+    union {
+        cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control.buf;
+    mh.msg_controllen = sizeof(control.buf);
+
+    ssize_t n;
+    do {
+        n = ::recvmsg(m_fd, &mh, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        if (n == 0)
+            errno = ECONNRESET;
+        return setError("Cannot receive record");
+    }
+
+    int fd = -1;
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&mh); cmsg;
+         cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    if (fd != -1) {
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+        if (passedFd)
+            *passedFd = fd;
+        else
+            ::close(fd);
+    }
+
+    if (n < 4 && !readFully(sizeBuf + n, 4 - int(n)))
+        return false;
+    quint32 size;
+    memcpy(&size, sizeBuf, 4);
+    size = qFromBigEndian(size);
+    if (size > quint32(MaxRecordSize)) {
+        m_errorString = "Invalid record size";
+        return false;
+    }
+
+    data->resize(int(size));
+    return readFully(data->data(), int(size));
+}
+
+#else // Q_OS_UNIX
+
+bool HandoffChannel::listen(const QString &)
+{
+    m_errorString = "Connection handoff is not supported on this platform";
+    return false;
+}
+
+bool HandoffChannel::accept(HandoffChannel *)
+{
+    return false;
+}
+
+bool HandoffChannel::connectTo(const QString &)
+{
+    m_errorString = "Connection handoff is not supported on this platform";
+    return false;
+}
+
+void HandoffChannel::setTimeout(int) {}
+bool HandoffChannel::readFully(char *, int) { return false; }
+bool HandoffChannel::writeFully(const char *, int) { return false; }
+bool HandoffChannel::send(const QByteArray &, int) { return false; }
+bool HandoffChannel::receive(QByteArray *, int *) { return false; }
+
+#endif // Q_OS_UNIX
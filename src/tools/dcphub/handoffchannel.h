@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DCPHUB_HANDOFFCHANNEL_H
+#define DCPHUB_HANDOFFCHANNEL_H
+
+#include <QtGlobal>
+#include <QByteArray>
+#include <QString>
+
+// Unix domain socket that transfers length prefixed records, each of which
+// may carry a file descriptor (SCM_RIGHTS). Used to hand over the listening
+// socket and all connections of a running hub to a new hub process. All
+// operations are blocking, with a timeout on connected channels.
+class HandoffChannel
+{
+public:
+    HandoffChannel();
+    ~HandoffChannel();
+
+    bool listen(const QString &path);
+    bool accept(HandoffChannel *channel);
+    bool connectTo(const QString &path);
+    void close();
+
+    bool isOpen() const { return m_fd != -1; }
+    int descriptor() const { return m_fd; }
+    QString errorString() const { return m_errorString; }
+
+    bool send(const QByteArray &data, int passFd = -1);
+    bool receive(QByteArray *data, int *passedFd = 0);
+
+private:
+    Q_DISABLE_COPY(HandoffChannel)
+    bool setError(const QString &what);
+    void setTimeout(int secs);
+    bool readFully(char *buf, int size);
+    bool writeFully(const char *buf, int size);
+
+    int m_fd;
+    QString m_path;  // socket file of a listening channel
+    QString m_errorString;
+};
+
+#endif // DCPHUB_HANDOFFCHANNEL_H
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "packetlogger.h"
+#include "dcppacket.h"
+#include "hexformatter.h"
+#include <dcpclient/message.h>
+#include <QTextStream>
+#include <cstring>
+#include <cstdio>
+
+// The ring size is a power of two, so that ring positions can be masked.
+static int ringSize(int capacity)
+{
+    int size = 64;
+    while (size < capacity && size < 0x40000000)
+        size <<= 1;
+    return size;
+}
+
+PacketLogger::PacketLogger(int capacity, QObject *parent)
+    : QThread(parent),
+      m_ring(ringSize(capacity), '\0'),
+      m_buffer(m_ring.data()),
+      m_mask(quint32(m_ring.size()) - 1)
+{
+}
+
+PacketLogger::~PacketLogger()
+{
+    stop();
+}
+
+void PacketLogger::stop()
+{
+    if (!isRunning())
+        return;
+    m_quit.fetchAndStoreRelease(1);
+    m_mutex.lock();
+    m_wakeUp.wakeOne();
+    m_mutex.unlock();
+    wait();
+}
+
+/*
+    Copies the packet into the ring buffer. This function is called from the
+    hub's thread; it does not block and returns false if the packet was
+    dropped because the ring buffer is full.
+ */
+bool PacketLogger::log(const QByteArray &packet, int flags)
+{
+    const quint32 capacity = m_mask + 1;
+    const quint32 dataSize = packet.size();
+    const quint32 recSize = (RecordHeaderSize + dataSize + RecordAlignment - 1)
+            & ~quint32(RecordAlignment - 1);
+
+    // only the producer writes m_head
+    const quint32 head = quint32(m_head.fetchAndAddRelaxed(0));
+    const quint32 tail = quint32(m_tail.fetchAndAddAcquire(0));
+    if (recSize > capacity - (head - tail)) {
+        m_dropped.fetchAndAddRelaxed(1);
+        return false;
+    }
+
+    quint32 header[2] = { dataSize, quint32(flags) };
+    copyToRing(head, reinterpret_cast<const char *>(header),
+               RecordHeaderSize);
+    copyToRing(head + RecordHeaderSize, packet.constData(), dataSize);
+    m_head.fetchAndStoreRelease(int(head + recSize));
+
+    // wake up the logger thread if it is waiting for data
+    if (m_sleeping.testAndSetOrdered(1, 0)) {
+        m_mutex.lock();
+        m_wakeUp.wakeOne();
+        m_mutex.unlock();
+    }
+    return true;
+}
+
+/*
+    Returns the total number of packets that were dropped.
+ */
+int PacketLogger::droppedCount() const
+{
+    return const_cast<QAtomicInt &>(m_droppedTotal).fetchAndAddRelaxed(0) +
+           const_cast<QAtomicInt &>(m_dropped).fetchAndAddRelaxed(0);
+}
+
+void PacketLogger::run()
+{
+    QTextStream out(stdout, QIODevice::WriteOnly);
+    HexFormatter hexfmt(16, HexFormatter::ShowPosition | HexFormatter::ShowText,
+                        '.');
+    QByteArray data;
+
+    for (;;)
+    {
+        const quint32 head = quint32(m_head.fetchAndAddAcquire(0));
+        quint32 tail = quint32(m_tail.fetchAndAddRelaxed(0));
+
+        if (head == tail) {
+            if (m_quit.fetchAndAddAcquire(0))
+                break;
+
+            // the timeout covers a wake up that was missed between setting
+            // m_sleeping and waiting
+            m_mutex.lock();
+            m_sleeping.fetchAndStoreOrdered(1);
+            if (quint32(m_head.fetchAndAddAcquire(0)) == tail)
+                m_wakeUp.wait(&m_mutex, 100);
+            m_sleeping.fetchAndStoreOrdered(0);
+            m_mutex.unlock();
+            continue;
+        }
+
+        // format a batch of records and write them at once
+        for (int n = 0; n < MaxBatchSize && tail != head; ++n)
+        {
+            quint32 header[2];
+            copyFromRing(tail, reinterpret_cast<char *>(header),
+                         RecordHeaderSize);
+            const quint32 dataSize = header[0];
+            const int flags = int(header[1]);
+            data.resize(int(dataSize));
+            copyFromRing(tail + RecordHeaderSize, data.data(), dataSize);
+
+            tail += (RecordHeaderSize + dataSize + RecordAlignment - 1)
+                    & ~quint32(RecordAlignment - 1);
+            m_tail.fetchAndStoreRelease(int(tail));
+
+            if (flags & LogMessage)
+                out << DcpPacket(data).message() << "\n";
+            if (flags & LogPacket)
+                out << hexfmt(data) << "\n";
+        }
+
+        const int dropped = m_dropped.fetchAndStoreRelaxed(0);
+        if (dropped > 0) {
+            m_droppedTotal.fetchAndAddRelaxed(dropped);
+            out << "[" << dropped << " packet(s) not logged]\n";
+        }
+        out.flush();
+    }
+}
+
+void PacketLogger::copyToRing(quint32 pos, const char *data, quint32 size)
+{
+    char *ring = m_buffer;
+    const quint32 offset = pos & m_mask;
+    const quint32 n = qMin(size, m_mask + 1 - offset);
+    std::memcpy(ring + offset, data, n);
+    std::memcpy(ring, data + n, size - n);
+}
+
+void PacketLogger::copyFromRing(quint32 pos, char *data, quint32 size) const
+{
+    const char *ring = m_buffer;
+    const quint32 offset = pos & m_mask;
+    const quint32 n = qMin(size, m_mask + 1 - offset);
+    std::memcpy(data, ring + offset, n);
+    std::memcpy(data + n, ring, size - n);
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DCPHUB_PACKETLOGGER_H
+#define DCPHUB_PACKETLOGGER_H
+
+#include <QThread>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QByteArray>
+
+// Writes packet debug output from a background thread. Packets are copied
+// into a single-producer/single-consumer ring buffer by log(), which never
+// blocks; if the ring is full the packet is dropped and counted instead.
+class PacketLogger : public QThread
+{
+public:
+    enum LogFlags {
+        LogMessage = 0x01,
+        LogPacket = 0x02
+    };
+
+    explicit PacketLogger(int capacity = 4 << 20, QObject *parent = 0);
+    ~PacketLogger();
+
+    void stop();
+
+    bool log(const QByteArray &packet, int flags);
+    int droppedCount() const;
+
+protected:
+    void run();
+
+private:
+    Q_DISABLE_COPY(PacketLogger)
+    enum { RecordHeaderSize = 8, RecordAlignment = 8, MaxBatchSize = 256 };
+
+    void copyToRing(quint32 pos, const char *data, quint32 size);
+    void copyFromRing(quint32 pos, char *data, quint32 size) const;
+
+    QByteArray m_ring;
+    char * const m_buffer;
+    const quint32 m_mask;
+
+    // m_head is written by the producer, m_tail by the consumer
+    QAtomicInt m_head;
+    QAtomicInt m_tail;
+    QAtomicInt m_dropped;
+    QAtomicInt m_droppedTotal;
+    QAtomicInt m_sleeping;
+    QAtomicInt m_quit;
+    QMutex m_mutex;
+    QWaitCondition m_wakeUp;
+};
+
+#endif // DCPHUB_PACKETLOGGER_H
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "ratelimit.h"
+#include <QDataStream>
+#include <cmath>
+
+TokenBucket::TokenBucket()
+    : m_rate(0.0),
+      m_burst(1.0),
+      m_tokens(1.0),
+      m_lastUpdate(-1)
+{
+}
+
+TokenBucket::TokenBucket(double rate, double burst)
+    : m_rate(0.0),
+      m_burst(1.0),
+      m_tokens(1.0),
+      m_lastUpdate(-1)
+{
+    setRate(rate, burst);
+    m_tokens = m_burst;
+}
+
+void TokenBucket::setRate(double rate, double burst)
+{
+    m_rate = rate;
+    m_burst = burst < 1.0 ? 1.0 : burst;
+    if (m_tokens > m_burst)
+        m_tokens = m_burst;
+}
+
+bool TokenBucket::consume(qint64 now, double tokens)
+{
+    if (isUnlimited())
+        return true;
+    refill(now);
+    if (m_tokens < tokens)
+        return false;
+    m_tokens -= tokens;
+    return true;
+}
+
+int TokenBucket::msecsUntilAvailable(qint64 now, double tokens)
+{
+    if (isUnlimited())
+        return 0;
+    refill(now);
+    if (m_tokens >= tokens)
+        return 0;
+    return int(std::ceil((tokens - m_tokens) * 1000.0 / m_rate));
+}
+
+void TokenBucket::refill(qint64 now)
+{
+    if (m_lastUpdate >= 0 && now > m_lastUpdate) {
+        m_tokens += (now - m_lastUpdate) * m_rate / 1000.0;
+        if (m_tokens > m_burst)
+            m_tokens = m_burst;
+    }
+    m_lastUpdate = now;
+}
+
+bool RateLimit::parseAction(const QByteArray &name, Action *action)
+{
+    Q_ASSERT(action);
+    if (name == "delay")
+        *action = DelayAction;
+    else if (name == "drop")
+        *action = DropAction;
+    else if (name == "disconnect")
+        *action = DisconnectAction;
+    else
+        return false;
+    return true;
+}
+
+QByteArray RateLimit::actionName(Action action)
+{
+    switch (action) {
+    case DelayAction:
+        return "delay";
+    case DropAction:
+        return "drop";
+    case DisconnectAction:
+        return "disconnect";
+    }
+    return QByteArray();
+}
+
+QDataStream & operator<<(QDataStream &out, const RateLimit &limit)
+{
+    return out << limit.rate << limit.burst << qint32(limit.action);
+}
+
+QDataStream & operator>>(QDataStream &in, RateLimit &limit)
+{
+    qint32 action;
+    in >> limit.rate >> limit.burst >> action;
+    if (action < RateLimit::DelayAction || action > RateLimit::DisconnectAction)
+        in.setStatus(QDataStream::ReadCorruptData);
+    else
+        limit.action = RateLimit::Action(action);
+    return in;
+}
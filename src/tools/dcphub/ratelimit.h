@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DCPHUB_RATELIMIT_H
+#define DCPHUB_RATELIMIT_H
+
+#include <QtGlobal>
+#include <QByteArray>
+
+class QDataStream;
+
+// Token bucket (copied from dcpclient_p.h). The rate is given in tokens per
+// second, timestamps are monotonic times in milliseconds.
+class TokenBucket
+{
+public:
+    TokenBucket();
+    TokenBucket(double rate, double burst);
+
+    double rate() const { return m_rate; }
+    double burst() const { return m_burst; }
+    void setRate(double rate, double burst);
+    bool isUnlimited() const { return m_rate <= 0.0; }
+
+    bool consume(qint64 now, double tokens = 1.0);
+    int msecsUntilAvailable(qint64 now, double tokens = 1.0);
+
+private:
+    void refill(qint64 now);
+
+    double m_rate;
+    double m_burst;
+    double m_tokens;
+    qint64 m_lastUpdate;
+};
+
+struct RateLimit
+{
+    // ordered by severity
+    enum Action {
+        DelayAction,
+        DropAction,
+        DisconnectAction
+    };
+
+    RateLimit() : rate(0.0), burst(1.0), action(DelayAction) {}
+    RateLimit(double rate_, double burst_, Action action_)
+        : rate(rate_), burst(burst_), action(action_) {}
+
+    bool isNull() const { return rate <= 0.0; }
+
+    static bool parseAction(const QByteArray &name, Action *action);
+    static QByteArray actionName(Action action);
+
+    double rate;
+    double burst;
+    Action action;
+};
+
+// used to pass the configured limits on to a new hub process
+QDataStream & operator<<(QDataStream &out, const RateLimit &limit);
+QDataStream & operator>>(QDataStream &in, RateLimit &limit);
+
+// A configured rate limit together with its token bucket
+struct RateLimitState
+{
+    RateLimitState() {}
+    explicit RateLimitState(const RateLimit &limit_)
+        : limit(limit_), bucket(limit_.rate, limit_.burst) {}
+
+    RateLimit limit;
+    TokenBucket bucket;
+};
+
+#endif // DCPHUB_RATELIMIT_H
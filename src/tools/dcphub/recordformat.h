@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DCPHUB_RECORDFORMAT_H
+#define DCPHUB_RECORDFORMAT_H
+
+#include <QtGlobal>
+
+// On-disk format of the traffic recorded by DcpHub. A recording consists of
+// a fixed number of segment files, which are used as a ring; the segment
+// sequence numbers define the order of the segments. All values are stored
+// in host byte order.
+//
+// Each segment starts with a RecordSegmentHeader, followed by the block
+// index and the record data. The data area is divided into blocks of
+// RecordBlockSize bytes; a record belongs to the block in which it starts.
+// For each block the index contains the time range, the offset of the
+// first record, the union of the message flags and a Bloom filter of the
+// device names, which allows readers to skip blocks without touching them.
+
+enum {
+    RecordFormatVersion = 3,
+    RecordAlignment = 8,
+    RecordBlockSize = 0x10000,
+    RecordDeviceNameSize = 16,
+    RecordDeviceFilterWords = 8,  // 512 bit Bloom filter
+    RecordDeviceFilterHashes = 3
+};
+
+enum {
+    // bits 0..15 contain the message flags
+    BlockHasErrorReplies = 0x10000
+};
+
+struct RecordSegmentHeader
+{
+    char magic[8];          // "DCPREC\0\0"
+    quint32 version;
+    quint32 headerSize;
+    quint64 sequence;
+    quint64 segmentSize;
+    qint64 firstTimestamp;  // timestamp of the first record
+    qint64 lastTimestamp;   // timestamp of the last record
+    quint32 dataEnd;        // end of the last complete record
+    quint32 recordCount;
+    quint32 blockCount;     // number of entries in the block index
+    quint32 dataStart;      // offset of the first block
+};
+
+struct RecordBlockIndex
+{
+    qint64 firstTimestamp;
+    qint64 lastTimestamp;
+    quint32 firstRecord;    // offset of the first record in the block
+    quint32 recordCount;
+    quint32 flags;          // message flags and BlockHasErrorReplies
+    quint32 reserved;
+    quint64 deviceFilter[RecordDeviceFilterWords];  // see recordDeviceBits()
+};
+
+struct RecordHeader
+{
+    quint32 packetSize;     // size of the packet following the header
+    quint32 connectionId;   // source connection, 0 for the hub itself
+    qint64 timestamp;       // monotonic time in ns since the Unix epoch
+};
+
+static const char RecordMagic[8] = { 'D', 'C', 'P', 'R', 'E', 'C', 0, 0 };
+
+inline quint32 recordSize(quint32 packetSize) {
+    return (sizeof(RecordHeader) + packetSize + RecordAlignment - 1)
+            & ~quint32(RecordAlignment - 1);
+}
+
+// Sets the bits of a NUL-padded device name in a block device filter. The
+// RecordDeviceFilterHashes bit positions are taken from a single 64 bit
+// hash of the name.
+inline void recordDeviceBits(const char *deviceName, quint64 *filter) {
+    quint64 h = Q_UINT64_C(14695981039346656037);  // FNV-1a
+    for (int i = 0; i < RecordDeviceNameSize; ++i) {
+        h ^= quint8(deviceName[i]);
+        h *= Q_UINT64_C(1099511628211);
+    }
+    h ^= h >> 33;  // mix the high bits into the low bits
+    h *= Q_UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    for (int i = 0; i < RecordDeviceFilterHashes; ++i) {
+        const int bit = int(h % (RecordDeviceFilterWords * 64));
+        h /= RecordDeviceFilterWords * 64;
+        filter[bit / 64] |= Q_UINT64_C(1) << (bit % 64);
+    }
+}
+
+// Parses the error code at the beginning of the data of a reply message.
+inline bool recordReplyErrorCode(const char *data, int size, int *code) {
+    int i = 0;
+    while (i < size && data[i] == ' ')
+        i++;
+    bool neg = i < size && data[i] == '-';
+    if (neg)
+        i++;
+    int start = i, value = 0;
+    while (i < size && data[i] >= '0' && data[i] <= '9' && i - start < 9)
+        value = 10 * value + (data[i++] - '0');
+    if (i == start || (i < size && data[i] != ' '))
+        return false;
+    *code = neg ? -value : value;
+    return true;
+}
+
+#endif // DCPHUB_RECORDFORMAT_H
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "recordreader.h"
+#include "dcphub/dcppacket.h"
+#include <dcpclient/message.h>
+#include <QtCore>
+
+static QTextStream cout(stdout, QIODevice::WriteOnly);
+static QTextStream cerr(stderr, QIODevice::WriteOnly);
+
+static QByteArray deviceKey(const QString &deviceName)
+{
+    QByteArray key = QByteArray::fromPercentEncoding(deviceName.toLatin1());
+    key = key.leftJustified(MessageDeviceNameSize, '\0', true);
+    return key;
+}
+
+static QString formatTime(qint64 ns)
+{
+    QDateTime dt = QDateTime::fromMSecsSinceEpoch(ns / 1000000).toUTC();
+    return dt.toString("yyyy-MM-ddThh:mm:ss.") +
+            QString("%1").arg((ns / 1000) % 1000000, 6, 10, QChar('0'));
+}
+
+class CmdLineOptions
+{
+public:
+    CmdLineOptions()
+        : verbose(false),
+          help(false)
+    {
+    }
+
+    bool parse()
+    {
+        QString appName = qApp->applicationName();
+        QStringList args = qApp->arguments();
+        for (QStringList::const_iterator it = args.begin()+1;
+             it != args.end(); ++it)
+        {
+            if (*it == "-h" || *it == "--help" || *it == "-help") {
+                printHelp();
+                help = true;
+                return true;
+            }
+            else if (*it == "-f" || *it == "-t") {
+                QString opt = *it;
+                if (++it == args.end()) {
+                    printReqArg(opt);
+                    return false;
+                }
+
+                qint64 value = RecordReader::parseTime(*it);
+                if (value < 0) {
+                    cerr << appName << ": argument of option `" << opt
+                         << "' must be a time in ISO format or in seconds "
+                         << "since the epoch.\n" << moreInfo() << endl;
+                    return false;
+                }
+
+                if (opt == "-f")
+                    query.from = value;
+                else
+                    query.to = value;
+            }
+            else if (*it == "-a" || *it == "-b" || *it == "-s" ||
+                     *it == "-d") {
+                QString opt = *it;
+                if (++it == args.end()) {
+                    printReqArg(opt);
+                    return false;
+                }
+
+                QByteArray key = deviceKey(*it);
+                if (opt == "-a")
+                    query.deviceA = key;
+                else if (opt == "-b")
+                    query.deviceB = key;
+                else if (opt == "-s")
+                    query.source = key;
+                else
+                    query.destination = key;
+            }
+            else if (*it == "-r") {
+                query.repliesOnly = true;
+            }
+            else if (*it == "-e") {
+                query.errorsOnly = true;
+            }
+            else if (*it == "-v") {
+                verbose = true;
+            }
+            else if (it->startsWith('-')) {
+                cerr << appName << ": unknown option `" << *it << "'.\n"
+                     << moreInfo() << endl;
+                return false;
+            }
+            else if (dirName.isEmpty())
+                dirName = *it;
+            else {
+                cerr << appName
+                     << ": invalid argument specified.\n"
+                     << moreInfo() << endl;
+                return false;
+            }
+        }
+
+        if (dirName.isEmpty()) {
+            cerr << appName << ": No recording directory specified.\n"
+                 << moreInfo() << endl;
+            return false;
+        }
+
+        if (!query.deviceB.isEmpty() && query.deviceA.isEmpty()) {
+            query.deviceA = query.deviceB;
+            query.deviceB.clear();
+        }
+
+        return true;
+    }
+
+    static void printHelp() {
+        cout << "Usage: " << qApp->applicationName()
+             << " [-f from] [-t to] [-a dev [-b dev]] [-s src] [-d dst]"
+             << " [-r] [-e] [-v] dir\n\n"
+             << "  -f, -t  time range (UTC in ISO format or Unix time)\n"
+             << "  -a, -b  messages from or to dev, or between two devices\n"
+             << "  -s, -d  messages from src or to dst\n"
+             << "  -r      reply messages only\n"
+             << "  -e      reply messages with error code > 0 only\n"
+             << "  -v      print the number of read and skipped blocks"
+             << endl;
+    }
+
+    static void printReqArg(const QString &optionName) {
+        cerr << qApp->applicationName() << ": option `" << optionName
+             << "' requires an argument.\n" << moreInfo() << endl;
+    }
+
+    static QString moreInfo() {
+        return QString("Try `%1 --help' for more information.")
+                .arg(qApp->applicationName());
+    }
+
+    QString dirName;
+    RecordReader::Query query;
+    bool verbose;
+    bool help;
+};
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName(QFileInfo(app.arguments()[0]).fileName());
+
+    CmdLineOptions opts;
+    if (!opts.parse()) return 1;
+    else if (opts.help) return 0;
+
+    RecordReader reader;
+    if (!reader.open(opts.dirName)) {
+        cerr << "Error: " << reader.errorString() << "." << endl;
+        return 1;
+    }
+    reader.setQuery(opts.query);
+
+    RecordHeader header;
+    QByteArray packet;
+    int count = 0;
+    while (reader.readNext(&header, &packet)) {
+        Dcp::Message msg = Dcp::Message::fromByteArray(
+                    packet.mid(PacketHeaderSize));
+        cout << formatTime(header.timestamp) << " #" << header.connectionId
+             << "  " << msg << "\n";
+        count++;
+    }
+    cout.flush();
+
+    if (opts.verbose)
+        cerr << count << " message(s), " << reader.blocksRead()
+             << " block(s) read, " << reader.blocksSkipped()
+             << " block(s) skipped." << endl;
+
+    return 0;
+}
@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "recordreader.h"
+#include "dcphub/dcppacket.h"
+#include <QFile>
+#include <QDir>
+#include <QDateTime>
+#include <QStringList>
+#include <QtAlgorithms>
+#include <cstring>
+
+RecordReader::Query::Query()
+    : from(Q_INT64_C(0)),
+      to(Q_INT64_C(0x7fffffffffffffff)),
+      repliesOnly(false),
+      errorsOnly(false)
+{
+}
+
+RecordReader::RecordReader()
+{
+    std::memset(m_deviceFilter, 0, sizeof(m_deviceFilter));
+    rewind();
+}
+
+RecordReader::~RecordReader()
+{
+    close();
+}
+
+/*
+    Parses a UTC time in ISO format or a Unix time in seconds, as accepted
+    for the time range of a query; returns the time in ns since the Unix
+    epoch or -1 on error.
+ */
+qint64 RecordReader::parseTime(const QString &s)
+{
+    bool ok;
+    double secs = s.toDouble(&ok);
+    if (ok)
+        return secs >= 0 ? qint64(secs * 1e9) : -1;
+
+    QDateTime dt = QDateTime::fromString(s, Qt::ISODate);
+    if (!dt.isValid())
+        return -1;
+    dt.setTimeSpec(Qt::UTC);
+    return dt.toMSecsSinceEpoch() * Q_INT64_C(1000000);
+}
+
+/*
+    Maps all segments in the directory and sorts them by their sequence
+    numbers.
+ */
+bool RecordReader::open(const QString &dirName)
+{
+    close();
+
+    QDir dir(dirName);
+    if (!dir.exists()) {
+        m_errorString = QString("Directory %1 does not exist").arg(dirName);
+        return false;
+    }
+
+    QStringList fileNames = dir.entryList(
+                QStringList() << "segment-*.dcprec", QDir::Files, QDir::Name);
+    foreach (const QString &fileName, fileNames)
+    {
+        QFile *file = new QFile(dir.filePath(fileName));
+        const uchar *map = 0;
+        if (file->open(QIODevice::ReadOnly) &&
+                file->size() >= qint64(sizeof(RecordSegmentHeader)))
+            map = file->map(0, file->size());
+        if (!map) {
+            delete file;
+            continue;
+        }
+
+        const RecordSegmentHeader *header =
+                reinterpret_cast<const RecordSegmentHeader *>(map);
+        if (std::memcmp(header->magic, RecordMagic, sizeof(RecordMagic)) ||
+                header->version != RecordFormatVersion ||
+                header->segmentSize != quint64(file->size()) ||
+                header->dataEnd > header->segmentSize ||
+                header->dataStart < header->headerSize +
+                    header->blockCount * sizeof(RecordBlockIndex)) {
+            delete file;
+            continue;
+        }
+
+        Segment segment;
+        segment.file = file;
+        segment.map = map;
+        segment.header = header;
+        segment.dataEnd = header->dataEnd;
+        m_segments.append(segment);
+    }
+
+    if (m_segments.isEmpty()) {
+        m_errorString = QString("No recorded segments found in %1")
+                .arg(dirName);
+        return false;
+    }
+
+    qSort(m_segments.begin(), m_segments.end(), segmentLessThan);
+    rewind();
+    return true;
+}
+
+void RecordReader::close()
+{
+    foreach (const Segment &segment, m_segments)
+        delete segment.file;  // unmaps the segment
+    m_segments.clear();
+    rewind();
+}
+
+void RecordReader::setQuery(const Query &query)
+{
+    m_query = query;
+    std::memset(m_deviceFilter, 0, sizeof(m_deviceFilter));
+    if (!query.deviceA.isEmpty())
+        recordDeviceBits(query.deviceA.constData(), m_deviceFilter);
+    if (!query.deviceB.isEmpty())
+        recordDeviceBits(query.deviceB.constData(), m_deviceFilter);
+    if (!query.source.isEmpty())
+        recordDeviceBits(query.source.constData(), m_deviceFilter);
+    if (!query.destination.isEmpty())
+        recordDeviceBits(query.destination.constData(), m_deviceFilter);
+    rewind();
+}
+
+/*
+    Reads the next record that matches the query. Returns false if there
+    are no more matching records.
+ */
+bool RecordReader::readNext(RecordHeader *header, QByteArray *packet)
+{
+    Q_ASSERT(header);
+    Q_ASSERT(packet);
+
+    while (m_segment < m_segments.size())
+    {
+        const Segment &seg = m_segments.at(m_segment);
+        const RecordSegmentHeader *h = seg.header;
+
+        // find the next block that may contain matching records
+        if (m_offset == 0) {
+            const RecordBlockIndex *index =
+                    reinterpret_cast<const RecordBlockIndex *>(
+                        seg.map + h->headerSize);
+            if (m_block == 0 && !segmentMatches(seg))
+                m_block = h->blockCount;
+            while (m_block < h->blockCount) {
+                const RecordBlockIndex &block = index[m_block++];
+                if (block.recordCount == 0)
+                    continue;
+                if (blockMatches(block)) {
+                    m_offset = block.firstRecord;
+                    m_blockEnd = h->dataStart + m_block * RecordBlockSize;
+                    m_blocksRead++;
+                    break;
+                }
+                m_blocksSkipped++;
+            }
+            if (m_offset == 0) {
+                m_segment++;
+                m_block = 0;
+                continue;
+            }
+        }
+
+        // read the records of the current block
+        while (m_offset < m_blockEnd &&
+               m_offset + sizeof(RecordHeader) <= seg.dataEnd)
+        {
+            const RecordHeader *rec =
+                    reinterpret_cast<const RecordHeader *>(seg.map + m_offset);
+            const char *data = reinterpret_cast<const char *>(
+                        seg.map + m_offset + sizeof(RecordHeader));
+            if (m_offset + recordSize(rec->packetSize) > seg.dataEnd)
+                break;
+            m_offset += recordSize(rec->packetSize);
+
+            if (recordMatches(rec, data)) {
+                *header = *rec;
+                *packet = QByteArray(data, rec->packetSize);
+                return true;
+            }
+        }
+        m_offset = 0;
+    }
+    return false;
+}
+
+bool RecordReader::segmentLessThan(const Segment &s1, const Segment &s2)
+{
+    return s1.header->sequence < s2.header->sequence;
+}
+
+bool RecordReader::segmentMatches(const Segment &segment) const
+{
+    const RecordSegmentHeader *h = segment.header;
+    return h->recordCount > 0 && h->lastTimestamp >= m_query.from &&
+            h->firstTimestamp <= m_query.to;
+}
+
+bool RecordReader::blockMatches(const RecordBlockIndex &block) const
+{
+    if (block.lastTimestamp < m_query.from ||
+            block.firstTimestamp > m_query.to)
+        return false;
+
+    // all bits of the queried devices must be set in the block's filter
+    for (int i = 0; i < RecordDeviceFilterWords; ++i)
+        if ((block.deviceFilter[i] & m_deviceFilter[i]) != m_deviceFilter[i])
+            return false;
+
+    if (m_query.repliesOnly && !(block.flags & DcpPacket::ReplyFlag))
+        return false;
+    if (m_query.errorsOnly && !(block.flags & BlockHasErrorReplies))
+        return false;
+    return true;
+}
+
+bool RecordReader::recordMatches(const RecordHeader *rec,
+                                 const char *packet) const
+{
+    if (rec->timestamp < m_query.from || rec->timestamp > m_query.to)
+        return false;
+    if (rec->packetSize < quint32(FullHeaderSize))
+        return false;
+
+    const char *msgHeader = packet + PacketHeaderSize;
+    const char *src = msgHeader + MessageSourcePos;
+    const char *dst = msgHeader + MessageDestinationPos;
+    const Query &q = m_query;
+
+    if (!q.source.isEmpty() &&
+            std::memcmp(src, q.source.constData(), MessageDeviceNameSize))
+        return false;
+    if (!q.destination.isEmpty() &&
+            std::memcmp(dst, q.destination.constData(), MessageDeviceNameSize))
+        return false;
+
+    if (!q.deviceA.isEmpty()) {
+        const char *a = q.deviceA.constData();
+        if (q.deviceB.isEmpty()) {
+            if (std::memcmp(src, a, MessageDeviceNameSize) &&
+                    std::memcmp(dst, a, MessageDeviceNameSize))
+                return false;
+        } else {
+            const char *b = q.deviceB.constData();
+            bool ab = !std::memcmp(src, a, MessageDeviceNameSize) &&
+                      !std::memcmp(dst, b, MessageDeviceNameSize);
+            bool ba = !std::memcmp(src, b, MessageDeviceNameSize) &&
+                      !std::memcmp(dst, a, MessageDeviceNameSize);
+            if (!ab && !ba)
+                return false;
+        }
+    }
+
+    if (q.repliesOnly || q.errorsOnly) {
+        quint16 flags = qFromBigEndian(*reinterpret_cast<const quint16 *>(
+            msgHeader + MessageFlagsPos));
+        if (!(flags & DcpPacket::ReplyFlag))
+            return false;
+        int errorCode;
+        if (q.errorsOnly && !(recordReplyErrorCode(
+                packet + FullHeaderSize, rec->packetSize - FullHeaderSize,
+                &errorCode) && errorCode > 0))
+            return false;
+    }
+    return true;
+}
+
+void RecordReader::rewind()
+{
+    m_segment = 0;
+    m_block = 0;
+    m_offset = 0;
+    m_blockEnd = 0;
+    m_blocksRead = 0;
+    m_blocksSkipped = 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DCPQUERY_RECORDREADER_H
+#define DCPQUERY_RECORDREADER_H
+
+#include "dcphub/recordformat.h"
+#include <QtGlobal>
+#include <QByteArray>
+#include <QString>
+#include <QList>
+
+class QFile;
+
+// Reads the segments recorded by DcpHub. The segment files are memory
+// mapped; blocks which cannot contain matching records according to the
+// block index are skipped without being read.
+class RecordReader
+{
+public:
+    struct Query
+    {
+        Query();
+
+        qint64 from;             // time range in ns since the Unix epoch
+        qint64 to;
+        QByteArray deviceA;      // messages from or to deviceA, or between
+        QByteArray deviceB;      // deviceA and deviceB if both are set
+        QByteArray source;
+        QByteArray destination;
+        bool repliesOnly;
+        bool errorsOnly;         // replies with error code > 0
+    };
+
+    RecordReader();
+    ~RecordReader();
+
+    static qint64 parseTime(const QString &s);
+
+    bool open(const QString &dirName);
+    void close();
+    QString errorString() const { return m_errorString; }
+
+    void setQuery(const Query &query);
+    bool readNext(RecordHeader *header, QByteArray *packet);
+
+    int blocksRead() const { return m_blocksRead; }
+    int blocksSkipped() const { return m_blocksSkipped; }
+
+private:
+    Q_DISABLE_COPY(RecordReader)
+
+    struct Segment {
+        QFile *file;
+        const uchar *map;
+        const RecordSegmentHeader *header;
+        quint32 dataEnd;
+    };
+
+    static bool segmentLessThan(const Segment &s1, const Segment &s2);
+    bool segmentMatches(const Segment &segment) const;
+    bool blockMatches(const RecordBlockIndex &block) const;
+    bool recordMatches(const RecordHeader *rec, const char *packet) const;
+    void rewind();
+
+    QList<Segment> m_segments;
+    Query m_query;
+    quint64 m_deviceFilter[RecordDeviceFilterWords];  // queried devices
+    int m_segment;
+    quint32 m_block;
+    quint32 m_offset;
+    quint32 m_blockEnd;
+    int m_blocksRead;
+    int m_blocksSkipped;
+    QString m_errorString;
+};
+
+#endif // DCPQUERY_RECORDREADER_H
@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "replayworker.h"
+#include "dcpquery/recordreader.h"
+#include "dcphub/dcppacket.h"
+#include <dcpclient/message.h>
+#include <QtCore>
+
+static QTextStream cout(stdout, QIODevice::WriteOnly);
+static QTextStream cerr(stderr, QIODevice::WriteOnly);
+
+class CmdLineOptions
+{
+public:
+    CmdLineOptions()
+        : serverName("localhost"),
+          serverPort(2001),
+          speed(1.0),
+          threads(4),
+          help(false)
+    {
+    }
+
+    bool parse()
+    {
+        QString appName = qApp->applicationName();
+        QStringList args = qApp->arguments();
+        for (QStringList::const_iterator it = args.begin()+1;
+             it != args.end(); ++it)
+        {
+            if (*it == "-h" || *it == "--help" || *it == "-help") {
+                printHelp();
+                help = true;
+                return true;
+            }
+            else if (*it == "-s") {
+                if (++it == args.end()) {
+                    printReqArg("-s");
+                    return false;
+                }
+
+                serverName = *it;
+            }
+            else if (*it == "-p") {
+                if (++it == args.end()) {
+                    printReqArg("-p");
+                    return false;
+                }
+
+                bool ok;
+                ushort value = it->toUShort(&ok);
+                if (!ok) {
+                    cerr << appName << ": argument of option `-p' must be "
+                         << "an integer.\n" << moreInfo() << endl;
+                    return false;
+                }
+
+                serverPort = quint16(value);
+            }
+            else if (*it == "-x") {
+                if (++it == args.end()) {
+                    printReqArg("-x");
+                    return false;
+                }
+
+                bool ok;
+                double value = it->toDouble(&ok);
+                if (!ok || value < 0) {
+                    cerr << appName << ": argument of option `-x' must be "
+                         << "a non-negative number.\n" << moreInfo() << endl;
+                    return false;
+                }
+
+                speed = value;
+            }
+            else if (*it == "-j") {
+                if (++it == args.end()) {
+                    printReqArg("-j");
+                    return false;
+                }
+
+                bool ok;
+                int value = it->toInt(&ok);
+                if (!ok || value < 1) {
+                    cerr << appName << ": argument of option `-j' must be "
+                         << "a positive integer.\n" << moreInfo() << endl;
+                    return false;
+                }
+
+                threads = value;
+            }
+            else if (*it == "-f" || *it == "-t") {
+                QString opt = *it;
+                if (++it == args.end()) {
+                    printReqArg(opt);
+                    return false;
+                }
+
+                qint64 value = RecordReader::parseTime(*it);
+                if (value < 0) {
+                    cerr << appName << ": argument of option `" << opt
+                         << "' must be a time in ISO format or in seconds "
+                         << "since the epoch.\n" << moreInfo() << endl;
+                    return false;
+                }
+
+                if (opt == "-f")
+                    query.from = value;
+                else
+                    query.to = value;
+            }
+            else if (it->startsWith('-')) {
+                cerr << appName << ": unknown option `" << *it << "'.\n"
+                     << moreInfo() << endl;
+                return false;
+            }
+            else if (dirName.isEmpty())
+                dirName = *it;
+            else {
+                cerr << appName
+                     << ": invalid argument specified.\n"
+                     << moreInfo() << endl;
+                return false;
+            }
+        }
+
+        if (dirName.isEmpty()) {
+            cerr << appName << ": No recording directory specified.\n"
+                 << moreInfo() << endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    static void printHelp() {
+        cout << "Usage: " << qApp->applicationName()
+             << " [-s server] [-p port] [-x speed] [-j threads]"
+             << " [-f from] [-t to] dir\n\n"
+             << "  -x  speed factor, 0 replays as fast as possible\n"
+             << "  -j  number of replay threads\n"
+             << "  -f, -t  time range (UTC in ISO format or Unix time)"
+             << endl;
+    }
+
+    static void printReqArg(const QString &optionName) {
+        cerr << qApp->applicationName() << ": option `" << optionName
+             << "' requires an argument.\n" << moreInfo() << endl;
+    }
+
+    static QString moreInfo() {
+        return QString("Try `%1 --help' for more information.")
+                .arg(qApp->applicationName());
+    }
+
+    QString serverName;
+    quint16 serverPort;
+    QString dirName;
+    RecordReader::Query query;
+    double speed;
+    int threads;
+    bool help;
+};
+
+static double percentile(const QVector<qint64> &sorted, double p)
+{
+    if (sorted.isEmpty())
+        return 0.0;
+    int i = qMin(int(p * sorted.size()), sorted.size() - 1);
+    return sorted.at(i) / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName(QFileInfo(app.arguments()[0]).fileName());
+
+    CmdLineOptions opts;
+    if (!opts.parse()) return 1;
+    else if (opts.help) return 0;
+
+    RecordReader reader;
+    if (!reader.open(opts.dirName)) {
+        cerr << "Error: " << reader.errorString() << "." << endl;
+        return 1;
+    }
+    reader.setQuery(opts.query);
+
+    // Read the messages sent by devices; messages sent by the hub itself
+    // are recreated by the hub under test
+    QList<QByteArray> devices;
+    QHash<QByteArray, int> deviceIndex;
+    QList<ReplayMessage> messages;
+    RecordHeader header;
+    QByteArray packet;
+    qint64 firstTimestamp = -1, lastTimestamp = -1;
+    while (reader.readNext(&header, &packet)) {
+        if (header.connectionId == 0)
+            continue;
+        Dcp::Message msg = Dcp::Message::fromByteArray(
+                    packet.mid(PacketHeaderSize));
+        if (msg.isNull())
+            continue;
+
+        QHash<QByteArray, int>::const_iterator it =
+                deviceIndex.constFind(msg.source());
+        if (it == deviceIndex.constEnd()) {
+            it = deviceIndex.insert(msg.source(), devices.size());
+            devices.append(msg.source());
+        }
+
+        if (firstTimestamp < 0)
+            firstTimestamp = header.timestamp;
+        lastTimestamp = header.timestamp;
+
+        ReplayMessage rmsg;
+        rmsg.offset = header.timestamp - firstTimestamp;
+        rmsg.device = it.value();
+        rmsg.snr = msg.snr();
+        rmsg.destination = msg.destination();
+        rmsg.data = msg.data();
+        rmsg.flags = msg.flags();
+        messages.append(rmsg);
+    }
+    reader.close();
+
+    if (messages.isEmpty()) {
+        cerr << "Error: No messages to replay." << endl;
+        return 1;
+    }
+
+    // Distribute the devices round robin on the worker threads
+    const int threadCount = qMin(opts.threads, devices.size());
+    QList<QList<QByteArray> > workerDevices;
+    for (int i = 0; i < threadCount; ++i)
+        workerDevices.append(QList<QByteArray>());
+    for (int i = 0; i < devices.size(); ++i)
+        workerDevices[i % threadCount].append(devices.at(i));
+
+    QSemaphore semaphore;
+    QList<ReplayWorker *> workers;
+    QList<QThread *> threads;
+    for (int i = 0; i < threadCount; ++i) {
+        ReplayWorker *worker = new ReplayWorker(
+                    opts.serverName, opts.serverPort, workerDevices.at(i),
+                    &semaphore);
+        QThread *thread = new QThread;
+        worker->moveToThread(thread);
+        workers.append(worker);
+        threads.append(thread);
+    }
+    foreach (const ReplayMessage &msg, messages) {
+        ReplayMessage wmsg = msg;
+        wmsg.device = msg.device / threadCount;
+        workers.at(msg.device % threadCount)->addMessage(wmsg);
+    }
+    messages.clear();
+
+    cout << "Connecting " << devices.size() << " device(s) using "
+         << threadCount << " thread(s)..." << endl;
+    foreach (QThread *thread, threads)
+        thread->start();
+    foreach (ReplayWorker *worker, workers)
+        QMetaObject::invokeMethod(worker, "connectClients",
+                                  Qt::QueuedConnection);
+    semaphore.acquire(threadCount);
+
+    int connectionErrors = 0;
+    foreach (ReplayWorker *worker, workers)
+        connectionErrors += worker->connectionErrors();
+    if (connectionErrors > 0)
+        cerr << "Warning: " << connectionErrors
+             << " device(s) could not connect." << endl;
+
+    // Start all workers with the same time reference
+    QElapsedTimer clock;
+    clock.start();
+    foreach (ReplayWorker *worker, workers) {
+        worker->setSchedule(clock, opts.speed);
+        QMetaObject::invokeMethod(worker, "start", Qt::QueuedConnection);
+    }
+    semaphore.acquire(threadCount);
+
+    // Collect the results
+    int sent = 0;
+    qint64 elapsed = 0;
+    QVector<qint64> drift;
+    foreach (ReplayWorker *worker, workers) {
+        sent += worker->messagesSent();
+        elapsed = qMax(elapsed, worker->finishTime());
+        drift += worker->drift();
+    }
+    qSort(drift.begin(), drift.end());
+    double driftSum = 0.0;
+    foreach (qint64 d, drift)
+        driftSum += d;
+
+    const double recordedSecs = (lastTimestamp - firstTimestamp) / 1e9;
+    const double elapsedSecs = elapsed / 1e9;
+    cout << "Messages:      " << sent << "\n"
+         << "Recorded:      " << recordedSecs << " s, "
+         << (recordedSecs > 0 ? sent / recordedSecs : 0.0) << " msg/s\n"
+         << "Replayed:      " << elapsedSecs << " s, "
+         << (elapsedSecs > 0 ? sent / elapsedSecs : 0.0) << " msg/s\n"
+         << "Drift [ms]:    mean " << (drift.isEmpty() ? 0.0 :
+                                       driftSum / drift.size() / 1e6)
+         << ", p50 " << percentile(drift, 0.50)
+         << ", p99 " << percentile(drift, 0.99)
+         << ", p99.9 " << percentile(drift, 0.999)
+         << ", max " << percentile(drift, 1.0) << endl;
+
+    for (int i = 0; i < threadCount; ++i) {
+        // the clients' sockets must be deleted in the worker threads
+        QMetaObject::invokeMethod(workers.at(i), "disconnectClients",
+                                  Qt::BlockingQueuedConnection);
+        threads.at(i)->quit();
+        threads.at(i)->wait();
+        delete workers.at(i);
+        delete threads.at(i);
+    }
+
+    return 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "replayworker.h"
+#include <dcpclient/client.h>
+#include <dcpclient/message.h>
+#include <QTimer>
+#include <QSemaphore>
+
+ReplayWorker::ReplayWorker(const QString &serverName, quint16 serverPort,
+                           const QList<QByteArray> &deviceNames,
+                           QSemaphore *semaphore, QObject *parent)
+    : QObject(parent),
+      m_serverName(serverName),
+      m_serverPort(serverPort),
+      m_deviceNames(deviceNames),
+      m_semaphore(semaphore),
+      m_timer(new QTimer(this)),
+      m_speed(1.0),
+      m_next(0),
+      m_connectionErrors(0),
+      m_finishTime(0)
+{
+    m_timer->setSingleShot(true);
+    connect(m_timer, SIGNAL(timeout()), SLOT(sendDueMessages()));
+}
+
+void ReplayWorker::setSchedule(const QElapsedTimer &clock, double speed)
+{
+    m_clock = clock;
+    m_speed = speed;
+}
+
+/*
+    Creates and connects one client per device and releases the semaphore
+    when all connections are established.
+ */
+void ReplayWorker::connectClients()
+{
+    foreach (const QByteArray &deviceName, m_deviceNames) {
+        Dcp::Client *client = new Dcp::Client(this);
+        connect(client, SIGNAL(messageReceived()), SLOT(readMessages()));
+        client->connectToServer(m_serverName, m_serverPort, deviceName);
+        m_clients.append(client);
+    }
+    foreach (Dcp::Client *client, m_clients) {
+        if (!client->waitForConnected())
+            m_connectionErrors++;
+    }
+    m_semaphore->release();
+}
+
+/*
+    Disconnects and deletes all clients. This must be called in the worker's
+    thread, before the thread is stopped, because the sockets of the clients
+    belong to this thread.
+ */
+void ReplayWorker::disconnectClients()
+{
+    m_timer->stop();
+    foreach (Dcp::Client *client, m_clients) {
+        client->disconnectFromServer();
+        delete client;
+    }
+    m_clients.clear();
+}
+
+void ReplayWorker::start()
+{
+    m_drift.reserve(m_messages.size());
+    sendDueMessages();
+}
+
+/*
+    Sends all messages whose scheduled time has passed and records the
+    difference between the actual and the scheduled send time.
+ */
+void ReplayWorker::sendDueMessages()
+{
+    // return to the event loop from time to time, so that the sockets are
+    // serviced when replaying as fast as possible
+    int budget = 256;
+    while (m_next < m_messages.size())
+    {
+        const ReplayMessage &msg = m_messages.at(m_next);
+        const qint64 due = m_speed > 0 ? qint64(msg.offset / m_speed) : 0;
+        const qint64 now = nsecsElapsed(m_clock);
+        if (due > now) {
+            m_timer->start(int((due - now) / 1000000));
+            return;
+        }
+        if (budget-- == 0) {
+            m_timer->start(0);
+            return;
+        }
+
+        m_clients.at(msg.device)->sendMessage(
+                    msg.snr, msg.destination, msg.data, msg.flags);
+        m_drift.append(now - due);
+        m_next++;
+    }
+    finish();
+}
+
+void ReplayWorker::readMessages()
+{
+    Dcp::Client *client = qobject_cast<Dcp::Client *>(sender());
+    if (!client)
+        return;
+
+    // replies to the replayed messages are discarded
+    while (client->messagesAvailable() > 0)
+        client->readMessage();
+}
+
+qint64 ReplayWorker::nsecsElapsed(const QElapsedTimer &timer)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(4, 8, 0)
+    return timer.nsecsElapsed();
+#else
+    return timer.elapsed() * Q_INT64_C(1000000);
+#endif
+}
+
+void ReplayWorker::finish()
+{
+    foreach (Dcp::Client *client, m_clients)
+        client->waitForMessagesWritten();
+    m_finishTime = nsecsElapsed(m_clock);
+    m_semaphore->release();
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DCPREPLAY_REPLAYWORKER_H
+#define DCPREPLAY_REPLAYWORKER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QString>
+#include <QList>
+#include <QVector>
+#include <QElapsedTimer>
+
+class QTimer;
+class QSemaphore;
+
+namespace Dcp {
+    class Client;
+}
+
+struct ReplayMessage
+{
+    qint64 offset;          // time since the first message in ns
+    int device;             // index into the worker's device list
+    quint32 snr;
+    QByteArray destination;
+    QByteArray data;
+    quint16 flags;
+};
+
+// Replays the messages of a set of devices. Each worker lives in its own
+// thread and owns one Dcp::Client per device.
+class ReplayWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    ReplayWorker(const QString &serverName, quint16 serverPort,
+                 const QList<QByteArray> &deviceNames,
+                 QSemaphore *semaphore, QObject *parent = 0);
+
+    void addMessage(const ReplayMessage &msg) { m_messages.append(msg); }
+    int messageCount() const { return m_messages.size(); }
+
+    // must be called before start() is invoked; speed 0 means as fast as
+    // possible
+    void setSchedule(const QElapsedTimer &clock, double speed);
+
+    // results, valid after the worker has finished
+    int connectionErrors() const { return m_connectionErrors; }
+    int messagesSent() const { return m_next; }
+    const QVector<qint64> & drift() const { return m_drift; }
+    qint64 finishTime() const { return m_finishTime; }
+
+public slots:
+    void connectClients();
+    void start();
+    void disconnectClients();
+
+protected slots:
+    void sendDueMessages();
+    void readMessages();
+
+private:
+    static qint64 nsecsElapsed(const QElapsedTimer &timer);
+    void finish();
+
+    QString m_serverName;
+    quint16 m_serverPort;
+    QList<QByteArray> m_deviceNames;
+    QList<Dcp::Client *> m_clients;
+    QList<ReplayMessage> m_messages;
+    QSemaphore *m_semaphore;
+    QTimer * const m_timer;
+    QElapsedTimer m_clock;
+    double m_speed;
+    int m_next;
+    int m_connectionErrors;
+    QVector<qint64> m_drift;
+    qint64 m_finishTime;
+};
+
+#endif // DCPREPLAY_REPLAYWORKER_H
@@ -23,6 +23,7 @@
  * OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include "loadgen.h"
 #include <dcpclient/client.h>
 #include <dcpclient/message.h>
 #include <QtCore>
@@ -46,6 +47,7 @@ public:
           deviceName("dcpsend"),
           delay(50),
           minConnectionTime(2000),
+          loadMode(false),
           verbose(false),
           help(false)
     {
@@ -127,6 +129,83 @@ public:
 
                 minConnectionTime = value > 0 ? value : 0;
             }
+            else if (*it == "-L") {
+                if (++it == args.end()) {
+                    printReqArg("-L");
+                    return false;
+                }
+
+                bool ok;
+                double value = it->toDouble(&ok);
+                if (!ok || value <= 0) {
+                    cerr << appName << ": argument of option `-L' must be "
+                         << "a positive number.\n" << moreInfo() << endl;
+                    return false;
+                }
+
+                load.rate = value;
+                loadMode = true;
+            }
+            else if (*it == "-c") {
+                if (++it == args.end()) {
+                    printReqArg("-c");
+                    return false;
+                }
+
+                bool ok;
+                int value = it->toInt(&ok);
+                if (!ok || value < 1) {
+                    cerr << appName << ": argument of option `-c' must be "
+                         << "a positive integer.\n" << moreInfo() << endl;
+                    return false;
+                }
+
+                load.clients = value;
+            }
+            else if (*it == "-z") {
+                if (++it == args.end()) {
+                    printReqArg("-z");
+                    return false;
+                }
+
+                if (!load.sizes.parse(*it)) {
+                    cerr << appName << ": argument of option `-z' must be "
+                         << "<n>, u:<min>:<max> or e:<mean>, with sizes "
+                         << "below " << int(SizeDistribution::MaxSize)
+                         << ".\n" << moreInfo()
+                         << endl;
+                    return false;
+                }
+            }
+            else if (*it == "-m") {
+                if (++it == args.end()) {
+                    printReqArg("-m");
+                    return false;
+                }
+
+                if (!load.mix.parse(*it)) {
+                    cerr << appName << ": argument of option `-m' must be "
+                         << "a list of <weight>:<command> pairs.\n"
+                         << moreInfo() << endl;
+                    return false;
+                }
+            }
+            else if (*it == "-T") {
+                if (++it == args.end()) {
+                    printReqArg("-T");
+                    return false;
+                }
+
+                bool ok;
+                int value = it->toInt(&ok);
+                if (!ok || value < 1) {
+                    cerr << appName << ": argument of option `-T' must be "
+                         << "a positive integer.\n" << moreInfo() << endl;
+                    return false;
+                }
+
+                load.duration = value;
+            }
             else if (*it == "-v") {
                 verbose = true;
             }
@@ -151,7 +230,16 @@ public:
     static void printHelp() {
         cout << "Usage: " << qApp->applicationName()
              << " [-s server] [-p port] [-n name] [-d delay] [-t mintime] [-v] "
-             << " dev1 [dev2 [dev3 [...]]]"
+             << " dev1 [dev2 [dev3 [...]]]\n"
+             << "       " << qApp->applicationName()
+             << " -L rate [-c clients] [-z sizes] [-m mix] [-T duration]"
+             << " [-s server] [-p port] [-n name] dev1 [dev2 [...]]\n\n"
+             << "Load generation mode:\n"
+             << "  -L  target rate in messages per second\n"
+             << "  -c  number of virtual clients\n"
+             << "  -z  payload size: <n>, u:<min>:<max> or e:<mean>\n"
+             << "  -m  command mix, e.g. \"7:get echo,3:set nop\"\n"
+             << "  -T  duration in seconds"
              << endl;
     }
 
@@ -171,6 +259,8 @@ public:
     QList<QByteArray> destList;
     int delay;
     int minConnectionTime;
+    LoadOptions load;
+    bool loadMode;
     bool verbose;
     bool help;
 };
@@ -184,6 +274,23 @@ int main(int argc, char **argv)
     if (!opts.parse()) return 1;
     else if (opts.help) return 0;
 
+    // Generate load instead of reading messages from stdin
+    if (opts.loadMode) {
+        LoadOptions load = opts.load;
+        load.serverName = opts.serverName;
+        load.serverPort = opts.serverPort;
+        load.deviceName = opts.deviceName;
+        load.destinations = opts.destList;
+
+        qsrand(uint(QDateTime::currentMSecsSinceEpoch()));
+        LoadGenerator generator(load);
+        if (!generator.connectClients())
+            return 1;
+        generator.start();
+        app.exec();
+        return generator.exitCode();
+    }
+
     // Connect to DCP server
     Dcp::Client dcp;
     dcp.connectToServer(opts.serverName, opts.serverPort, opts.deviceName);
@@ -192,6 +299,14 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    // Pace the messages to each destination instead of sleeping after each
+    // line; the messages are sent by waitForMessagesWritten()
+    quint16 flags = 0;
+    if (opts.delay > 0) {
+        dcp.setPacing(1000.0 / opts.delay);
+        flags = Dcp::Message::PaceFlag;
+    }
+
     // Stop the time since the connection was established
     QElapsedTimer stopWatch;
     stopWatch.start();
@@ -211,7 +326,7 @@ int main(int argc, char **argv)
         if (!line.isEmpty())
         {
             // Send message to all device in destList
-            Dcp::Message msg(0, opts.deviceName, "", line.toLatin1(), 0);
+            Dcp::Message msg(0, opts.deviceName, "", line.toLatin1(), flags);
             foreach (QByteArray dest, opts.destList)
             {
                 msg.setSnr(++snr);
@@ -226,9 +341,6 @@ int main(int argc, char **argv)
                 cerr << "Error: " << dcp.errorString() << endl;
                 return 1;
             }
-
-            // Wait the give time after each line
-            sleep::ms(ulong(opts.delay));
         }
 
         // Read incoming messages
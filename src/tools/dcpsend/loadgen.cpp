@@ -0,0 +1,325 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "loadgen.h"
+#include <dcpclient/client.h>
+#include <dcpclient/message.h>
+#include <dcpclient/messageparser.h>
+#include <QCoreApplication>
+#include <QStringList>
+#include <QTextStream>
+#include <QTimer>
+#include <QtAlgorithms>
+#include <cmath>
+#include <cstdio>
+
+// maximum data size of a single packet message
+enum { MaxDataSize = 0x10000 - 50 };
+
+static int randomInt(int n)
+{
+    // combine two values, RAND_MAX may be as small as 32767
+    return int(((uint(qrand()) << 15) ^ uint(qrand())) % uint(n));
+}
+
+static double randomUniform()
+{
+    return (randomInt(0x3fffffff) + 0.5) / double(0x3fffffff);
+}
+
+bool SizeDistribution::parse(const QString &spec)
+{
+    QStringList parts = spec.split(':');
+    bool ok1 = true, ok2 = true;
+    if (parts.size() == 1) {
+        m_type = Fixed;
+        m_a = parts[0].toInt(&ok1);
+    } else if (parts.size() == 3 && parts[0] == "u") {
+        m_type = Uniform;
+        m_a = parts[1].toInt(&ok1);
+        m_b = parts[2].toInt(&ok2);
+        ok2 = ok2 && m_b >= m_a;
+    } else if (parts.size() == 2 && parts[0] == "e") {
+        m_type = Exponential;
+        m_a = parts[1].toInt(&ok1);
+    } else
+        return false;
+    return ok1 && ok2 && m_a >= 0 && m_a < MaxSize && m_b < MaxSize;
+}
+
+int SizeDistribution::sample() const
+{
+    switch (m_type) {
+    case Fixed:
+        return m_a;
+    case Uniform:
+        return m_a + randomInt(m_b - m_a + 1);
+    case Exponential:
+        return qMin(int(-m_a * std::log(randomUniform())), MaxSize - 1);
+    }
+    return 0;
+}
+
+bool CommandMix::parse(const QString &spec)
+{
+    m_commands.clear();
+    m_weights.clear();
+    m_totalWeight = 0;
+    foreach (const QString &entry, spec.split(',')) {
+        int sep = entry.indexOf(':');
+        bool ok;
+        int weight = entry.left(sep).toInt(&ok);
+        QByteArray command = entry.mid(sep + 1).trimmed().toLatin1();
+        if (sep < 0 || !ok || weight <= 0 || command.isEmpty())
+            return false;
+        m_commands.append(command);
+        m_weights.append(weight);
+        m_totalWeight += weight;
+    }
+    return true;
+}
+
+QByteArray CommandMix::sample() const
+{
+    int r = randomInt(m_totalWeight);
+    for (int i = 0; i < m_commands.size(); ++i) {
+        if (r < m_weights.at(i))
+            return m_commands.at(i);
+        r -= m_weights.at(i);
+    }
+    return m_commands.last();
+}
+
+LoadGenerator::LoadGenerator(const LoadOptions &opts, QObject *parent)
+    : QObject(parent),
+      m_opts(opts),
+      m_sendTimer(new QTimer(this)),
+      m_drainTimer(new QTimer(this)),
+      m_sent(0),
+      m_endTime(0),
+      m_lastReplyTime(0),
+      m_sending(false),
+      m_errorReplies(0),
+      m_exitCode(0)
+{
+    if (m_opts.mix.isEmpty())
+        m_opts.mix.parse("1:get echo");
+    m_sendTimer->setSingleShot(true);
+    m_drainTimer->setSingleShot(true);
+    connect(m_sendTimer, SIGNAL(timeout()), SLOT(sendDueMessages()));
+    connect(m_drainTimer, SIGNAL(timeout()), SLOT(finish()));
+}
+
+/*
+    Connects the virtual clients; their device names are the configured name
+    followed by the client number.
+ */
+bool LoadGenerator::connectClients()
+{
+    for (int i = 0; i < m_opts.clients; ++i) {
+        Dcp::Client *client = new Dcp::Client(this);
+        connect(client, SIGNAL(messageReceived()), SLOT(readMessages()));
+        QByteArray name = m_opts.clients == 1 ? m_opts.deviceName :
+                m_opts.deviceName + QByteArray::number(i + 1);
+        client->connectToServer(m_opts.serverName, m_opts.serverPort, name);
+        m_clients.append(client);
+        m_pending.append(PendingHash());
+    }
+
+    QTextStream cerr(stderr, QIODevice::WriteOnly);
+    foreach (Dcp::Client *client, m_clients) {
+        if (!client->waitForConnected()) {
+            cerr << "Error: " << client->errorString() << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+void LoadGenerator::start()
+{
+    const qint64 count = qint64(m_opts.rate * m_opts.duration);
+    m_ackLatency.reserve(int(qMin(count, qint64(1 << 24))));
+    m_replyLatency.reserve(int(qMin(count, qint64(1 << 24))));
+    m_endTime = qint64(m_opts.duration) * 1000000;
+    m_sending = true;
+    m_clock.start();
+    sendDueMessages();
+}
+
+/*
+    Sends all messages whose scheduled time has passed. If the generator
+    falls behind, the missed messages are sent immediately; their latency
+    still counts from the scheduled time.
+ */
+void LoadGenerator::sendDueMessages()
+{
+    const double interval = 1e6 / m_opts.rate;
+    const int clientCount = m_clients.size();
+    const int destCount = m_opts.destinations.size();
+    int budget = 1024;
+    while (m_sending)
+    {
+        const qint64 scheduled = qint64(m_sent * interval);
+        if (scheduled >= m_endTime) {
+            m_sending = false;
+            break;
+        }
+
+        const qint64 now = usecsElapsed();
+        if (scheduled > now) {
+            m_sendTimer->start(int((scheduled - now) / 1000));
+            return;
+        }
+        if (budget-- == 0) {
+            m_sendTimer->start(0);
+            return;
+        }
+
+        const int c = int(m_sent % clientCount);
+        const QByteArray &dest =
+                m_opts.destinations.at(int((m_sent / clientCount) % destCount));
+        QByteArray data = m_opts.mix.sample();
+        // long commands must not push the message over the packet size
+        const int size = qMin(m_opts.sizes.sample(),
+                              MaxDataSize - data.size() - 1);
+        if (size > 0) {
+            data += ' ';
+            data += QByteArray(size, 'x');
+        }
+
+        Dcp::Message msg = m_clients.at(c)->sendMessage(dest, data);
+        Pending pending = { scheduled, false };
+        m_pending[c].insert(msg.snr(), pending);
+        m_sent++;
+    }
+
+    // wait for the outstanding replies
+    m_drainTimer->start(5000);
+    readMessages();
+}
+
+void LoadGenerator::readMessages()
+{
+    const qint64 now = usecsElapsed();
+    Dcp::ReplyParser parser;
+    for (int c = 0; c < m_clients.size(); ++c)
+    {
+        Dcp::Client *client = m_clients.at(c);
+        PendingHash &pendingHash = m_pending[c];
+        while (client->messagesAvailable() > 0)
+        {
+            Dcp::Message msg = client->readMessage();
+            PendingHash::iterator it = pendingHash.find(msg.snr());
+            if (it == pendingHash.end() || !parser.parse(msg))
+                continue;
+
+            if (parser.isAckReply() && !it.value().acked) {
+                m_ackLatency.append(now - it.value().scheduled);
+                it.value().acked = true;
+
+                // no reply follows a failed ACK
+                if (parser.errorCode() != 0) {
+                    m_errorReplies++;
+                    pendingHash.erase(it);
+                }
+                continue;
+            }
+
+            m_replyLatency.append(now - it.value().scheduled);
+            if (parser.errorCode() != 0)
+                m_errorReplies++;
+            m_lastReplyTime = now;
+            pendingHash.erase(it);
+        }
+    }
+
+    if (!m_sending && m_drainTimer->isActive()) {
+        foreach (const PendingHash &pendingHash, m_pending)
+            if (!pendingHash.isEmpty())
+                return;
+        finish();
+    }
+}
+
+void LoadGenerator::finish()
+{
+    m_sendTimer->stop();
+    m_drainTimer->stop();
+
+    int outstanding = 0;
+    foreach (const PendingHash &pendingHash, m_pending)
+        outstanding += pendingHash.size();
+
+    QTextStream cout(stdout, QIODevice::WriteOnly);
+    const double sendSecs = qMin(usecsElapsed(), m_endTime) / 1e6;
+    const double replySecs = m_lastReplyTime / 1e6;
+    cout << "Sent:           " << m_sent << " messages in " << sendSecs
+         << " s (" << (sendSecs > 0 ? m_sent / sendSecs : 0.0)
+         << " msg/s, target " << m_opts.rate << " msg/s)\n"
+         << "Replies:        " << m_replyLatency.size() << " ("
+         << m_errorReplies << " with error), " << outstanding
+         << " outstanding\n"
+         << "Throughput:     "
+         << (replySecs > 0 ? m_replyLatency.size() / replySecs : 0.0)
+         << " replies/s" << endl;
+    printPercentiles("ACK latency", m_ackLatency);
+    printPercentiles("Reply latency", m_replyLatency);
+
+    foreach (Dcp::Client *client, m_clients)
+        client->disconnectFromServer();
+
+    m_exitCode = outstanding > 0 ? 1 : 0;
+    QCoreApplication::exit(m_exitCode);
+}
+
+qint64 LoadGenerator::usecsElapsed() const
+{
+#if QT_VERSION >= QT_VERSION_CHECK(4, 8, 0)
+    return m_clock.nsecsElapsed() / 1000;
+#else
+    return m_clock.elapsed() * 1000;
+#endif
+}
+
+void LoadGenerator::printPercentiles(const char *title,
+                                     QVector<qint64> &values)
+{
+    QTextStream cout(stdout, QIODevice::WriteOnly);
+    cout << QString("%1 [ms]:").arg(title).leftJustified(16);
+    if (values.isEmpty()) {
+        cout << "-" << endl;
+        return;
+    }
+
+    qSort(values.begin(), values.end());
+    const double ps[] = { 0.5, 0.9, 0.99, 0.999 };
+    const char *names[] = { "p50", "p90", "p99", "p99.9" };
+    for (int i = 0; i < 4; ++i) {
+        int idx = qMin(int(ps[i] * values.size()), values.size() - 1);
+        cout << names[i] << " " << values.at(idx) / 1000.0 << ", ";
+    }
+    cout << "max " << values.last() / 1000.0 << endl;
+}
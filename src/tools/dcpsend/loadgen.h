@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DCPSEND_LOADGEN_H
+#define DCPSEND_LOADGEN_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QString>
+#include <QList>
+#include <QHash>
+#include <QVector>
+#include <QElapsedTimer>
+
+class QTimer;
+
+namespace Dcp {
+    class Client;
+}
+
+// Payload size distribution: "<n>" (fixed), "u:<min>:<max>" (uniform) or
+// "e:<mean>" (exponential); sizes are below MaxSize, so that messages fit
+// into a single DCP packet
+class SizeDistribution
+{
+public:
+    enum { MaxSize = 0xff00 };
+
+    SizeDistribution() : m_type(Fixed), m_a(0), m_b(0) {}
+    bool parse(const QString &spec);
+    int sample() const;
+
+private:
+    enum Type { Fixed, Uniform, Exponential };
+    Type m_type;
+    int m_a, m_b;
+};
+
+// Weighted list of commands: "<weight>:<command>[,<weight>:<command>...]"
+class CommandMix
+{
+public:
+    CommandMix() : m_totalWeight(0) {}
+    bool parse(const QString &spec);
+    bool isEmpty() const { return m_commands.isEmpty(); }
+    QByteArray sample() const;
+
+private:
+    QList<QByteArray> m_commands;
+    QList<int> m_weights;
+    int m_totalWeight;
+};
+
+struct LoadOptions
+{
+    LoadOptions() : serverPort(2001), rate(100.0), clients(1), duration(10) {}
+
+    QString serverName;
+    quint16 serverPort;
+    QByteArray deviceName;
+    QList<QByteArray> destinations;
+    double rate;            // messages per second
+    int clients;
+    int duration;           // in seconds
+    SizeDistribution sizes;
+    CommandMix mix;
+};
+
+// Open-loop load generator. Messages are scheduled at fixed intervals,
+// independent of the replies; latencies are measured from the scheduled
+// send time, so that a slow server is not hidden by a late sender.
+class LoadGenerator : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit LoadGenerator(const LoadOptions &opts, QObject *parent = 0);
+
+    bool connectClients();
+    void start();
+
+    int exitCode() const { return m_exitCode; }
+
+protected slots:
+    void sendDueMessages();
+    void readMessages();
+    void finish();
+
+private:
+    struct Pending {
+        qint64 scheduled;   // scheduled send time in us
+        bool acked;
+    };
+    typedef QHash<quint32, Pending> PendingHash;
+
+    qint64 usecsElapsed() const;
+    void printPercentiles(const char *title, QVector<qint64> &values);
+
+    LoadOptions m_opts;
+    QList<Dcp::Client *> m_clients;
+    QList<PendingHash> m_pending;
+    QTimer * const m_sendTimer;
+    QTimer * const m_drainTimer;
+    QElapsedTimer m_clock;
+    qint64 m_sent;
+    qint64 m_endTime;
+    qint64 m_lastReplyTime;
+    bool m_sending;
+    QVector<qint64> m_ackLatency;
+    QVector<qint64> m_replyLatency;
+    qint64 m_errorReplies;
+    int m_exitCode;
+};
+
+#endif // DCPSEND_LOADGEN_H
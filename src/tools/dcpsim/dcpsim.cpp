@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "simthread.h"
+#include "dcphub/dcppacket.h"
+#include <QtCore>
+#include <csignal>
+#include <cstring>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <netdb.h>
+#include <unistd.h>
+
+static QTextStream cout(stdout, QIODevice::WriteOnly);
+static QTextStream cerr(stderr, QIODevice::WriteOnly);
+
+static volatile sig_atomic_t quitRequested = 0;
+
+static void exitHandler(int) {
+    quitRequested = 1;
+}
+
+class CmdLineOptions
+{
+public:
+    CmdLineOptions()
+        : serverName("localhost"),
+          serverPort(2001),
+          namePrefix("sim"),
+          deviceCount(1000),
+          threads(4),
+          statsInterval(5),
+          help(false)
+    {
+    }
+
+    bool parse()
+    {
+        QString appName = qApp->applicationName();
+        QStringList args = qApp->arguments();
+        for (QStringList::const_iterator it = args.begin()+1;
+             it != args.end(); ++it)
+        {
+            if (*it == "-h" || *it == "--help" || *it == "-help") {
+                printHelp();
+                help = true;
+                return true;
+            }
+            else if (*it == "-s") {
+                if (++it == args.end()) {
+                    printReqArg("-s");
+                    return false;
+                }
+
+                serverName = *it;
+            }
+            else if (*it == "-p") {
+                if (++it == args.end()) {
+                    printReqArg("-p");
+                    return false;
+                }
+
+                bool ok;
+                ushort value = it->toUShort(&ok);
+                if (!ok) {
+                    cerr << appName << ": argument of option `-p' must be "
+                         << "an integer.\n" << moreInfo() << endl;
+                    return false;
+                }
+
+                serverPort = quint16(value);
+            }
+            else if (*it == "-n") {
+                if (++it == args.end()) {
+                    printReqArg("-n");
+                    return false;
+                }
+
+                namePrefix = it->toLatin1();
+            }
+            else if (*it == "-N" || *it == "-j" || *it == "-i" ||
+                     *it == "-r") {
+                QString opt = *it;
+                if (++it == args.end()) {
+                    printReqArg(opt);
+                    return false;
+                }
+
+                bool ok;
+                int value = it->toInt(&ok);
+                if (!ok || value < (opt == "-i" ? 0 : 1)) {
+                    cerr << appName << ": argument of option `" << opt
+                         << "' must be a positive integer.\n"
+                         << moreInfo() << endl;
+                    return false;
+                }
+
+                if (opt == "-N")
+                    deviceCount = value;
+                else if (opt == "-j")
+                    threads = value;
+                else if (opt == "-i")
+                    sim.telemetryInterval = value;
+                else
+                    statsInterval = value;
+            }
+            else if (*it == "-G" || *it == "-S") {
+                QString opt = *it;
+                if (++it == args.end()) {
+                    printReqArg(opt);
+                    return false;
+                }
+
+                Distribution &dist = opt == "-G" ? sim.getTime : sim.setTime;
+                if (!dist.parse(*it)) {
+                    cerr << appName << ": argument of option `" << opt
+                         << "' must be <n>, u:<min>:<max> or e:<mean>.\n"
+                         << moreInfo() << endl;
+                    return false;
+                }
+            }
+            else if (*it == "-t") {
+                if (++it == args.end()) {
+                    printReqArg("-t");
+                    return false;
+                }
+
+                sim.telemetryTarget = it->toLatin1().leftJustified(
+                            MessageDeviceNameSize, '\0', true);
+            }
+            else if (it->startsWith('-')) {
+                cerr << appName << ": unknown option `" << *it << "'.\n"
+                     << moreInfo() << endl;
+                return false;
+            }
+            else {
+                cerr << appName
+                     << ": invalid argument specified.\n"
+                     << moreInfo() << endl;
+                return false;
+            }
+        }
+
+        const int digits = QString::number(deviceCount).size();
+        if (namePrefix.size() + digits > MessageDeviceNameSize) {
+            cerr << appName << ": device name prefix is too long.\n"
+                 << moreInfo() << endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    static void printHelp() {
+        cout << "Usage: " << qApp->applicationName()
+             << " [-s server] [-p port] [-n prefix] [-N devices] [-j threads]"
+             << " [-G get_time] [-S set_time] [-i interval [-t target]]"
+             << " [-r stats_interval]\n\n"
+             << "  -N  number of virtual devices\n"
+             << "  -j  number of threads\n"
+             << "  -G  service time of get commands in us:\n"
+             << "      <n>, u:<min>:<max> or e:<mean>\n"
+             << "  -S  service time of set commands in us\n"
+             << "  -i  telemetry interval in ms, 0 disables telemetry\n"
+             << "  -t  device receiving the telemetry messages\n"
+             << "  -r  statistics interval in seconds"
+             << endl;
+    }
+
+    static void printReqArg(const QString &optionName) {
+        cerr << qApp->applicationName() << ": option `" << optionName
+             << "' requires an argument.\n" << moreInfo() << endl;
+    }
+
+    static QString moreInfo() {
+        return QString("Try `%1 --help' for more information.")
+                .arg(qApp->applicationName());
+    }
+
+    QString serverName;
+    quint16 serverPort;
+    QByteArray namePrefix;
+    int deviceCount;
+    int threads;
+    int statsInterval;
+    SimOptions sim;
+    bool help;
+};
+
+static bool resolveServer(CmdLineOptions &opts)
+{
+    struct addrinfo hints, *res = 0;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    QByteArray port = QByteArray::number(opts.serverPort);
+    int err = ::getaddrinfo(opts.serverName.toLatin1().constData(),
+                            port.constData(), &hints, &res);
+    if (err != 0 || !res) {
+        cerr << "Error: Cannot resolve " << opts.serverName << ": "
+             << gai_strerror(err) << "." << endl;
+        return false;
+    }
+    std::memcpy(&opts.sim.serverAddr, res->ai_addr, res->ai_addrlen);
+    opts.sim.serverAddrLen = res->ai_addrlen;
+    ::freeaddrinfo(res);
+    return true;
+}
+
+/*
+    Raises the soft limit of open files, so that there is a socket for each
+    device, an epoll instance for each thread and some spare descriptors.
+ */
+static bool raiseFileLimit(const CmdLineOptions &opts)
+{
+    const rlim_t needed = rlim_t(opts.deviceCount) + opts.threads + 64;
+    struct rlimit limit;
+    if (::getrlimit(RLIMIT_NOFILE, &limit) < 0) {
+        cerr << "Error: Cannot get the file descriptor limit: "
+             << ::strerror(errno) << "." << endl;
+        return false;
+    }
+    if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < needed) {
+        if (limit.rlim_max != RLIM_INFINITY && limit.rlim_max < needed) {
+            cerr << "Error: " << opts.deviceCount << " devices need "
+                 << quint64(needed) << " file descriptors, but the limit is "
+                 << quint64(limit.rlim_max) << "." << endl;
+            return false;
+        }
+        limit.rlim_cur = needed;
+        if (::setrlimit(RLIMIT_NOFILE, &limit) < 0) {
+            cerr << "Error: Cannot raise the file descriptor limit to "
+                 << quint64(needed) << ": " << ::strerror(errno) << "."
+                 << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName(QFileInfo(app.arguments()[0]).fileName());
+
+    signal(SIGINT, exitHandler);
+    signal(SIGTERM, exitHandler);
+
+    CmdLineOptions opts;
+    if (!opts.parse()) return 1;
+    else if (opts.help) return 0;
+    if (!resolveServer(opts)) return 1;
+    if (!raiseFileLimit(opts)) return 1;
+
+    // Distribute the devices on the threads
+    const int threadCount = qMin(opts.threads, opts.deviceCount);
+    const int digits = QString::number(opts.deviceCount).size();
+    QList<QList<QByteArray> > threadDevices;
+    for (int i = 0; i < threadCount; ++i)
+        threadDevices.append(QList<QByteArray>());
+    for (int i = 0; i < opts.deviceCount; ++i) {
+        QByteArray name = opts.namePrefix + QString("%1")
+                .arg(i + 1, digits, 10, QChar('0')).toLatin1();
+        threadDevices[i % threadCount].append(
+                    name.leftJustified(MessageDeviceNameSize, '\0'));
+    }
+
+    SimStats stats;
+    QList<SimThread *> threads;
+    for (int i = 0; i < threadCount; ++i) {
+        SimThread *thread = new SimThread(opts.sim, threadDevices.at(i),
+                                          &stats);
+        threads.append(thread);
+        thread->start();
+    }
+    cout << "Simulating " << opts.deviceCount << " device(s) using "
+         << threadCount << " thread(s)." << endl;
+
+    // Print statistics until the program is interrupted
+    QElapsedTimer clock;
+    clock.start();
+    int lastCommands = 0, lastTelemetry = 0;
+    qint64 lastTime = 0;
+    while (!quitRequested)
+    {
+        ::usleep(100000);
+        const qint64 t = clock.elapsed();
+        if (t - lastTime < opts.statsInterval * 1000 && !quitRequested)
+            continue;
+
+        const double secs = (t - lastTime) / 1000.0;
+        const int commands = stats.commands.fetchAndAddRelaxed(0);
+        const int telemetry = stats.telemetry.fetchAndAddRelaxed(0);
+        cout << "connected " << stats.connected.fetchAndAddRelaxed(0)
+             << ", commands " << commands << " ("
+             << (commands - lastCommands) / secs << "/s), replies "
+             << stats.replies.fetchAndAddRelaxed(0) << ", telemetry "
+             << telemetry << " (" << (telemetry - lastTelemetry) / secs
+             << "/s), errors " << stats.errors.fetchAndAddRelaxed(0) << endl;
+        lastCommands = commands;
+        lastTelemetry = telemetry;
+        lastTime = t;
+    }
+
+    cout << "Shutting down..." << endl;
+    foreach (SimThread *thread, threads)
+        thread->stop();
+    foreach (SimThread *thread, threads)
+        delete thread;
+
+    return 0;
+}
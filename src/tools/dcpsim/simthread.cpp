@@ -0,0 +1,485 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "simthread.h"
+#include "dcphub/dcppacket.h"
+#include <QStringList>
+#include <QtEndian>
+#include <QDateTime>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+bool Distribution::parse(const QString &spec)
+{
+    QStringList parts = spec.split(':');
+    bool ok1 = true, ok2 = true;
+    if (parts.size() == 1) {
+        m_type = Fixed;
+        m_a = parts[0].toInt(&ok1);
+    } else if (parts.size() == 3 && parts[0] == "u") {
+        m_type = Uniform;
+        m_a = parts[1].toInt(&ok1);
+        m_b = parts[2].toInt(&ok2);
+        ok2 = ok2 && m_b >= m_a;
+    } else if (parts.size() == 2 && parts[0] == "e") {
+        m_type = Exponential;
+        m_a = parts[1].toInt(&ok1);
+    } else
+        return false;
+    return ok1 && ok2 && m_a >= 0;
+}
+
+int Distribution::sample(uint *seed) const
+{
+    switch (m_type) {
+    case Fixed:
+        return m_a;
+    case Uniform:
+        return m_a + int(rand_r(seed) % uint(m_b - m_a + 1));
+    case Exponential:
+        return int(-m_a * std::log((rand_r(seed) + 0.5) / (RAND_MAX + 1.0)));
+    }
+    return 0;
+}
+
+SimThread::SimThread(const SimOptions &opts,
+                     const QList<QByteArray> &deviceNames,
+                     SimStats *stats, QObject *parent)
+    : QThread(parent),
+      m_opts(opts),
+      m_devices(deviceNames.size()),
+      m_stats(stats),
+      m_epfd(-1),
+      m_seed(uint(QDateTime::currentMSecsSinceEpoch()) ^ quintptr(this))
+{
+    for (int i = 0; i < deviceNames.size(); ++i) {
+        Device &dev = m_devices[i];
+        dev.name = deviceNames.at(i);
+        dev.values.insert("mode", "idle");
+    }
+}
+
+SimThread::~SimThread()
+{
+    stop();
+    wait();
+}
+
+void SimThread::run()
+{
+    m_epfd = epoll_create(1024);
+    if (m_epfd < 0) {
+        m_stats->errors.fetchAndAddRelaxed(1);
+        return;
+    }
+    m_clock.start();
+
+    for (int i = 0; i < m_devices.size(); ++i)
+        connectDevice(i);
+
+    enum { MaxEvents = 256 };
+    struct epoll_event events[MaxEvents];
+    while (!m_quit.fetchAndAddAcquire(0))
+    {
+        // wait until the next scheduled event, but check for the stop
+        // request at least every 100ms
+        int timeout = 100;
+        if (!m_events.isEmpty()) {
+            qint64 wait = m_events.constBegin().key() - now();
+            timeout = int(qBound(qint64(0), (wait + 999) / 1000, qint64(100)));
+        }
+
+        int n = epoll_wait(m_epfd, events, MaxEvents, timeout);
+        for (int i = 0; i < n; ++i) {
+            const int index = int(events[i].data.u32);
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                closeDevice(index);
+                continue;
+            }
+            if (events[i].events & EPOLLIN)
+                readDevice(index);
+            if ((events[i].events & EPOLLOUT) && m_devices[index].fd >= 0) {
+                if (m_devices[index].connecting)
+                    deviceConnected(index);
+                else
+                    writeDevice(index);
+            }
+        }
+
+        // process all due events
+        const qint64 t = now();
+        while (!m_events.isEmpty() && m_events.constBegin().key() <= t) {
+            Event ev = m_events.begin().value();
+            m_events.erase(m_events.begin());
+            switch (ev.type) {
+            case ReplyEvent:
+                // drop replies to commands of a previous connection
+                if (m_devices[ev.device].connected &&
+                        m_devices[ev.device].generation == ev.generation) {
+                    sendPacket(ev.device, ev.packet);
+                    m_stats->replies.fetchAndAddRelaxed(1);
+                }
+                break;
+            case TelemetryEvent:
+                sendTelemetry(ev.device);
+                break;
+            case ReconnectEvent:
+                connectDevice(ev.device);
+                break;
+            }
+        }
+    }
+
+    for (int i = 0; i < m_devices.size(); ++i)
+        if (m_devices[i].fd >= 0)
+            closeDevice(i);
+    ::close(m_epfd);
+    m_epfd = -1;
+}
+
+qint64 SimThread::now() const
+{
+#if QT_VERSION >= QT_VERSION_CHECK(4, 8, 0)
+    return m_clock.nsecsElapsed() / 1000;
+#else
+    return m_clock.elapsed() * 1000;
+#endif
+}
+
+/*
+    Starts a non-blocking connect; the socket becomes writable when the
+    connection is established.
+ */
+void SimThread::connectDevice(int index)
+{
+    Device &dev = m_devices[index];
+    dev.fd = ::socket(m_opts.serverAddr.ss_family, SOCK_STREAM, 0);
+    if (dev.fd < 0) {
+        // e.g. EMFILE, try again later
+        m_stats->errors.fetchAndAddRelaxed(1);
+        scheduleReconnect(index);
+        return;
+    }
+    dev.generation++;
+    ::fcntl(dev.fd, F_SETFL, ::fcntl(dev.fd, F_GETFL) | O_NONBLOCK);
+    int one = 1;
+    ::setsockopt(dev.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    int res = ::connect(dev.fd,
+                        reinterpret_cast<const sockaddr *>(&m_opts.serverAddr),
+                        m_opts.serverAddrLen);
+    if (res < 0 && errno != EINPROGRESS) {
+        m_stats->errors.fetchAndAddRelaxed(1);
+        closeDevice(index);
+        return;
+    }
+
+    struct epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.u32 = quint32(index);
+    ::epoll_ctl(m_epfd, EPOLL_CTL_ADD, dev.fd, &ev);
+
+    dev.connecting = true;
+    dev.writing = true;
+    dev.inBuf.clear();
+    dev.readPos = 0;
+    dev.outBuf.clear();
+    dev.writePos = 0;
+}
+
+/*
+    Registers the device name by sending a HELO message and starts the
+    telemetry.
+ */
+void SimThread::deviceConnected(int index)
+{
+    Device &dev = m_devices[index];
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (::getsockopt(dev.fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 ||
+            error != 0) {
+        m_stats->errors.fetchAndAddRelaxed(1);
+        closeDevice(index);
+        return;
+    }
+
+    dev.connecting = false;
+    dev.connected = true;
+    setWriteInterest(index, false);
+    sendPacket(index, encodePacket(0, dev.snr++, dev.name.constData(),
+                                   QByteArray(MessageDeviceNameSize, '\0')
+                                   .constData(), "HELO"));
+    m_stats->connected.fetchAndAddRelaxed(1);
+
+    // start the telemetry with a random phase
+    if (m_opts.telemetryInterval > 0 && !m_opts.telemetryTarget.isEmpty() &&
+            !dev.telemetryScheduled) {
+        dev.telemetryScheduled = true;
+        Event tev = { TelemetryEvent, index, dev.generation, QByteArray() };
+        qint64 phase = rand_r(&m_seed) % (m_opts.telemetryInterval * 1000);
+        m_events.insertMulti(now() + phase, tev);
+    }
+}
+
+/*
+    Closes the connection of the device and schedules a reconnect.
+ */
+void SimThread::closeDevice(int index)
+{
+    Device &dev = m_devices[index];
+    if (dev.fd < 0)
+        return;
+    ::epoll_ctl(m_epfd, EPOLL_CTL_DEL, dev.fd, 0);
+    ::close(dev.fd);
+    dev.fd = -1;
+    dev.connecting = false;
+    dev.writing = false;
+    if (dev.connected) {
+        dev.connected = false;
+        m_stats->connected.fetchAndAddRelaxed(-1);
+    }
+
+    scheduleReconnect(index);
+}
+
+void SimThread::scheduleReconnect(int index)
+{
+    if (!m_quit.fetchAndAddAcquire(0)) {
+        Event ev = { ReconnectEvent, index, m_devices[index].generation,
+                     QByteArray() };
+        m_events.insertMulti(now() + 1000000, ev);
+    }
+}
+
+void SimThread::readDevice(int index)
+{
+    Device &dev = m_devices[index];
+    char buf[16384];
+    for (;;) {
+        ssize_t n = ::recv(dev.fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            dev.inBuf.append(buf, int(n));
+            continue;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK &&
+                       errno != EINTR)) {
+            closeDevice(index);
+            return;
+        }
+        if (errno != EINTR)
+            break;
+    }
+
+    // handle all complete packets
+    for (;;) {
+        const int avail = dev.inBuf.size() - dev.readPos;
+        if (avail < FullHeaderSize)
+            break;
+        const char *p = dev.inBuf.constData() + dev.readPos;
+        quint32 dataSize = qFromBigEndian(*reinterpret_cast<const quint32 *>(
+            p + PacketHeaderSize + MessageDataLenPos));
+        quint32 size = FullHeaderSize + dataSize;
+        if (size > MaxPacketSize) {
+            closeDevice(index);
+            return;
+        }
+        if (avail < int(size))
+            break;
+        handlePacket(index, p, int(size));
+        if (m_devices[index].fd < 0)
+            return;
+        dev.readPos += size;
+    }
+
+    if (dev.readPos == dev.inBuf.size()) {
+        dev.inBuf.resize(0);
+        dev.readPos = 0;
+    } else if (dev.readPos > 0x10000) {
+        dev.inBuf.remove(0, dev.readPos);
+        dev.readPos = 0;
+    }
+}
+
+void SimThread::writeDevice(int index)
+{
+    Device &dev = m_devices[index];
+    while (dev.writePos < dev.outBuf.size()) {
+        ssize_t n = ::send(dev.fd, dev.outBuf.constData() + dev.writePos,
+                           dev.outBuf.size() - dev.writePos, MSG_NOSIGNAL);
+        if (n > 0) {
+            dev.writePos += int(n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            setWriteInterest(index, true);
+            return;
+        }
+        closeDevice(index);
+        return;
+    }
+
+    dev.outBuf.resize(0);
+    dev.writePos = 0;
+    setWriteInterest(index, false);
+}
+
+/*
+    Handles a message received by a device. Commands are acknowledged at
+    once; the reply is sent after the configured service time.
+ */
+void SimThread::handlePacket(int index, const char *packet, int size)
+{
+    Device &dev = m_devices[index];
+    const char *msgHeader = packet + PacketHeaderSize;
+    const quint16 flags = qFromBigEndian(*reinterpret_cast<const quint16 *>(
+        msgHeader + MessageFlagsPos));
+    const quint32 snr = qFromBigEndian(*reinterpret_cast<const quint32 *>(
+        msgHeader + MessageSnrPos));
+    const char *source = msgHeader + MessageSourcePos;
+
+    // replies (e.g. to the telemetry messages) are ignored
+    if (flags & DcpPacket::ReplyFlag)
+        return;
+    m_stats->commands.fetchAndAddRelaxed(1);
+
+    QList<QByteArray> args = QByteArray(packet + FullHeaderSize,
+                                        size - FullHeaderSize).simplified()
+                                        .split(' ');
+    const quint16 replyFlags = flags | DcpPacket::ReplyFlag;
+    QByteArray cmd = args.value(0), id = args.value(1);
+
+    QByteArray reply;
+    Distribution *serviceTime = 0;
+    int ackCode = 0;
+    if (cmd == "get" && args.size() == 2) {
+        if (id == "time")
+            reply = QDateTime::currentDateTimeUtc().toString(
+                        "yyyy-MM-ddTHH:mm:ss.zzz").toLatin1();
+        else if (dev.values.contains(id))
+            reply = dev.values.value(id);
+        else
+            ackCode = 2;  // unknown command
+        serviceTime = &m_opts.getTime;
+    }
+    else if (cmd == "set" && args.size() == 3 && id != "time") {
+        dev.values.insert(id, args.at(2));
+        reply = "FIN";
+        serviceTime = &m_opts.setTime;
+    }
+    else if (cmd == "get" || cmd == "set")
+        ackCode = 3;  // parameter error
+    else
+        ackCode = 2;
+
+    sendPacket(index, encodePacket(replyFlags | DcpPacket::UrgentFlag, snr,
+                                   dev.name.constData(), source,
+                                   QByteArray::number(ackCode) + " ACK"));
+    if (ackCode != 0)
+        return;
+
+    Event ev = { ReplyEvent, index, dev.generation,
+                 encodePacket(replyFlags, snr, dev.name.constData(), source,
+                              "0 " + reply) };
+    int delay = serviceTime->sample(&m_seed);
+    if (delay <= 0) {
+        sendPacket(index, ev.packet);
+        m_stats->replies.fetchAndAddRelaxed(1);
+    } else
+        m_events.insertMulti(now() + delay, ev);
+}
+
+void SimThread::sendPacket(int index, const QByteArray &packet)
+{
+    Device &dev = m_devices[index];
+    if (dev.fd < 0)
+        return;
+    dev.outBuf.append(packet);
+    if (!dev.writing)
+        writeDevice(index);
+}
+
+void SimThread::sendTelemetry(int index)
+{
+    Device &dev = m_devices[index];
+    if (!dev.connected) {
+        dev.telemetryScheduled = false;
+        return;
+    }
+
+    QByteArray data = "telemetry " + QByteArray::number(dev.telemetrySeq++) +
+            " " + QByteArray::number(QDateTime::currentMSecsSinceEpoch());
+    sendPacket(index, encodePacket(0, dev.snr++, dev.name.constData(),
+                                   m_opts.telemetryTarget.constData(), data));
+    m_stats->telemetry.fetchAndAddRelaxed(1);
+
+    Event ev = { TelemetryEvent, index, dev.generation, QByteArray() };
+    m_events.insertMulti(now() + qint64(m_opts.telemetryInterval) * 1000, ev);
+}
+
+void SimThread::setWriteInterest(int index, bool enable)
+{
+    Device &dev = m_devices[index];
+    if (dev.writing == enable || dev.fd < 0)
+        return;
+    dev.writing = enable;
+
+    struct epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = enable ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    ev.data.u32 = quint32(index);
+    ::epoll_ctl(m_epfd, EPOLL_CTL_MOD, dev.fd, &ev);
+}
+
+QByteArray SimThread::encodePacket(quint16 flags, quint32 snr,
+                                   const char *source,
+                                   const char *destination,
+                                   const QByteArray &data)
+{
+    QByteArray packet(FullHeaderSize + data.size(), '\0');
+    char *p = packet.data();
+    char *msgHeader = p + PacketHeaderSize;
+    qToBigEndian(quint32(data.size()),
+                 reinterpret_cast<uchar *>(p + PacketMsgSizePos));
+    qToBigEndian(quint32(0), reinterpret_cast<uchar *>(p + PacketOffsetPos));
+    qToBigEndian(flags, reinterpret_cast<uchar *>(msgHeader + MessageFlagsPos));
+    qToBigEndian(snr, reinterpret_cast<uchar *>(msgHeader + MessageSnrPos));
+    std::memcpy(msgHeader + MessageSourcePos, source, MessageDeviceNameSize);
+    std::memcpy(msgHeader + MessageDestinationPos, destination,
+                MessageDeviceNameSize);
+    qToBigEndian(quint32(data.size()),
+                 reinterpret_cast<uchar *>(msgHeader + MessageDataLenPos));
+    std::memcpy(p + FullHeaderSize, data.constData(), data.size());
+    return packet;
+}
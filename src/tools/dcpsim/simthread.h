@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DCPSIM_SIMTHREAD_H
+#define DCPSIM_SIMTHREAD_H
+
+#include <QThread>
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QString>
+#include <QList>
+#include <QHash>
+#include <QMap>
+#include <QVector>
+#include <QElapsedTimer>
+#include <sys/socket.h>
+
+// Random distribution of service times in microseconds: "<n>" (fixed),
+// "u:<min>:<max>" (uniform) or "e:<mean>" (exponential)
+class Distribution
+{
+public:
+    Distribution() : m_type(Fixed), m_a(0), m_b(0) {}
+    bool parse(const QString &spec);
+    int sample(uint *seed) const;
+
+private:
+    enum Type { Fixed, Uniform, Exponential };
+    Type m_type;
+    int m_a, m_b;
+};
+
+struct SimOptions
+{
+    SimOptions() : serverAddrLen(0), telemetryInterval(0) {}
+
+    sockaddr_storage serverAddr;
+    socklen_t serverAddrLen;
+    Distribution getTime;
+    Distribution setTime;
+    int telemetryInterval;          // in ms, 0 disables telemetry
+    QByteArray telemetryTarget;     // NUL-padded device key
+};
+
+struct SimStats
+{
+    QAtomicInt connected;
+    QAtomicInt commands;
+    QAtomicInt replies;
+    QAtomicInt telemetry;
+    QAtomicInt errors;
+};
+
+// Drives a set of virtual devices using a single epoll instance. The
+// devices do not use any QObjects; each one is a socket with input and
+// output buffers and a small set of values, that can be queried and
+// changed with get and set commands.
+class SimThread : public QThread
+{
+public:
+    SimThread(const SimOptions &opts, const QList<QByteArray> &deviceNames,
+              SimStats *stats, QObject *parent = 0);
+    ~SimThread();
+
+    void stop() { m_quit.fetchAndStoreRelease(1); }
+
+protected:
+    void run();
+
+private:
+    Q_DISABLE_COPY(SimThread)
+
+    struct Device {
+        Device() : fd(-1), generation(0), connecting(false),
+                   connected(false), writing(false), snr(0),
+                   readPos(0), writePos(0), telemetrySeq(0),
+                   telemetryScheduled(false) {}
+        int fd;
+        quint32 generation;         // incremented for each connection
+        QByteArray name;            // NUL-padded device key
+        bool connecting;            // waiting for the connection
+        bool connected;
+        bool writing;               // waiting for EPOLLOUT
+        quint32 snr;
+        QByteArray inBuf;
+        int readPos;
+        QByteArray outBuf;
+        int writePos;
+        quint32 telemetrySeq;
+        bool telemetryScheduled;
+        QHash<QByteArray, QByteArray> values;
+    };
+
+    enum EventType { ReplyEvent, TelemetryEvent, ReconnectEvent };
+    struct Event {
+        EventType type;
+        int device;
+        quint32 generation;         // connection the event belongs to
+        QByteArray packet;
+    };
+
+    qint64 now() const;
+    void connectDevice(int index);
+    void deviceConnected(int index);
+    void closeDevice(int index);
+    void scheduleReconnect(int index);
+    void readDevice(int index);
+    void writeDevice(int index);
+    void handlePacket(int index, const char *packet, int size);
+    void sendPacket(int index, const QByteArray &packet);
+    void sendTelemetry(int index);
+    void setWriteInterest(int index, bool enable);
+    QByteArray encodePacket(quint16 flags, quint32 snr, const char *source,
+                            const char *destination, const QByteArray &data);
+
+    SimOptions m_opts;
+    QVector<Device> m_devices;
+    QMap<qint64, Event> m_events;   // scheduled events, by time in us
+    SimStats *m_stats;
+    QAtomicInt m_quit;
+    QElapsedTimer m_clock;
+    int m_epfd;
+    uint m_seed;
+};
+
+#endif // DCPSIM_SIMTHREAD_H
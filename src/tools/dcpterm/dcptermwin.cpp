@@ -42,6 +42,7 @@ DcpTermWin::DcpTermWin(const CmdLineOptions &opts, QWidget *parent)
     : QMainWindow(parent),
       ui(new Ui::DcpTermWin),
       m_dcp(new Dcp::Client),
+      m_server(new Dcp::DeviceServer(this, this)),
       m_serverPort(0),
       m_encoding("Latin1"),
       m_codec(QTextCodec::codecForName("ISO-8859-1")),
@@ -57,7 +58,7 @@ DcpTermWin::DcpTermWin(const CmdLineOptions &opts, QWidget *parent)
 
     // setup dcp client
     m_dcp->setAutoReconnect(true);
-    m_dcp->setReconnectInterval(5000);
+    m_dcp->setReconnectPolicy(Dcp::ReconnectPolicy(500, 2.0, 5000));
     dcp_stateChanged(m_dcp->state());
     connect(m_dcp, SIGNAL(stateChanged(Dcp::Client::State)),
                    SLOT(dcp_stateChanged(Dcp::Client::State)));
@@ -65,6 +66,15 @@ DcpTermWin::DcpTermWin(const CmdLineOptions &opts, QWidget *parent)
                    SLOT(dcp_error(Dcp::Client::Error)));
     connect(m_dcp, SIGNAL(messageReceived()), SLOT(dcp_messageReceived()));
 
+    // messages are read and printed by dcp_messageReceived(), which passes
+    // the commands on to the server; its answers are sent by sendAck() and
+    // sendReply()
+    m_server->addCommand(Dcp::CommandParser::SetCmd, "nop",
+                         this, SLOT(setNop(Dcp::DeviceRequest *)));
+    m_server->addCommand(Dcp::CommandParser::GetCmd, "echo",
+                         this, SLOT(getEcho(Dcp::DeviceRequest *)),
+                         0, Dcp::DeviceServer::UnlimitedArguments);
+
     // load settings from ini file, also sets m_codec
     loadSettings();
     Q_ASSERT(m_codec);
@@ -114,8 +124,13 @@ void DcpTermWin::loadSettings()
     m_dcp->setAutoReconnect(settings.value("AutoReconnect", false).toBool());
     ui->actionAutoReconnect->setChecked(m_dcp->autoReconnect());
     int reconnectInverval = settings.value("ReconnectInterval").toInt(&ok);
-    if (ok && reconnectInverval > 0)
-        m_dcp->setReconnectInterval(reconnectInverval);
+    if (ok && reconnectInverval > 0) {
+        // the interval is used as upper limit of the reconnect backoff
+        Dcp::ReconnectPolicy policy = m_dcp->reconnectPolicy();
+        policy.setInitialDelay(qMin(policy.initialDelay(), reconnectInverval));
+        policy.setMaxDelay(reconnectInverval);
+        m_dcp->setReconnectPolicy(policy);
+    }
     settings.endGroup();
 
     // UI settings (position, size, ...)
@@ -193,7 +208,8 @@ void DcpTermWin::saveSettings()
     settings.setValue("ServerPort", m_serverPort);
     settings.setValue("DeviceName", m_deviceName);
     settings.setValue("AutoReconnect", ui->actionAutoReconnect->isChecked());
-    settings.setValue("ReconnectInterval", m_dcp->reconnectInterval());
+    settings.setValue("ReconnectInterval",
+                      m_dcp->reconnectPolicy().maxDelay());
     settings.setValue("Encoding", m_encoding);
     settings.endGroup();
 
@@ -241,6 +257,17 @@ void DcpTermWin::sendMessage(const Dcp::Message &msg)
         printLine(formatMessageOutput(msg, false), Qt::blue);
 }
 
+void DcpTermWin::sendAck(const Dcp::Message &command, int errorCode)
+{
+    sendMessage(command.ackMessage(errorCode));
+}
+
+void DcpTermWin::sendReply(const Dcp::Message &command, const QByteArray &data,
+                           int errorCode)
+{
+    sendMessage(command.replyMessage(data, errorCode));
+}
+
 QByteArray DcpTermWin::normalizedDeviceName() const
 {
     QString deviceName = m_deviceName;
@@ -466,32 +493,26 @@ void DcpTermWin::dcp_messageReceived()
     else
     {
         // handle command messages sent to us
-        if (!m_command.parse(msg)) {
-            sendMessage(msg.ackMessage(Dcp::AckUnknownCommandError));
-            return;
-        }
+        m_server->handleMessage(msg);
+    }
+}
 
-        if (m_command.cmdType() == Dcp::CommandParser::SetCmd &&
-            m_command.identifier() == "nop")
-        {
-            // command: set nop
-            if (m_command.hasArguments())
-                sendMessage(msg.ackMessage(Dcp::AckParameterError));
-            else {
-                sendMessage(msg.ackMessage());
-                sendMessage(msg.replyMessage("FIN"));
-            }
-        }
-        else if (m_command.cmdType() == Dcp::CommandParser::GetCmd &&
-                 m_command.identifier() == "echo")
-        {
-            // command: get echo [args]
-            sendMessage(msg.ackMessage());
-            sendMessage(msg.replyMessage(m_command.joinedArguments()));
-        }
-        else
-            sendMessage(msg.ackMessage(Dcp::AckUnknownCommandError));
+void DcpTermWin::setNop(Dcp::DeviceRequest *request)
+{
+    // command: set nop
+    Q_UNUSED(request)
+}
+
+void DcpTermWin::getEcho(Dcp::DeviceRequest *request)
+{
+    // command: get echo [args]
+    QByteArray data;
+    foreach (const QByteArray &arg, request->arguments()) {
+        if (!data.isEmpty())
+            data += ' ';
+        data += arg;
     }
+    request->setReply(data);
 }
 
 void DcpTermWin::on_actionConnect_triggered(bool checked)
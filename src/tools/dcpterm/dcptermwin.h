@@ -28,6 +28,7 @@
 
 #include <dcpclient/client.h>
 #include <dcpclient/messageparser.h>
+#include <dcpclient/deviceserver.h>
 #include <QMainWindow>
 
 class QColor;
@@ -35,7 +36,7 @@ class QLabel;
 namespace Ui { class DcpTermWin; }
 class CmdLineOptions;
 
-class DcpTermWin : public QMainWindow
+class DcpTermWin : public QMainWindow, public Dcp::ReplySink
 {
     Q_OBJECT
 
@@ -49,6 +50,9 @@ protected:
     void closeEvent(QCloseEvent *event);
     bool verboseOutput() const;
     void sendMessage(const Dcp::Message &msg);
+    void sendAck(const Dcp::Message &command, int errorCode);
+    void sendReply(const Dcp::Message &command, const QByteArray &data,
+                   int errorCode);
     QByteArray normalizedDeviceName() const;
     void updateTextCodec();
     QString formatMessageOutput(const Dcp::Message &msg, bool incoming) const;
@@ -63,6 +67,8 @@ private slots:
     void dcp_stateChanged(Dcp::Client::State state);
     void dcp_error(Dcp::Client::Error error);
     void dcp_messageReceived();
+    void setNop(Dcp::DeviceRequest *request);
+    void getEcho(Dcp::DeviceRequest *request);
 
     // autoconnect slots
     void on_actionConnect_triggered(bool checked);
@@ -77,7 +83,7 @@ private slots:
 private:
     Ui::DcpTermWin *ui;
     Dcp::Client *m_dcp;
-    Dcp::CommandParser m_command;
+    Dcp::DeviceServer *m_server;
     Dcp::ReplyParser m_reply;
     QString m_deviceName;
     QString m_serverName;